@@ -0,0 +1,649 @@
+#! /usr/bin/perl -w
+
+# bench.pl
+#    This program benchmarks every io61 implementation in this directory:
+#    io61.c, the alternate versions (io61v2.c, io61v3.c, io61v4.c,
+#    io61_2.c, io61-mappable_version.c), stdio-io61.c and slow-io61.c.
+#    It builds each variant's test programs under bench/, runs them over
+#    a matrix of access patterns, block sizes, strides, file sizes and
+#    cache states, checks their output against the stdio variant, and
+#    prints the results as JSON. Where fincore(1) is available, each
+#    result also reports `pagecache`: the median bytes of input and
+#    output left in the page cache after a trial.
+#
+#    The `mixed` tests gather from pipes instead: MIXED_FAST producers
+#    write the input as fast as they can, and one trickles it in
+#    MIXED_PIECE-byte pieces a millisecond apart. A blocking round-robin
+#    reader (gather61) holds the fast producers to the slow one's pace;
+#    a reader that polls (pollgather61) doesn't. These results report
+#    `fastdone`: the median seconds until the fast producers finished.
+#    Output order depends on timing, so only output sizes are checked.
+#
+#    The `randline` tests fetch random lines with io61_seek_line: one
+#    scans from the start of the file for every line, the other looks
+#    lines up in a line index saved next to the input (built by the
+#    first trial).
+#
+#    The `fanout` tests copy the input to the output and to pipes read by
+#    child processes through one io61_fanout file; the `separate` tests
+#    write each block to one io61_file per sink instead.
+#
+#    The `record` tests copy batches of fixed-size records returned in
+#    place by io61_records_next; the `block` tests copy the same sizes
+#    with io61_read for comparison.
+#
+#    The report ends with a cost `model` fitted to the results; see
+#    model(). It gives each variant's seconds per byte and per system
+#    call, the input sizes at which one variant's predicted time
+#    overtakes another's for a test, and the io61 variant predicted
+#    fastest for each test at the smallest and largest sizes. Models
+#    need at least two SIZES.
+#
+#    Environment variables control the run:
+#      TRIALS=N          trials per test (default 5)
+#      SIZES=1m,8m       input file sizes (suffixes k, m, g)
+#      CACHES=warm,cold  cache states; `cold` drops the input from the
+#                        page cache before every trial
+#      VARIANTS=a,b      variants to run (default all)
+#      TESTS=a,b         test patterns to run (default all); see @cases
+#      MAXTIME=S         seconds before a run is killed (default 10)
+#      OUTPUT=FILE       write the JSON there as well as to stdout
+#      BASELINE=FILE     compare with an earlier OUTPUT and exit with
+#                        status 1 if any test regressed
+#      THRESHOLD=X       allowed median slowdown, as a fraction
+#                        (default 0.25), after scaling by the change
+#                        in stdio's time; differences under 20ms are
+#                        always allowed
+
+use Time::HiRes;
+use POSIX;
+use JSON::PP;
+use Digest::MD5;
+use List::Util qw(max);
+eval { require "syscall.ph" };
+
+my($CC) = exists($ENV{"CC"}) ? $ENV{"CC"} : "cc";
+my($TRIALS) = exists($ENV{"TRIALS"}) ? int($ENV{"TRIALS"}) : 5;
+$TRIALS = 5 if $TRIALS <= 0;
+my($MAXTIME) = exists($ENV{"MAXTIME"}) ? $ENV{"MAXTIME"} + 0 : 10;
+$MAXTIME = 10 if $MAXTIME <= 0;
+my($THRESHOLD) = exists($ENV{"THRESHOLD"}) ? $ENV{"THRESHOLD"} + 0 : 0.25;
+my($MINDELTA) = 0.02;
+my($MODEL_REACH) = 16;          # how far outside SIZES to predict
+my(@SIZES) = split(/,/, exists($ENV{"SIZES"}) ? $ENV{"SIZES"} : "1m,8m");
+my(@CACHES) = split(/,/, exists($ENV{"CACHES"}) ? $ENV{"CACHES"} : "warm,cold");
+
+# variant name => implementation sources
+my(@variants) = (
+    ["io61", "io61.c", "uring61.c", "simd61.c", "lz61.c"],
+    ["stdio", "stdio-io61.c", "simd61.c"],
+    ["slow", "slow-io61.c"],
+    ["io61v2", "io61v2.c"],
+    ["io61v3", "io61v3.c"],
+    ["io61v4", "io61v4.c"],
+    ["io61_2", "io61_2.c"],
+    ["mappable", "io61-mappable_version.c"]
+);
+if (exists($ENV{"VARIANTS"})) {
+    my(%want) = map { $_ => 1 } split(/,/, $ENV{"VARIANTS"});
+    @variants = grep { $want{$_->[0]} } @variants;
+}
+
+# test pattern => program and arguments
+my(@cases) = (
+    ["cat", "cat61"],
+    ["block512", "blockcat61", "-b", 512],
+    ["block4k", "blockcat61", "-b", 4096],
+    ["block64k", "blockcat61", "-b", 65536],
+    ["stride2", "stridecat61", "-t", 2],
+    ["stride1k", "stridecat61", "-t", 1024],
+    ["stride1m", "stridecat61", "-t", 1048576],
+    ["reverse", "reverse61"],
+    ["reorder4k", "reordercat61", "-b", 4096],
+    ["direct", "cat61", "-F", "direct"],
+    ["direct64k", "blockcat61", "-b", 65536, "-F", "direct"],
+    ["mixedgather", "gather61", "-b", 4096],
+    ["mixedpoll", "pollgather61", "-b", 4096],
+    ["randline", "randline61", "-n", 50],
+    ["randlineidx", "randline61", "-x", "-n", 50],
+    ["streamline", "streamcat61", "-l"],
+    ["stream4k", "streamcat61", "-b", 4096],
+    ["pread1", "prandblockcat61", "-j", 1, "-n", 100000],
+    ["pread4", "prandblockcat61", "-j", 4, "-n", 100000],
+    ["pread16", "prandblockcat61", "-j", 16, "-n", 100000],
+    ["fanout2", "fanout61", "-n", 2],
+    ["fanout4", "fanout61", "-n", 4],
+    ["fanout8", "fanout61", "-n", 8],
+    ["separate2", "fanout61", "-w", "-n", 2],
+    ["separate4", "fanout61", "-w", "-n", 4],
+    ["separate8", "fanout61", "-w", "-n", 8],
+    ["record16", "recordcat61", "-b", 16],
+    ["record64", "recordcat61", "-b", 64],
+    ["block16", "blockcat61", "-b", 16],
+    ["block64", "blockcat61", "-b", 64]
+);
+my(%mixed) = ("mixedgather" => 1, "mixedpoll" => 1);
+my($MIXED_FAST) = 3;
+my($MIXED_PIECE) = 16384;
+if (exists($ENV{"TESTS"})) {
+    my(%want) = map { $_ => 1 } split(/,/, $ENV{"TESTS"});
+    @cases = grep { $want{$_->[0]} } @cases;
+}
+my(%programs) = map { $_->[1] => 1 } @cases;
+
+
+sub parse_size ($) {
+    my($s) = @_;
+    my(%mult) = ("" => 1, "k" => 1 << 10, "m" => 1 << 20, "g" => 1 << 30);
+    $s =~ m{\A(\d+)([kmg]?)\z}i or die "bench.pl: bad size `$s`\n";
+    return $1 * $mult{lc($2)};
+}
+
+sub makefile ($$) {
+    my($filename, $size) = @_;
+    if (!-r $filename || !defined(-s $filename) || -s $filename != $size) {
+        while (!defined(-s $filename) || -s $filename < $size) {
+            system("cat /usr/share/dict/words >> $filename");
+        }
+        truncate($filename, $size);
+    }
+}
+
+sub decache ($) {
+    my($fn) = @_;
+    if (defined(&{"SYS_fadvise64"}) && open(DECACHE, "<", $fn)) {
+        syscall &SYS_fadvise64, fileno(DECACHE), 0, -s DECACHE, 4;
+        close(DECACHE);
+        return 1;
+    }
+    return 0;
+}
+
+my($FINCORE) = (grep { -x $_ } ("/usr/bin/fincore", "/bin/fincore"))[0];
+
+sub pagecache (@) {
+    return undef if !$FINCORE;
+    my($bytes) = 0;
+    foreach my $fn (@_) {
+        my($x) = `$FINCORE --bytes --noheadings --output RES $fn 2>/dev/null`;
+        return undef if $? != 0 || $x !~ m{\A\s*(\d+)};
+        $bytes += $1;
+    }
+    return $bytes;
+}
+
+sub file_md5sum ($) {
+    my($fn) = @_;
+    open(MD5FILE, "<", $fn) or return "";
+    binmode(MD5FILE);
+    my($x) = Digest::MD5->new->addfile(*MD5FILE)->hexdigest;
+    close(MD5FILE);
+    return $x;
+}
+
+sub percentile ($@) {
+    my($p, @x) = @_;
+    @x = sort { $a <=> $b } @x;
+    my($i) = POSIX::ceil($p * @x) - 1;
+    return $x[$i < 0 ? 0 : $i];
+}
+
+
+# build(variant)
+#    Build the test programs for one variant in bench/NAME. Returns 1 on
+#    success; on failure, prints the compiler's complaints to stderr.
+
+sub run_quiet ($) {
+    my($cmd) = @_;
+    my($out) = `$cmd 2>&1`;
+    if ($? != 0) {
+        print STDERR "bench.pl: $cmd\n$out";
+        return 0;
+    }
+    return 1;
+}
+
+sub build ($) {
+    my($v) = @_;
+    my($name, @sources) = @$v;
+    my($dir) = "bench/$name";
+    mkdir($dir) if !-d $dir;
+    my(@objs);
+    foreach my $src (@sources) {
+        my($obj) = "$dir/" . ($src =~ s/\.c\z/.o/r);
+        run_quiet("$CC -std=gnu11 -O2 -I. -c -o $obj $src") or return 0;
+        push @objs, $obj;
+    }
+    foreach my $prog (sort keys %programs) {
+        run_quiet("$CC -o $dir/$prog @objs bench/common/$prog.o bench/common/profile61.o bench/common/compat61.o -lpthread")
+            or return 0;
+    }
+    return 1;
+}
+
+
+# run_trial(program, input, output)
+#    Run one trial and return its profile (time, utime, stime, maxrss,
+#    syscr, syscw), or a hash with `error` set. `input` may be an array
+#    reference for several inputs.
+
+sub run_trial ($$$@) {
+    my($prog, $input, $output, @args) = @_;
+    my(@inputs) = ref($input) ? @$input : ($input);
+    pipe(PR, PW);
+    my($pid) = fork();
+    if ($pid == 0) {
+        close(PR);
+        POSIX::dup2(fileno(PW), 100);
+        close(PW);
+        open(STDIN, "<", "/dev/null");
+        open(STDOUT, ">", "/dev/null");
+        open(STDERR, ">", "/dev/null");
+        exec($prog, @args, "-o", $output, @inputs) or POSIX::_exit(1);
+    }
+    close(PW);
+    my($deadline) = Time::HiRes::time() + $MAXTIME;
+    my($status);
+    while (1) {
+        my($w) = waitpid($pid, WNOHANG);
+        if ($w == $pid) {
+            $status = $?;
+            last;
+        } elsif (Time::HiRes::time() > $deadline) {
+            kill 9, $pid;
+            waitpid($pid, 0);
+            close(PR);
+            return {"error" => "timeout"};
+        }
+        Time::HiRes::usleep(2000);
+    }
+    my($buf) = "";
+    POSIX::read(fileno(PR), $buf, 16384);
+    close(PR);
+    return {"error" => "exit status $status"} if $status != 0;
+    my(%p);
+    $buf =~ s/,\s*\"files\".*//s;
+    while ($buf =~ m,\"(.*?)\"\s*:\s*(-?[\d.]+),g) {
+        $p{$1} = $2 + 0;
+    }
+    return {"error" => "no profile"} if !exists($p{"time"});
+    return \%p;
+}
+
+
+# start_producers(input, fifos)
+#    Fork a producer for each of `fifos`: the first trickles `input` into
+#    its FIFO, the rest copy it as fast as they can. Each producer reports
+#    when it finished on the returned pipe handle. Returns that handle
+#    and the producers' process IDs.
+
+sub start_producers ($$) {
+    my($input, $fifos) = @_;
+    my($rd, $wr);
+    pipe($rd, $wr);
+    my(@pids);
+    for (my $i = 0; $i < @$fifos; ++$i) {
+        my($pid) = fork();
+        if ($pid == 0) {
+            close($rd);
+            open(my $in, "<", $input) or POSIX::_exit(1);
+            open(my $out, ">", $fifos->[$i]) or POSIX::_exit(1);
+            my($buf);
+            while (sysread($in, $buf, $i == 0 ? $MIXED_PIECE : 65536) > 0) {
+                while (length($buf) > 0) {
+                    my($w) = syswrite($out, $buf);
+                    POSIX::_exit(1) if !defined($w);
+                    substr($buf, 0, $w) = "";
+                }
+                Time::HiRes::usleep(1000) if $i == 0;
+            }
+            close($out);
+            syswrite($wr, "$i " . Time::HiRes::time() . "\n");
+            POSIX::_exit(0);
+        }
+        push @pids, $pid;
+    }
+    close($wr);
+    return ($rd, @pids);
+}
+
+# run_mixed_trial(program, input, output)
+#    Like run_trial, but the program gathers from FIFOs fed by
+#    start_producers, and the profile also has `fastdone`.
+
+sub run_mixed_trial ($$$@) {
+    my($prog, $input, $output, @args) = @_;
+    my(@fifos) = map { "bench/out/mixed$_.fifo" } 0..$MIXED_FAST;
+    foreach my $fifo (@fifos) {
+        unlink($fifo);
+        POSIX::mkfifo($fifo, 0600) or return {"error" => "mkfifo: $!"};
+    }
+    my($start) = Time::HiRes::time();
+    my($rd, @pids) = start_producers($input, \@fifos);
+    my($t) = run_trial($prog, \@fifos, $output, @args);
+    # Producers stuck opening a FIFO the program never opened get killed
+    kill 9, @pids if exists($t->{"error"});
+    waitpid($_, 0) foreach @pids;
+    my($fastdone) = 0;
+    while (defined(my $line = <$rd>)) {
+        my($i, $when) = split(/ /, $line);
+        $fastdone = max($fastdone, $when - $start) if $i != 0;
+    }
+    close($rd);
+    unlink(@fifos);
+    $t->{"fastdone"} = $fastdone if !exists($t->{"error"});
+    return $t;
+}
+
+
+# run_test(variant, case, input, cache, expected_md5)
+#    Run all trials of one test for one variant and summarize them.
+
+sub run_test ($$$$$) {
+    my($vname, $case, $input, $cache, $expected) = @_;
+    my($cname, $prog, @args) = @$case;
+    my($output) = "bench/out/$vname.out";
+    my($trial) = $mixed{$cname} ? \&run_mixed_trial : \&run_trial;
+    my($r) = {"variant" => $vname, "test" => $cname,
+              "size" => -s $input, "cache" => $cache,
+              "command" => join(" ", "$prog", @args)};
+    my(@trials);
+
+    # A warm trial starts with the input in the page cache
+    if ($cache eq "warm") {
+        my($t) = $trial->("bench/$vname/$prog", $input, $output, @args);
+        if (exists($t->{"error"})) {
+            $r->{"status"} = $t->{"error"};
+            return $r;
+        }
+    }
+    for (my $i = 0; $i < $TRIALS; ++$i) {
+        decache($input) if $cache eq "cold";
+        my($t) = $trial->("bench/$vname/$prog", $input, $output, @args);
+        if (exists($t->{"error"})) {
+            $r->{"status"} = $t->{"error"};
+            return $r;
+        }
+        $t->{"pagecache"} = pagecache($input, $output);
+        push @trials, $t;
+    }
+
+    my($md5) = file_md5sum($output);
+    my($outsize) = -s $output;
+    unlink($output);
+    $r->{"md5"} = $md5;
+    if ($mixed{$cname}
+        ? $outsize != ($MIXED_FAST + 1) * -s $input
+        : defined($expected) && $md5 ne $expected) {
+        $r->{"status"} = "wrong output";
+        return $r;
+    }
+    $r->{"status"} = "ok";
+    my(@times) = map { $_->{"time"} } @trials;
+    $r->{"median"} = percentile(0.5, @times);
+    $r->{"p99"} = percentile(0.99, @times);
+    $r->{"utime"} = percentile(0.5, map { $_->{"utime"} } @trials);
+    $r->{"stime"} = percentile(0.5, map { $_->{"stime"} } @trials);
+    $r->{"maxrss"} = max(map { $_->{"maxrss"} } @trials);
+    if (exists($trials[0]->{"fastdone"})) {
+        $r->{"fastdone"} = percentile(0.5, map { $_->{"fastdone"} } @trials);
+    }
+    if (defined($trials[0]->{"pagecache"})) {
+        $r->{"pagecache"} = percentile(0.5, map { $_->{"pagecache"} } @trials);
+    }
+    if (exists($trials[0]->{"syscr"}) && $trials[0]->{"syscr"} >= 0) {
+        $r->{"syscalls"} = percentile(0.5, map { $_->{"syscr"} + $_->{"syscw"} } @trials);
+    }
+    return $r;
+}
+
+
+# compare(results, baseline)
+#    Return a list of regressions relative to `baseline`. Timings are
+#    scaled by how much the stdio variant's time changed for the same test,
+#    so a busier or faster machine does not look like a regression.
+
+sub compare ($$) {
+    my($results, $baseline) = @_;
+    my(%base) = map { (join("/", @$_{"variant", "test", "size", "cache"}) => $_) }
+        @{$baseline->{"results"}};
+    my(%now) = map { (join("/", @$_{"variant", "test", "size", "cache"}) => $_) }
+        @$results;
+    my(@regressions);
+    foreach my $r (@$results) {
+        my($key) = join("/", @$r{"variant", "test", "size", "cache"});
+        my($b) = $base{$key};
+        next if !$b || $b->{"status"} ne "ok";
+        if ($r->{"status"} ne "ok") {
+            push @regressions, {"test" => $key, "reason" => $r->{"status"}};
+            next;
+        }
+        next if $r->{"variant"} eq "stdio";
+        my($skey) = join("/", "stdio", @$r{"test", "size", "cache"});
+        my($scale) = 1;
+        if ($now{$skey} && $now{$skey}->{"status"} eq "ok"
+            && $base{$skey} && $base{$skey}->{"status"} eq "ok") {
+            $scale = $now{$skey}->{"median"} / $base{$skey}->{"median"};
+        }
+        my($expected) = $b->{"median"} * $scale;
+        if ($r->{"median"} > $expected * (1 + $THRESHOLD)
+            && $r->{"median"} - $expected > $MINDELTA) {
+            push @regressions, {"test" => $key,
+                                "reason" => sprintf("median %.4fs, baseline %.4fs scaled to %.4fs (%.2fx)",
+                                                    $r->{"median"}, $b->{"median"}, $expected,
+                                                    $r->{"median"} / $expected)};
+        }
+    }
+    return @regressions;
+}
+
+
+# lsq(rows, ys)
+#    Return the coefficients x that minimize the squared error of
+#    rows * x against ys, or () if the rows don't determine them. The
+#    columns are scaled first, since bytes and seconds differ by orders
+#    of magnitude.
+
+sub lsq ($$) {
+    my($rows, $ys) = @_;
+    my($n) = scalar(@{$rows->[0]});
+    my(@scale) = map { my($i) = $_; max(map { abs($_->[$i]) } @$rows) || 1 } 0..$n-1;
+    my(@a) = map { [(0) x ($n + 1)] } 0..$n-1;
+    for (my $r = 0; $r < @$rows; ++$r) {
+        my(@x) = map { $rows->[$r][$_] / $scale[$_] } 0..$n-1;
+        for (my $i = 0; $i < $n; ++$i) {
+            $a[$i][$_] += $x[$i] * $x[$_] foreach 0..$n-1;
+            $a[$i][$n] += $x[$i] * $ys->[$r];
+        }
+    }
+    for (my $i = 0; $i < $n; ++$i) {
+        my($p) = $i;
+        for (my $k = $i + 1; $k < $n; ++$k) {
+            $p = $k if abs($a[$k][$i]) > abs($a[$p][$i]);
+        }
+        return () if abs($a[$p][$i]) < 1e-9;
+        @a[$i, $p] = @a[$p, $i];
+        for (my $k = 0; $k < $n; ++$k) {
+            next if $k == $i;
+            my($m) = $a[$k][$i] / $a[$i][$i];
+            $a[$k][$_] -= $m * $a[$i][$_] foreach $i..$n;
+        }
+    }
+    return map { $a[$_][$n] / $a[$_][$_] / $scale[$_] } 0..$n-1;
+}
+
+# fit(rows, ys)
+#    Like lsq, but no coefficient may be negative: a cost can't be. Of
+#    the fits to subsets of the columns (the others' coefficients 0)
+#    with no negative coefficient, returns the one with the smallest
+#    squared error, followed by its R^2.
+
+sub fit ($$) {
+    my($rows, $ys) = @_;
+    my($n) = scalar(@{$rows->[0]});
+    my($mean) = 0;
+    $mean += $_ / @$ys foreach @$ys;
+    my(@best, $bestsse);
+    for (my $mask = 1; $mask < (1 << $n); ++$mask) {
+        my(@cols) = grep { $mask & (1 << $_) } 0..$n-1;
+        my(@c) = lsq([map { [@$_[@cols]] } @$rows], $ys);
+        next if !@c || grep { $_ < 0 } @c;
+        my(@x) = (0) x $n;
+        @x[@cols] = @c;
+        my($sse) = 0;
+        for (my $r = 0; $r < @$rows; ++$r) {
+            my($p) = 0;
+            $p += $x[$_] * $rows->[$r][$_] foreach 0..$n-1;
+            $sse += ($ys->[$r] - $p) ** 2;
+        }
+        ($bestsse, @best) = ($sse, @x) if !defined($bestsse) || $sse < $bestsse;
+    }
+    return () if !@best;
+    my($sst) = 0;
+    $sst += ($_ - $mean) ** 2 foreach @$ys;
+    return (@best, $sst > 0 ? 1 - $bestsse / $sst : 1);
+}
+
+
+# model(results)
+#    Fit a cost model to `results`. Each variant's costs, per cache
+#    state, are time = fixed + per_byte * size + per_syscall * syscalls,
+#    fitted over all its tests (except the mixed ones, which wait for
+#    their producers). Tests differ in more than their system calls,
+#    though, so predictions use each test's own line: time = fixed +
+#    per_byte * size, fitted over the sizes run. Where two variants'
+#    lines for a test cross within a factor of MODEL_REACH of the sizes
+#    run, that is a crossover: the variant with the smaller fixed cost
+#    wins below it.
+
+sub model ($) {
+    my($results) = @_;
+    my(@ok) = grep { $_->{"status"} eq "ok" && !$mixed{$_->{"test"}} } @$results;
+    my($m) = {"fits" => [], "crossovers" => [], "best" => []};
+
+    my(%groups);
+    push @{$groups{"$_->{variant}/$_->{cache}"}}, $_
+        foreach grep { defined($_->{"syscalls"}) } @ok;
+    foreach my $key (sort keys %groups) {
+        my($g) = $groups{$key};
+        my(@x) = fit([map { [1, $_->{"size"}, $_->{"syscalls"}] } @$g],
+                     [map { $_->{"median"} } @$g]);
+        push @{$m->{"fits"}},
+            {"variant" => $g->[0]->{"variant"}, "cache" => $g->[0]->{"cache"},
+             "n" => scalar(@$g), "fixed" => $x[0], "per_byte" => $x[1],
+             "per_syscall" => $x[2], "r2" => $x[3]} if @x;
+    }
+
+    # Each test's lines: variant => [fixed, per_byte]
+    my(%tests);
+    push @{$tests{"$_->{test}/$_->{cache}"}->{$_->{"variant"}}}, $_ foreach @ok;
+    foreach my $tkey (sort keys %tests) {
+        my($test, $cache) = split(m{/}, $tkey);
+        my(%l, %sizes);
+        foreach my $v (keys %{$tests{$tkey}}) {
+            my($g) = $tests{$tkey}->{$v};
+            my(%vsizes) = map { $_->{"size"} => 1 } @$g;
+            next if keys(%vsizes) < 2;
+            my(@x) = fit([map { [1, $_->{"size"}] } @$g],
+                         [map { $_->{"median"} } @$g]);
+            next if !@x;
+            $l{$v} = \@x;
+            %sizes = (%sizes, %vsizes);
+        }
+        my(@vs) = sort keys %l;
+        my(@sizes) = sort { $a <=> $b } keys %sizes;
+        for (my $i = 0; $i < @vs; ++$i) {
+            for (my $j = $i + 1; $j < @vs; ++$j) {
+                my($p, $q) = ($l{$vs[$i]}, $l{$vs[$j]});
+                next if $p->[1] == $q->[1];
+                my($x) = ($q->[0] - $p->[0]) / ($p->[1] - $q->[1]);
+                next if $x < $sizes[0] / $MODEL_REACH
+                    || $x > $sizes[-1] * $MODEL_REACH;
+                my($below, $above) = $p->[0] < $q->[0] ? @vs[$i, $j] : @vs[$j, $i];
+                push @{$m->{"crossovers"}},
+                    {"test" => $test, "cache" => $cache, "size" => int($x),
+                     "below" => $below, "above" => $above};
+            }
+        }
+        # Which io61 strategy to prefer for this test
+        my(@io61s) = grep { $_ ne "stdio" && $_ ne "slow" } @vs;
+        foreach my $size (@io61s ? ($sizes[0], $sizes[-1]) : ()) {
+            my(@byt) = sort { $a->[1] <=> $b->[1] }
+                map { [$_, $l{$_}->[0] + $l{$_}->[1] * $size] } @io61s;
+            push @{$m->{"best"}},
+                {"test" => $test, "cache" => $cache, "size" => $size,
+                 "variant" => $byt[0]->[0], "predicted" => $byt[0]->[1]};
+        }
+    }
+    return $m;
+}
+
+
+# build everything
+for my $dir ("bench", "bench/common", "bench/out", "bench/files") {
+    mkdir($dir) if !-d $dir;
+}
+my($common_ok) = 1;
+foreach my $src ((sort keys %programs), "profile61", "compat61") {
+    $common_ok = 0 if !run_quiet("$CC -std=gnu11 -O2 -I. -c -o bench/common/$src.o $src.c");
+}
+die "bench.pl: cannot build test programs\n" if !$common_ok;
+my(%build);
+foreach my $v (@variants) {
+    $build{$v->[0]} = build($v) ? "ok" : "failed";
+    print STDERR "bench.pl: variant $v->[0] failed to build; skipping it\n"
+        if $build{$v->[0]} ne "ok";
+}
+@variants = grep { $build{$_->[0]} eq "ok" } @variants;
+
+# run the matrix
+if ((grep { $_ eq "cold" } @CACHES) && !defined(&{"SYS_fadvise64"})) {
+    print STDERR "bench.pl: cannot drop page cache here; skipping cold runs\n";
+    @CACHES = grep { $_ ne "cold" } @CACHES;
+}
+my(@results);
+foreach my $sizestr (@SIZES) {
+    my($size) = parse_size($sizestr);
+    my($input) = "bench/files/text$sizestr.txt";
+    makefile($input, $size);
+    foreach my $case (@cases) {
+        next if $case->[1] eq "reordercat61" && $size % $case->[3] != 0;
+        foreach my $cache (@CACHES) {
+            # Producers, not the program, read the input of mixed tests
+            next if $mixed{$case->[0]} && $cache eq "cold";
+            # stdio runs first; its output is the reference
+            my($expected);
+            foreach my $v (sort { ($b->[0] eq "stdio") <=> ($a->[0] eq "stdio") } @variants) {
+                print STDERR "$v->[0] $case->[0] $sizestr $cache\n";
+                my($r) = run_test($v->[0], $case, $input, $cache, $expected);
+                $expected = $r->{"md5"} if $v->[0] eq "stdio" && $r->{"status"} eq "ok";
+                push @results, $r;
+            }
+        }
+    }
+}
+
+my($report) = {"trials" => $TRIALS, "threshold" => $THRESHOLD,
+               "build" => \%build, "results" => \@results,
+               "model" => model(\@results)};
+my($status) = 0;
+if (exists($ENV{"BASELINE"})) {
+    open(BASELINE, "<", $ENV{"BASELINE"}) or die "bench.pl: $ENV{BASELINE}: $!\n";
+    my($baseline) = decode_json(join("", <BASELINE>));
+    close(BASELINE);
+    my(@regressions) = compare(\@results, $baseline);
+    $report->{"regressions"} = \@regressions;
+    foreach my $x (@regressions) {
+        print STDERR "REGRESSION: $x->{test}: $x->{reason}\n";
+    }
+    $status = 1 if @regressions;
+}
+
+my($json) = JSON::PP->new->canonical->pretty->encode($report);
+print $json;
+if (exists($ENV{"OUTPUT"})) {
+    open(OUTPUT, ">", $ENV{"OUTPUT"}) or die "bench.pl: $ENV{OUTPUT}: $!\n";
+    print OUTPUT $json;
+    close(OUTPUT);
+}
+exit($status);
@@ -1,29 +1,36 @@
 #include "io61.h"
 
-// Usage: ./blockcat61 [-b BLOCKSIZE] [-o OUTFILE] [FILE]
+// Usage: ./blockcat61 [-b BLOCKSIZE] [-o OUTFILE] [-F FLAGS] [-j THREADS]
+//                     [-k] [FILE]
 //    Copies the input FILE to standard output in blocks.
-//    Default BLOCKSIZE is 4096.
+//    Default BLOCKSIZE is 4096. With `-k` or `-j`, the copy is handed
+//    to io61_copy, which may keep the data in the kernel and split it
+//    among THREADS threads.
 
 int main(int argc, char* argv[]) {
     // Parse arguments
-    io61_arguments args = io61_parse_arguments(argc, argv, "b:o:");
+    io61_arguments args = io61_parse_arguments(argc, argv, "b:o:F:j:k");
     size_t block_size = args.block_size ? args.block_size : 4096;
 
     // Allocate buffer, open files
     char* buf = (char*) malloc(block_size);
 
     io61_profile_begin();
-    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY | args.flags);
     io61_file* outf = io61_open_check(args.output_file,
-                                      O_WRONLY | O_CREAT | O_TRUNC);
+                                      O_WRONLY | O_CREAT | O_TRUNC | args.flags);
 
     // Copy file data
-    while (1) {
-        ssize_t amount = io61_read(inf, buf, block_size);
-        if (amount <= 0)
-            break;
-        io61_write(outf, buf, amount);
-    }
+    if (args.kernel_copy || args.nthreads) {
+        io61_copy_options opts = { (size_t) -1, args.nthreads };
+        io61_copy(inf, outf, &opts);
+    } else
+        while (1) {
+            ssize_t amount = io61_read(inf, buf, block_size);
+            if (amount <= 0)
+                break;
+            io61_write(outf, buf, amount);
+        }
 
     io61_close(inf);
     io61_close(outf);
@@ -1,24 +1,41 @@
 #include "io61.h"
 
-// Usage: ./cat61 [-s SIZE] [-o OUTFILE] [FILE]
-//    Copies the input FILE to OUTFILE one character at a time.
+// Usage: ./cat61 [-s SIZE] [-o OUTFILE] [-F FLAGS] [-k] [-l] [FILE]
+//    Copies the input FILE to OUTFILE one character at a time. With
+//    `-k`, the copy is handed to io61_copy, which may keep the data in
+//    the kernel. With `-l`, it goes a line at a time with io61_readline.
 
 int main(int argc, char* argv[]) {
     // Parse arguments
-    io61_arguments args = io61_parse_arguments(argc, argv, "s:o:");
+    io61_arguments args = io61_parse_arguments(argc, argv, "s:o:F:kl");
 
     io61_profile_begin();
-    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY | args.flags);
     io61_file* outf = io61_open_check(args.output_file,
-                                      O_WRONLY | O_CREAT | O_TRUNC);
+                                      O_WRONLY | O_CREAT | O_TRUNC | args.flags);
 
-    while (args.input_size > 0) {
-        int ch = io61_readc(inf);
-        if (ch == EOF)
-            break;
-        io61_writec(outf, ch);
-        --args.input_size;
-    }
+    if (args.kernel_copy) {
+        io61_copy_options opts = { args.input_size, 0 };
+        io61_copy(inf, outf, &opts);
+    } else if (args.by_line) {
+        char buf[BUFSIZ];
+        while (args.input_size > 0) {
+            size_t n = args.input_size < sizeof(buf) ? args.input_size
+                : sizeof(buf);
+            ssize_t amount = io61_readline(inf, buf, n);
+            if (amount <= 0)
+                break;
+            io61_write(outf, buf, amount);
+            args.input_size -= amount;
+        }
+    } else
+        while (args.input_size > 0) {
+            int ch = io61_readc(inf);
+            if (ch == EOF)
+                break;
+            io61_writec(outf, ch);
+            --args.input_size;
+        }
 
     io61_close(inf);
     io61_close(outf);
@@ -7,6 +7,14 @@
 #    generating an infinite-length file, or using too much memory,
 #    check.pl will kill it.
 #
+#    `perl check.pl -S`, or IO61_STATS in the environment, also prints
+#    io61's system call and cache counts for each test.
+#
+#    `perl check.pl -C`, or IO61_CHECKSUM in the environment, has io61
+#    and stdio checksum their output as they write it. Outputs are then
+#    compared by checksum rather than by reading them back, wherever a
+#    test writes its output files in order.
+#
 #    To add tests of your own, scroll down to the bottom. It should
 #    be relatively clear what to do.
 
@@ -33,6 +41,7 @@ sub first (@) { return $_[0]; }
 my($CHECKSUM) = first(grep {-x $_} ("/usr/bin/md5sum", "/sbin/md5",
                                     "/bin/false"));
 my($VERBOSE) = exists($ENV{"VERBOSE"});
+my($CHECKSUMS) = exists($ENV{"IO61_CHECKSUM"});
 my($NOMAKE) = exists($ENV{"NOMAKE"}) && int($ENV{"NOMAKE"});
 eval { require "syscall.ph" };
 
@@ -73,6 +82,27 @@ sub makebinaryfile ($$) {
     $fileinfo{$filename} = [-M $filename, -C $filename, $size];
 }
 
+# makesparsefile(filename, size)
+#    A file with 64KB of text at the start of every megabyte and holes
+#    in between, including at the end.
+sub makesparsefile ($$) {
+    my($filename, $size) = @_;
+    if (!-r $filename || !defined(-s $filename) || -s $filename != $size) {
+        my($text) = "";
+        while (length($text) < 65536) {
+            $text .= `cat /usr/share/dict/words`;
+        }
+        open(SPARSE, ">", $filename) or die "$filename: $!\n";
+        for (my $pos = 0; $pos < $size; $pos += 1 << 20) {
+            seek(SPARSE, $pos, 0);
+            print SPARSE substr($text, 0, $size - $pos < 65536 ? $size - $pos : 65536);
+        }
+        truncate(SPARSE, $size);
+        close(SPARSE);
+    }
+    $fileinfo{$filename} = [-M $filename, -C $filename, $size];
+}
+
 sub verify_file ($) {
     my($filename) = @_;
     if (exists($fileinfo{$filename})
@@ -81,6 +111,8 @@ sub verify_file ($) {
         truncate($filename, 0);
         if ($filename =~ /^binary/) {
             makebinaryfile($filename, $fileinfo{$filename}->[2]);
+        } elsif ($filename =~ /sparse/) {
+            makesparsefile($filename, $fileinfo{$filename}->[2]);
         } else {
             makefile($filename, $fileinfo{$filename}->[2]);
         }
@@ -189,9 +221,14 @@ sub run_sh61 ($;%) {
         return $answer;
     }
 
-    $nb = POSIX::read(fileno(PR), $buf, 2000);
+    $nb = POSIX::read(fileno(PR), $buf, 16384);
     close(PR);
     $buf = $nb > 0 ? substr($buf, 0, $nb) : "";
+    # IO61_CHECKSUM output checksums, in the order the files closed
+    my(@crcs) = $buf =~ m/\"crc32c\"\s*:\s*\"([0-9a-f]+)\"/g;
+    $buf =~ s/,?\s*\"checksums\"\s*:\s*\[.*?\]//s;
+    # IO61_STATS per-file counts repeat the totals' names; skip them
+    $buf =~ s/,\s*\"files\".*//s;
 
     while ($buf =~ m,\"(.*?)\"\s*:\s*([\d.]+),g) {
         $answer->{$1} = $2;
@@ -206,20 +243,32 @@ sub run_sh61 ($;%) {
     close(OR);
 
     if ($size_limit_file && @$size_limit_file) {
-        my($len, @sums) = 0;
+        my($len, $disk, @sums) = (0, 0);
+        # Checksums from the program itself stand in for md5sum, if
+        # there is one for each output file
+        my($nfiles) = scalar(grep { $_ ne "pipe" } @$size_limit_file);
+        my($usecrcs) = $CHECKSUMS && @crcs == $nfiles && $nfiles > 0;
         foreach my $fname (@$size_limit_file) {
             my($sz) = $fname eq "pipe" ? length($out) : -s $fname;
             $len += $sz if defined($sz);
+            my(@st) = $fname eq "pipe" ? () : stat($fname);
+            $disk += $st[12] * 512 if @st;
             if ($VERBOSE && $fname eq "pipe") {
                 # XXX
-            } elsif (($VERBOSE || $MAKETRIALLOG || exists($ENV{"TRIALLOG"}))
+            } elsif (!$usecrcs
+                     && ($VERBOSE || $MAKETRIALLOG || exists($ENV{"TRIALLOG"}))
                      && -f $fname
                      && (!exists($opt{"no_content_check"}) || !$opt{"no_content_check"})) {
                 push @sums, file_md5sum($fname);
             }
         }
         $answer->{"outputsize"} = $len;
+        $answer->{"diskusage"} = $disk;
         $answer->{"md5sum"} = join(" ", @sums) if @sums;
+        if ($usecrcs && (!exists($opt{"no_content_check"}) || !$opt{"no_content_check"})) {
+            $answer->{"crc32c"} = join(" ", @crcs);
+            $answer->{"md5sum"} = "crc32c " . $answer->{"crc32c"};
+        }
     }
 
     if ($out) {
@@ -421,7 +470,12 @@ sub median_trial ($$$;$) {
                 && $tt->{"outputsize"} != $tcompar->{"outputsize"}) {
                 $tt->{"different_size"} = 1;
             }
-            if (exists($tcompar->{"content_check"})) {
+            if (exists($tcompar->{"content_check"})
+                && exists($tcompar->{"crc32c"}) && exists($tt->{"crc32c"})) {
+                $tt->{"different_content"} = " (crc32c " . $tt->{"crc32c"}
+                    . ", expected " . $tcompar->{"crc32c"} . ")"
+                    if $tt->{"crc32c"} ne $tcompar->{"crc32c"};
+            } elsif (exists($tcompar->{"content_check"})) {
                 foreach my $fname (@{$tcompar->{"content_check"}}) {
                     my($basefname) = $fname;
                     $basefname =~ s{files/}{files/base};
@@ -431,7 +485,8 @@ sub median_trial ($$$;$) {
                     $tt->{"different_content"} = " ($r)" if $?;
                 }
             }
-            if (exists($tcompar->{"md5sum_check"}) && exists($tt->{"md5sum"})) {
+            if (exists($tcompar->{"md5sum_check"}) && exists($tt->{"md5sum"})
+                && ($tcompar->{"md5sum_check"} =~ /^crc32c/) == ($tt->{"md5sum"} =~ /^crc32c/)) {
                 $tt->{"different_content"} = " (got md5sum " . $tt->{"md5sum"}
                     . ", expected " . $tcompar->{"md5sum_check"} . ")"
                     if $tcompar->{"md5sum_check"} ne $tt->{"md5sum"};
@@ -469,6 +524,16 @@ sub print_stdio ($) {
     }
 }
 
+sub print_stats ($) {
+    my($t) = @_;
+    my($nacc) = $t->{"hits"} + $t->{"misses"};
+    printf("STATS:     %d reads (%dB each), %d writes (%dB each), %d lseeks; %d fills, %d flushes, %.1f%% cache hits\n",
+           $t->{"reads"}, $t->{"reads"} ? $t->{"rbytes"} / $t->{"reads"} : 0,
+           $t->{"writes"}, $t->{"writes"} ? $t->{"wbytes"} / $t->{"writes"} : 0,
+           $t->{"seeks"}, $t->{"fills"}, $t->{"flushes"},
+           $nacc ? 100 * $t->{"hits"} / $nacc : 0);
+}
+
 sub run ($) {
     my($sequentially) = @_;
     my($number, $type) = (0, undef);
@@ -528,6 +593,9 @@ sub run ($) {
             if exists($t->{"outputsize"});
         $tcompar->{"content_check"} = $qitem->{"outfiles"}
             if !$NOYOURCODE && !$NOSTDIO && !$qitem->{"no_content_check"} && $sequentially;
+        $tcompar->{"crc32c"} = $stdiot->{"crc32c"}
+            if exists($tcompar->{"content_check"}) && $stdiot
+               && exists($stdiot->{"crc32c"});
         $tcompar->{"md5sum_check"} = $t->{"md5sum"}
             if !$NOYOURCODE && $NOSTDIO && !$qitem->{"no_content_check"} && exists($t->{"md5sum"});
         my($tt) = median_trial($number, "yourcode", $qitem, $tcompar);
@@ -540,6 +608,28 @@ sub run ($) {
                $tt->{"time"}, $tt->{"utime"}, $tt->{"stime"}, $tt->{"maxrss"},
                $tt->{"medianof"}, $tt->{"medianof"} == 1 ? "" : "s");
             push @runtimes, $tt->{"time"};
+            print_stats($tt) if exists($tt->{"reads"});
+            print "CHECKSUM:  crc32c ", $tt->{"crc32c"}, "\n"
+                if exists($tt->{"crc32c"});
+            if (exists($qitem->{"opt"}->{"maxrss"})
+                && $tt->{"maxrss"} > $qitem->{"opt"}->{"maxrss"}) {
+                print "           ${Red}ERROR: used ", $tt->{"maxrss"}, "KiB memory, limit ",
+                    $qitem->{"opt"}->{"maxrss"}, "KiB${Off}\n";
+                ++$nerror;
+            }
+            if (exists($qitem->{"opt"}->{"maxdisk"})
+                && exists($tt->{"diskusage"})) {
+                my($kib) = int($tt->{"diskusage"} / 1024);
+                printf "DISK:      %dKiB allocated for %dKiB of output%s\n",
+                    $kib, int($tt->{"outputsize"} / 1024),
+                    $stdiot && exists($stdiot->{"diskusage"})
+                    ? sprintf(" (stdio: %dKiB)", int($stdiot->{"diskusage"} / 1024)) : "";
+                if ($kib > $qitem->{"opt"}->{"maxdisk"}) {
+                    print "           ${Red}ERROR: output uses ", $kib,
+                        "KiB of disk, limit ", $qitem->{"opt"}->{"maxdisk"}, "KiB${Off}\n";
+                    ++$nerror;
+                }
+            }
         }
 
         # print stdio vs. yourcode comparison
@@ -642,6 +732,8 @@ makefile("files/text1meg.txt", 1 << 20);
 makebinaryfile("files/binary1meg.bin", 1 << 20);
 makefile("files/text5meg.txt", 5 << 20);
 makefile("files/text20meg.txt", 20 << 20);
+makefile("files/text4k.txt", 4096);
+makesparsefile("files/sparse20meg.bin", 20 << 20);
 
 $SIG{"INT"} = sub {
     kill 9, -$run61_pid if $run61_pid;
@@ -655,6 +747,11 @@ while (@ARGV) {
         $sequentially = 0;
     } elsif ($ARGV[0] eq "-V") {
         $VERBOSE = 1;
+    } elsif ($ARGV[0] eq "-S") {
+        $ENV{"IO61_STATS"} = 1;
+    } elsif ($ARGV[0] eq "-C") {
+        $ENV{"IO61_CHECKSUM"} = 1;
+        $CHECKSUMS = 1;
     } else {
         last;
     }
@@ -793,6 +890,260 @@ enqueue(28,
     "redirected large file, 1B-4KB block I/O, sequential");
 
 
+# ASYNC READ-AHEAD (cold cache: inputs are decached before each trial)
+
+enqueue(29,
+    "./cat61 -F async -o files/out.txt files/text20meg.txt",
+    "regular large file, character I/O, sequential, async read-ahead");
+
+enqueue(30,
+    "./blockcat61 -F async -o files/out.txt files/text20meg.txt",
+    "regular large file, 4KB block I/O, sequential, async read-ahead");
+
+enqueue(31,
+    "cat files/text20meg.txt | ./blockcat61 -F async | cat > files/out.txt",
+    "piped large file, 4KB block I/O, sequential, async read-ahead");
+
+
+# IO_URING BATCHING ACROSS MANY FILES
+
+enqueue(32,
+    "./gather61 -F uring -b 512 -o files/out.txt " . join(" ", ("files/text1meg.txt") x 24),
+    "24 gathered small files, 512B block I/O, sequential, io_uring");
+
+enqueue(33,
+    "./scatter61 -F uring -b 512 " . join(" ", map { "files/out$_.txt" } 1..24) . " < files/text20meg.txt",
+    "large file scattered to 24 files, 512B block I/O, sequential, io_uring");
+
+enqueue(34,
+    "./gather61 -F uring -o files/out.txt " . join(" ", ("files/text1meg.txt") x 24),
+    "24 gathered small files, character I/O, sequential, io_uring");
+
+
+# IN-PLACE READ/WRITE
+
+enqueue(35,
+    "cp files/text5meg.txt files/out.txt && ./ireordercat61 files/out.txt",
+    "regular medium file, 4KB block I/O, random seek order, in place");
+
+enqueue(36,
+    "cp files/text20meg.txt files/out.txt && ./ireordercat61 -b 1024 -r 6582 files/out.txt",
+    "regular large file, 1KB block I/O, random seek order, in place");
+
+
+# PARALLEL COPY
+
+enqueue(37,
+    "./blockcat61 -j 4 -o files/out.txt files/text20meg.txt",
+    "regular large file, io61_copy on 4 threads");
+
+enqueue(38,
+    "cat files/text20meg.txt | ./blockcat61 -j 4 | cat > files/out.txt",
+    "piped large file, io61_copy falls back to streaming");
+
+
+# KERNEL COPY
+
+enqueue(39,
+    "./cat61 -k -o files/out.txt files/text20meg.txt",
+    "regular large file, io61_copy in the kernel");
+
+enqueue(40,
+    "cat files/text20meg.txt | ./cat61 -k | cat > files/out.txt",
+    "piped large file, io61_copy with splice");
+
+enqueue(41,
+    "./cat61 -k -s 5242880 -o files/out.txt /dev/zero",
+    "size-limited magic file, io61_copy in the kernel");
+
+
+# LINE AND REVERSE BATCHING
+
+enqueue(42,
+    "./cat61 -l -o files/out.txt files/text20meg.txt",
+    "regular large file, line I/O, sequential");
+
+enqueue(43,
+    "./reverse61 -b 4096 -o files/out.txt files/text20meg.txt",
+    "regular large file, 4KB block I/O, reverse order");
+
+enqueue(44,
+    "./reverse61 -b 1000 -s 4096 -o files/out.txt /dev/urandom",
+    "seekable unmappable file, 1000B block I/O, reverse order",
+    "no_content_check" => 1);
+
+
+# REQUEST/RESPONSE OVER PIPES
+enqueue(45,
+    "./pipeexchange61 > files/out.txt",
+    "pipe request/response exchange",
+    "no_content_check" => 1);
+
+enqueue(46,
+    "./pipeexchange61 -F pipe > files/out.txt",
+    "pipe request/response exchange, low-latency pipe mode",
+    "no_content_check" => 1);
+
+# RANDOM-BLOCK BATCHES
+enqueue(47,
+    "./reordercat61 -b 1 -o files/out.txt files/text1meg.txt",
+    "regular file, 1B block batches, random seek order");
+
+enqueue(48,
+    "./reordercat61 -b 65536 -o files/out.txt files/text20meg.txt",
+    "regular large file, 64KB block batches, random seek order");
+
+enqueue(49,
+    "./reordercat61 -b 4096 -F uring -o files/out.txt files/text5meg.txt",
+    "regular file, 4KB block batches through io_uring, random seek order");
+
+# COMPRESSED FRAMES
+enqueue(50,
+    "./lzcat61 -o files/out.txt.lz files/text20meg.txt && ./lzcat61 -d -o files/out.txt files/out.txt.lz",
+    "regular large file, compress and decompress");
+
+enqueue(51,
+    "./lzcat61 -o files/out.txt.lz files/text5meg.txt && ./lzcat61 -d -b 4096 -o files/out.txt files/out.txt.lz",
+    "regular file, compress, then decompress 4KB blocks in random seek order");
+
+enqueue(52,
+    "cat files/text5meg.txt | ./lzcat61 | ./lzcat61 -d > files/out.txt",
+    "piped compress and decompress");
+
+# MANY OPEN FILES (memory-capped: `maxrss` is in KiB)
+enqueue(53,
+    "./gather61 -b 512 -o files/out.txt \$(yes files/text4k.txt | head -n 10000)",
+    "10,000 gathered tiny files, 512B block I/O, sequential, 32MB memory cap",
+    "expansion" => 10000, "maxrss" => 32768);
+
+
+# O_DIRECT
+enqueue(54,
+    "./cat61 -F direct -o files/out.txt files/text20meg.txt",
+    "regular large file, character I/O, O_DIRECT");
+
+enqueue(55,
+    "./cat61 -F direct -s 5000001 -o files/out.txt files/text20meg.txt",
+    "regular large file, size-limited to an unaligned length, O_DIRECT");
+
+enqueue(56,
+    "./randblockcat61 -F direct -o files/out.txt files/text20meg.txt",
+    "regular large file, random-size block I/O, O_DIRECT");
+
+enqueue(57,
+    "cat files/text5meg.txt | ./blockcat61 -F direct -b 1000 -o files/out.txt",
+    "piped medium file to regular file, 1000B block I/O, O_DIRECT output");
+
+
+# NONBLOCKING INPUTS IN READINESS ORDER (output lines are sorted, since
+# their order depends on timing)
+enqueue(58,
+    "rm -f files/slow.fifo files/fast.fifo; mkfifo files/slow.fifo files/fast.fifo; (sleep 0.3; cat files/text1meg.txt; echo) > files/slow.fifo & (cat files/text5meg.txt; echo) > files/fast.fifo & ./pollgather61 -l files/slow.fifo files/fast.fifo | sort > files/out.txt",
+    "slow and fast piped files, gathered by lines as they are ready");
+
+enqueue(59,
+    "rm -f files/slow.fifo files/fast.fifo files/fast2.fifo; mkfifo files/slow.fifo files/fast.fifo files/fast2.fifo; (for i in 1 2 3 4 5 6 7 8 9 10; do sleep 0.02; head -c 100000 files/text1meg.txt; done; echo) > files/slow.fifo & (cat files/text20meg.txt; echo) > files/fast.fifo & (cat files/text5meg.txt; echo) > files/fast2.fifo & ./pollgather61 -l -b 65536 files/slow.fifo files/fast.fifo files/fast2.fifo | sort > files/out.txt",
+    "trickling and fast piped files, gathered by 64KB of lines as they are ready");
+
+
+# SPARSE FILES (disk-capped: `maxdisk` is in KiB of allocated blocks;
+# the input has 1.25MB of data in 20MB)
+enqueue(60,
+    "./cat61 -o files/out.bin files/sparse20meg.bin",
+    "sparse large file, character I/O, holes kept",
+    "maxdisk" => 4096);
+
+enqueue(61,
+    "./blockcat61 -b 65536 -o files/out.bin files/sparse20meg.bin",
+    "sparse large file, 64KB block I/O, holes kept",
+    "maxdisk" => 4096);
+
+enqueue(62,
+    "./cat61 -k -o files/out.bin files/sparse20meg.bin",
+    "sparse large file, kernel copy, holes kept",
+    "maxdisk" => 4096);
+
+
+# RANDOM LINES (FILE.lx61 holds a line index; without -x, every fetch
+# scans from the start of the file)
+enqueue(63,
+    "./lineindex61 files/text20meg.txt && ./randline61 -x -n 20000 -o files/out.txt files/text20meg.txt",
+    "regular large file, 20000 random lines through a saved line index");
+
+enqueue(64,
+    "rm -f files/text5meg.txt.lx61; ./randline61 -x -b 64 -n 20000 -o files/out.txt files/text5meg.txt",
+    "regular medium file, 20000 random lines, line index every 64 lines built on demand");
+
+enqueue(65,
+    "./randline61 -n 50 -o files/out.txt files/text5meg.txt",
+    "regular medium file, 50 random lines, no line index");
+
+
+# FILE* STREAMS FROM io61_fopen (the stdio version uses plain fopen)
+enqueue(66,
+    "./streamcat61 -l -o files/out.txt files/text20meg.txt",
+    "regular large file, fgets and fputs on io61 streams");
+
+enqueue(67,
+    "cat files/text5meg.txt | ./streamcat61 -b 65536 > files/out.txt",
+    "piped medium file, 64KB fread and fwrite on io61 streams");
+
+enqueue(68,
+    "./streamcat61 -b 1 -t 1024 -o files/out.txt files/text1meg.txt",
+    "regular small file, 1B fread with fseeko, 1024B stride, on io61 streams");
+
+
+# CONCURRENT POSITIONAL READS OF ONE SHARED HANDLE
+enqueue(69,
+    "./prandblockcat61 -j 4 -n 200000 -o files/out.txt files/text20meg.txt",
+    "regular large file, 4 threads, 200000 random-size positional reads");
+
+enqueue(70,
+    "./prandblockcat61 -j 16 -b 1000000 -o files/out.txt files/text20meg.txt",
+    "regular large file, 16 threads, random-size positional reads up to 1MB");
+
+
+# FAN-OUT TO SEVERAL SINKS (the extra sinks are pipes to child
+# processes, which check what they get against the input)
+enqueue(71,
+    "./fanout61 -n 2 -o files/out.txt files/text20meg.txt",
+    "regular large file, fanned out to the output file and a pipe");
+
+enqueue(72,
+    "./fanout61 -n 8 -b 65536 -o files/out.txt files/text20meg.txt",
+    "regular large file, 64KB blocks fanned out to the output file and 7 pipes");
+
+enqueue(73,
+    "cat files/text5meg.txt | ./fanout61 -n 4 | (sleep 0.2; cat) > files/out.txt",
+    "piped medium file, fanned out to 3 pipes and a slow-starting output pipe");
+
+
+# BATCHES OF FIXED-SIZE RECORDS
+enqueue(74,
+    "./recordcat61 -b 16 -o files/out.txt files/text20meg.txt",
+    "regular large file, 16-byte records");
+
+enqueue(75,
+    "cat files/text5meg.txt | ./recordcat61 -b 64 > files/out.txt",
+    "piped medium file, 64-byte records");
+
+enqueue(76,
+    "./recordcat61 -b 1000 -o files/out.bin files/binary1meg.bin",
+    "regular small binary file, 1000-byte records, the last one partial");
+
+
+# IO_URING OUTPUT TO A PIPE (writes to a pipe can complete short)
+enqueue(77,
+    "./blockcat61 -F uring -b 4096 files/text20meg.txt | (sleep 0.2; cat) > files/out.txt",
+    "regular large file, 4KB block I/O through io_uring to a slow-starting pipe");
+
+
+# APPENDING THROUGH A STDIO STREAM (streamcat61 -a checks ftello)
+enqueue(78,
+    "cp files/text1meg.txt files/out.txt && ./streamcat61 -a -l -o files/out.txt files/text5meg.txt",
+    "medium file appended line by line to a small file, checking ftello");
+
+
 run($sequentially);
 
 summary();
@@ -0,0 +1,413 @@
+#define _GNU_SOURCE             // fopencookie
+#include "io61.h"
+#include <errno.h>
+#include <pthread.h>
+
+// compat61.c
+//    Fallbacks for io61 functions that the alternate implementations
+//    (io61v2.c, io61v3.c, io61v4.c, io61_2.c) predate, written in terms
+//    of the original io61 interface. They are weak symbols, so an
+//    implementation's own definitions take precedence. bench.pl links
+//    this file into every variant it builds.
+
+#define WEAK __attribute__((weak))
+
+
+WEAK int io61_set_bufsize(io61_file* f, size_t sz) {
+    (void) f;
+    return sz == 0 ? -1 : 0;
+}
+
+WEAK ssize_t io61_readv(io61_file* f, const struct iovec* iov, int iovcnt) {
+    size_t nread = 0;
+    for (int i = 0; i != iovcnt; ++i) {
+        ssize_t n = io61_read(f, (char*) iov[i].iov_base, iov[i].iov_len);
+        if (n < 0)
+            return nread ? (ssize_t) nread : -1;
+        nread += n;
+        if ((size_t) n != iov[i].iov_len)
+            break;
+    }
+    return nread;
+}
+
+WEAK ssize_t io61_writev(io61_file* f, const struct iovec* iov, int iovcnt) {
+    size_t nwritten = 0;
+    for (int i = 0; i != iovcnt; ++i) {
+        ssize_t n = io61_write(f, (const char*) iov[i].iov_base,
+                               iov[i].iov_len);
+        if (n < 0)
+            return nwritten ? (ssize_t) nwritten : -1;
+        nwritten += n;
+        if ((size_t) n != iov[i].iov_len)
+            break;
+    }
+    return nwritten;
+}
+
+WEAK ssize_t io61_readline(io61_file* f, char* buf, size_t sz) {
+    size_t n = 0;
+    int ch;
+    while (n != sz && (ch = io61_readc(f)) != EOF) {
+        buf[n++] = ch;
+        if (ch == '\n')
+            break;
+    }
+    return n;
+}
+
+WEAK ssize_t io61_scan(io61_file* f, int delim) {
+    size_t n = 0;
+    int ch;
+    while ((ch = io61_readc(f)) != EOF) {
+        ++n;
+        if (ch == (unsigned char) delim)
+            break;
+    }
+    return n;
+}
+
+// The original interface cannot report the file position, so reading
+// backward from it is not possible.
+WEAK ssize_t io61_read_reverse(io61_file* f, char* buf, size_t sz) {
+    (void) f, (void) buf, (void) sz;
+    return -1;
+}
+
+// Record sizes live in a list beside the files, since the original
+// io61_file can't hold them. Records are read a buffer at a time with
+// io61_read; a partial record at the buffer's end moves to the front
+// for the next call.
+typedef struct io61_records {
+    io61_file* f;
+    size_t recsize;
+    char* buf;
+    size_t cap;
+    size_t off;
+    size_t len;
+    struct io61_records* next;
+} io61_records;
+
+static io61_records* io61_all_records;
+static pthread_mutex_t io61_records_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static io61_records* io61_records_find(io61_file* f) {
+    pthread_mutex_lock(&io61_records_lock);
+    io61_records* r = io61_all_records;
+    while (r && r->f != f)
+        r = r->next;
+    pthread_mutex_unlock(&io61_records_lock);
+    return r;
+}
+
+WEAK int io61_set_recsize(io61_file* f, size_t sz) {
+    io61_records* r = io61_records_find(f);
+    if (sz == 0 || (r && r->len != 0))
+        return -1;
+    if (!r) {
+        r = (io61_records*) calloc(1, sizeof(io61_records));
+        r->f = f;
+        pthread_mutex_lock(&io61_records_lock);
+        r->next = io61_all_records;
+        io61_all_records = r;
+        pthread_mutex_unlock(&io61_records_lock);
+    }
+    r->recsize = sz;
+    r->cap = sz < 65536 ? 65536 - 65536 % sz : sz;
+    r->buf = (char*) realloc(r->buf, r->cap);
+    return 0;
+}
+
+WEAK ssize_t io61_records_next(io61_file* f, const char** ptr, size_t* count) {
+    *count = 0;
+    io61_records* r = io61_records_find(f);
+    if (!r)
+        return -1;
+    memmove(r->buf, r->buf + r->off, r->len);
+    r->off = 0;
+    size_t n = r->len;
+    ssize_t m = 0;
+    while (n < r->cap && (m = io61_read(f, r->buf + n, r->cap - n)) > 0)
+        n += m;
+    size_t whole = n - n % r->recsize;
+    if (whole == 0 && m < 0) {
+        r->len = n;
+        return -1;
+    }
+    *ptr = r->buf;
+    *count = whole / r->recsize;
+    if (whole == 0)
+        whole = n;
+    r->off = whole;
+    r->len = n - whole;
+    return whole;
+}
+
+// Without an index, a line is found by scanning from the start.
+WEAK int io61_index_lines(io61_file* f, size_t every, const char* indexfile) {
+    (void) f, (void) every, (void) indexfile;
+    errno = ENOSYS;
+    return -1;
+}
+
+WEAK int io61_load_line_index(io61_file* f, const char* indexfile) {
+    (void) f, (void) indexfile;
+    errno = ENOSYS;
+    return -1;
+}
+
+WEAK ssize_t io61_seek_line(io61_file* f, size_t n) {
+    if (io61_seek(f, 0) < 0)
+        return -1;
+    size_t i = 0;
+    int ch;
+    while (i != n && (ch = io61_readc(f)) != EOF)
+        i += ch == '\n';
+    return i;
+}
+
+// Batches run in caller order and leave the file position after the
+// last request.
+static ssize_t io61_batch(io61_file* f, int write, io61_batch_op* ops,
+                          size_t n) {
+    ssize_t total = 0;
+    int err = 0;
+    for (size_t i = 0; i != n; ++i) {
+        if (io61_seek(f, ops[i].off) < 0)
+            ops[i].result = -1;
+        else if (write)
+            ops[i].result = io61_write(f, ops[i].buf, ops[i].len);
+        else
+            ops[i].result = io61_read(f, ops[i].buf, ops[i].len);
+        if (ops[i].result < 0)
+            err = 1;
+        else
+            total += ops[i].result;
+    }
+    return err && total == 0 ? -1 : total;
+}
+
+WEAK ssize_t io61_read_batch(io61_file* f, io61_batch_op* ops, size_t n) {
+    return io61_batch(f, 0, ops, n);
+}
+
+WEAK ssize_t io61_write_batch(io61_file* f, io61_batch_op* ops, size_t n) {
+    return io61_batch(f, 1, ops, n);
+}
+
+WEAK ssize_t io61_copy(io61_file* inf, io61_file* outf,
+                       const io61_copy_options* opts) {
+    size_t size = opts ? opts->size : (size_t) -1;
+    char buf[8192];
+    size_t ncopied = 0;
+    while (ncopied != size) {
+        size_t n = size - ncopied < sizeof(buf) ? size - ncopied : sizeof(buf);
+        ssize_t r = io61_read(inf, buf, n);
+        if (r < 0 && ncopied == 0)
+            return -1;
+        else if (r <= 0)
+            break;
+        if (io61_write(outf, buf, r) != r)
+            return ncopied ? (ssize_t) ncopied : -1;
+        ncopied += r;
+    }
+    return ncopied;
+}
+
+// The original interface can't tell whether a read would wait, so every
+// file is always ready.
+struct io61_poller {
+    io61_file** files;
+    void** datas;
+    int* events;
+    size_t nents;
+    size_t capents;
+    size_t next;
+};
+
+WEAK io61_poller* io61_poller_new(void) {
+    return (io61_poller*) calloc(1, sizeof(io61_poller));
+}
+
+WEAK int io61_poller_add(io61_poller* p, io61_file* f, int events,
+                         void* data) {
+    if (p->nents == p->capents) {
+        p->capents = p->capents ? 2 * p->capents : 16;
+        p->files = (io61_file**) realloc(p->files, sizeof(io61_file*) * p->capents);
+        p->datas = (void**) realloc(p->datas, sizeof(void*) * p->capents);
+        p->events = (int*) realloc(p->events, sizeof(int) * p->capents);
+    }
+    p->files[p->nents] = f;
+    p->datas[p->nents] = data;
+    p->events[p->nents] = events;
+    ++p->nents;
+    return 0;
+}
+
+WEAK int io61_poller_remove(io61_poller* p, io61_file* f) {
+    for (size_t i = 0; i != p->nents; ++i)
+        if (p->files[i] == f) {
+            --p->nents;
+            p->files[i] = p->files[p->nents];
+            p->datas[i] = p->datas[p->nents];
+            p->events[i] = p->events[p->nents];
+            p->next = 0;
+            return 0;
+        }
+    return -1;
+}
+
+WEAK int io61_poll(io61_poller* p, io61_event* evs, int nevs, int timeout) {
+    (void) timeout;
+    int n = 0;
+    for (size_t k = 0; k != p->nents && n < nevs; ++k) {
+        size_t i = (p->next + k) % p->nents;
+        evs[n].f = p->files[i];
+        evs[n].events = p->events[i];
+        evs[n].data = p->datas[i];
+        ++n;
+    }
+    if (p->nents != 0)
+        p->next = (p->next + 1) % p->nents;
+    return n;
+}
+
+WEAK void io61_poller_free(io61_poller* p) {
+    free(p->files);
+    free(p->datas);
+    free(p->events);
+    free(p);
+}
+
+// Shared handles serialize their readers on a lock around a seek and a
+// read of one io61_file.
+struct io61_shared {
+    io61_file* f;
+    pthread_mutex_t lock;
+};
+
+WEAK io61_shared* io61_shared_fdopen(int fd) {
+    io61_shared* s = (io61_shared*) malloc(sizeof(io61_shared));
+    s->f = io61_fdopen(fd, O_RDONLY);
+    pthread_mutex_init(&s->lock, NULL);
+    return s;
+}
+
+WEAK off_t io61_shared_filesize(io61_shared* s) {
+    return io61_filesize(s->f);
+}
+
+WEAK ssize_t io61_pread(io61_shared* s, char* buf, size_t sz, off_t off) {
+    pthread_mutex_lock(&s->lock);
+    ssize_t n = io61_seek(s->f, off) < 0 ? -1 : io61_read(s->f, buf, sz);
+    pthread_mutex_unlock(&s->lock);
+    return n;
+}
+
+WEAK int io61_shared_close(io61_shared* s) {
+    int r = io61_close(s->f);
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+    return r;
+}
+
+// io61_fopen streams keep track of the file position themselves, since
+// the original interface cannot report it.
+typedef struct io61_cookie {
+    io61_file* f;
+    off_t pos;
+} io61_cookie;
+
+static ssize_t io61_cookie_read(void* cookie, char* buf, size_t sz) {
+    io61_cookie* c = (io61_cookie*) cookie;
+    ssize_t n = io61_read(c->f, buf, sz);
+    if (n > 0)
+        c->pos += n;
+    return n;
+}
+
+static ssize_t io61_cookie_write(void* cookie, const char* buf, size_t sz) {
+    io61_cookie* c = (io61_cookie*) cookie;
+    ssize_t n = io61_write(c->f, buf, sz);
+    if (n <= 0)
+        return 0;
+    c->pos += n;
+    return n;
+}
+
+static int io61_cookie_seek(void* cookie, off64_t* off, int whence) {
+    io61_cookie* c = (io61_cookie*) cookie;
+    off_t pos = *off;
+    if (whence == SEEK_CUR)
+        pos += c->pos;
+    else if (whence == SEEK_END) {
+        io61_flush(c->f);
+        off_t size = io61_filesize(c->f);
+        if (size < 0)
+            return -1;
+        pos += size;
+    }
+    if (pos < 0 || (pos != c->pos && io61_seek(c->f, pos) < 0))
+        return -1;
+    *off = c->pos = pos;
+    return 0;
+}
+
+static int io61_cookie_close(void* cookie) {
+    io61_cookie* c = (io61_cookie*) cookie;
+    int r = io61_close(c->f);
+    free(c);
+    return r;
+}
+
+WEAK FILE* io61_fopen(const char* filename, const char* mode) {
+    int plus = strchr(mode, '+') != NULL;
+    int flags;
+    if (mode[0] == 'r')
+        flags = plus ? O_RDWR : O_RDONLY;
+    else if (mode[0] == 'w')
+        flags = (plus ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC;
+    else if (mode[0] == 'a' && !plus)
+        flags = O_WRONLY | O_CREAT | O_APPEND;
+    else {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (strchr(mode, 'x'))
+        flags |= O_EXCL;
+    int fd = open(filename, flags, 0666);
+    if (fd < 0)
+        return NULL;
+    io61_cookie* c = (io61_cookie*) malloc(sizeof(io61_cookie));
+    c->f = io61_fdopen(fd, flags & O_ACCMODE);
+    // Writes land at end of file, so the stream's position starts there.
+    // Older io61_seeks mishandle write-only files, so don't seek.
+    off_t size = (flags & O_APPEND) ? io61_filesize(c->f) : 0;
+    c->pos = size > 0 ? size : 0;
+    cookie_io_functions_t hooks = {
+        io61_cookie_read, io61_cookie_write,
+        io61_cookie_seek, io61_cookie_close
+    };
+    FILE* stream = fopencookie(c, mode, hooks);
+    if (!stream)
+        io61_cookie_close(c);
+    return stream;
+}
+
+// The original interface has no way to send one write to several
+// files; callers write to each file themselves.
+WEAK io61_file* io61_fanout(const int* fds, int nfds) {
+    (void) fds, (void) nfds;
+    errno = ENOSYS;
+    return NULL;
+}
+
+WEAK int64_t io61_checksum(io61_file* f) {
+    (void) f;
+    return -1;
+}
+
+WEAK size_t io61_stats_report(char* buf, size_t sz) {
+    (void) buf, (void) sz;
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include "io61.h"
+#include <errno.h>
+#include <sys/wait.h>
+
+// Usage: ./fanout61 [-w] [-n SINKS] [-b BLOCKSIZE] [-F FLAGS]
+//                   [-o OUTFILE] [FILE]
+//    Copies the input FILE to OUTFILE and to SINKS - 1 pipes (default
+//    SINKS is 2), in BLOCKSIZE blocks (default 4096), through one
+//    io61_fanout file. A child process reads each pipe and checksums
+//    what arrives; the program fails if a child's checksum or byte
+//    count differs from the input's. With -w, or if io61_fanout isn't
+//    available, each sink gets its own io61_file and every block is
+//    written to each of them separately.
+
+typedef struct sum {
+    size_t n;
+    uint64_t a;
+    uint64_t b;
+} sum;
+
+static void sum_update(sum* s, const char* buf, size_t n) {
+    const unsigned char* p = (const unsigned char*) buf;
+    uint64_t a = s->a, b = s->b;
+    for (size_t i = 0; i != n; ++i) {
+        a += p[i];
+        b += a;
+    }
+    s->a = a;
+    s->b = b;
+    s->n += n;
+}
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args = io61_parse_arguments(argc, argv, "wn:b:F:o:");
+    size_t block_size = args.block_size ? args.block_size : 4096;
+    int nsinks = args.count ? (int) args.count : 2;
+
+    // Allocate buffer, open files, start a child for each pipe
+    char* buf = (char*) malloc(block_size > 65536 ? block_size : 65536);
+    int* fds = (int*) malloc(sizeof(int) * nsinks);
+    pid_t* pids = (pid_t*) malloc(sizeof(pid_t) * nsinks);
+    fds[0] = args.output_file
+        ? open(args.output_file, O_WRONLY | O_CREAT | O_TRUNC, 0666)
+        : STDOUT_FILENO;
+    if (fds[0] < 0) {
+        fprintf(stderr, "%s: %s\n", args.output_file, strerror(errno));
+        exit(1);
+    }
+    int sumpipe[2];
+    int r = pipe(sumpipe);
+    assert(r == 0);
+    for (int i = 1; i < nsinks; ++i) {
+        int pfd[2];
+        r = pipe(pfd);
+        assert(r == 0);
+        pids[i] = fork();
+        assert(pids[i] >= 0);
+        if (pids[i] == 0) {
+            for (int j = 0; j < i; ++j)
+                close(fds[j]);
+            close(pfd[1]);
+            sum s = { 0, 0, 0 };
+            ssize_t n;
+            while ((n = read(pfd[0], buf, 65536)) != 0)
+                if (n > 0)
+                    sum_update(&s, buf, n);
+                else if (errno != EINTR)
+                    _exit(1);
+            _exit(write(sumpipe[1], &s, sizeof(s)) == sizeof(s) ? 0 : 1);
+        }
+        close(pfd[0]);
+        fds[i] = pfd[1];
+    }
+    close(sumpipe[1]);
+
+    io61_profile_begin();
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY | args.flags);
+    io61_file* outf = args.separate_writers ? NULL : io61_fanout(fds, nsinks);
+    io61_file** outfs = NULL;
+    if (!outf) {
+        outfs = (io61_file**) malloc(sizeof(io61_file*) * nsinks);
+        for (int i = 0; i < nsinks; ++i)
+            outfs[i] = io61_fdopen(fds[i], O_WRONLY | args.flags);
+    }
+
+    // Copy file data
+    sum expected = { 0, 0, 0 };
+    while (1) {
+        ssize_t amount = io61_read(inf, buf, block_size);
+        if (amount <= 0)
+            break;
+        sum_update(&expected, buf, amount);
+        if (outf)
+            io61_write(outf, buf, amount);
+        else
+            for (int i = 0; i < nsinks; ++i)
+                io61_write(outfs[i], buf, amount);
+    }
+
+    io61_close(inf);
+    int failed = 0;
+    if (outf)
+        failed = io61_close(outf) < 0;
+    else
+        for (int i = 0; i < nsinks; ++i)
+            failed |= io61_close(outfs[i]) < 0;
+    if (failed)
+        perror("fanout61");
+
+    // Check what the children got
+    for (int i = 1; i < nsinks; ++i) {
+        sum s;
+        int status;
+        if (read(sumpipe[0], &s, sizeof(s)) != sizeof(s)) {
+            fprintf(stderr, "fanout61: a sink reported nothing\n");
+            failed = 1;
+        } else if (s.n != expected.n) {
+            fprintf(stderr, "fanout61: a sink got %zu bytes, expected %zu\n",
+                    s.n, expected.n);
+            failed = 1;
+        } else if (s.a != expected.a || s.b != expected.b) {
+            fprintf(stderr, "fanout61: a sink got different data\n");
+            failed = 1;
+        }
+        waitpid(pids[i], &status, 0);
+    }
+    io61_profile_end();
+    free(outfs);
+    free(pids);
+    free(fds);
+    free(buf);
+    exit(failed);
+}
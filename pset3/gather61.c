@@ -1,45 +1,72 @@
 #include "io61.h"
+#include <limits.h>
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
-// Usage: ./gather61 [-b BLOCKSIZE] [-o OUTFILE] [FILE1 FILE2...]
+// Usage: ./gather61 [-b BLOCKSIZE] [-o OUTFILE] [-F FLAGS] [FILE1 FILE2...]
 //    Copies the input FILEs to OUTFILE, alternating between
 //    FILEs with every block. (I.e., read a block from FILE1, then
 //    a block from FILE2, etc.) This is a "gather" I/O pattern: many
 //    input files are gathered into a single output file.
-//    Default BLOCKSIZE is 1.
+//    Default BLOCKSIZE is 1. Each round's blocks are written in batches
+//    of up to IOV_MAX blocks or about 1MB, one io61_writev per batch.
+//    The open file limit is raised as far as needed for thousands of
+//    FILEs.
 
 int main(int argc, char* argv[]) {
     // Parse arguments
-    io61_arguments args = io61_parse_arguments(argc, argv, "b:o:#");
+    io61_arguments args = io61_parse_arguments(argc, argv, "b:o:F:#");
     size_t block_size = args.block_size ? args.block_size : 1;
 
-    // Allocate buffer, open files
-    char* buf = (char*) malloc(block_size);
+    // Allocate buffers, open files
     int nfiles = args.n_input_files;
+    io61_raise_file_limit(nfiles);
+    size_t batch = block_size < (1 << 20) ? (1 << 20) / block_size : 1;
+    if (batch > IOV_MAX)
+        batch = IOV_MAX;
+    if (batch > (size_t) nfiles)
+        batch = nfiles;
+    char* buf = (char*) malloc(block_size * batch);
+    struct iovec* iov = (struct iovec*) malloc(sizeof(struct iovec) * batch);
 
     io61_profile_begin();
     io61_file** infs = (io61_file**) calloc(nfiles, sizeof(io61_file*));
     for (int i = 0; i < nfiles; ++i)
-        infs[i] = io61_open_check(args.input_files[i], O_RDONLY);
+        infs[i] = io61_open_check(args.input_files[i], O_RDONLY | args.flags);
     io61_file* outf = io61_open_check(args.output_file,
-                                      O_WRONLY | O_CREAT | O_TRUNC);
+                                      O_WRONLY | O_CREAT | O_TRUNC | args.flags);
 
     // Copy file data
-    int whichf = 0, ndeadfiles = 0;
+    int ndeadfiles = 0;
     while (ndeadfiles != nfiles) {
-        if (infs[whichf]) {
-            ssize_t amount = io61_read(infs[whichf], buf, block_size);
+        size_t niov = 0;
+        for (int whichf = 0; whichf != nfiles; ++whichf) {
+            if (!infs[whichf])
+                continue;
+            char* blockbuf = &buf[niov * block_size];
+            ssize_t amount = io61_read(infs[whichf], blockbuf, block_size);
             if (amount <= 0) {
                 io61_close(infs[whichf]);
                 infs[whichf] = NULL;
                 ++ndeadfiles;
-            } else
-                io61_write(outf, buf, amount);
+            } else {
+                iov[niov].iov_base = blockbuf;
+                iov[niov].iov_len = amount;
+                ++niov;
+            }
+            if (niov == batch) {
+                io61_writev(outf, iov, niov);
+                niov = 0;
+            }
         }
-        whichf = (whichf + 1) % nfiles;
+        if (niov != 0)
+            io61_writev(outf, iov, niov);
     }
 
     io61_close(outf);
     io61_profile_end();
     free(infs);
+    free(iov);
     free(buf);
 }
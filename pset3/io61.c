@@ -1,248 +1,4236 @@
+#define _GNU_SOURCE             // fopencookie
 #include "io61.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <limits.h>
 #include <errno.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <endian.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include "uring61.h"
+#include "simd61.h"
+#include "lz61.h"
 
 
 // io61_file
 //    Data structure for io61 file wrappers. Add your own stuff.
-// added another 4096 to BUFSZ
+//
+// Each file has one page-aligned cache buffer. It starts at BUFSZ bytes
+// and adapts to the access pattern: it doubles, up to BUFMAX (BUFMAX_HUGE
+// with IO61_HUGE), while a stream keeps filling it; it halves, down to
+// BUFMIN, while refills and flushes use less than a quarter of it, as
+// with a slow pipe; and a seek shrinks it back to BUFSZ. All buffers
+// together grow to at most BUFBUDGET bytes. io61_set_bufsize, or
+// IO61_BUFSZ in the environment, fixes the size instead.
+//
+// Buffer pool: plain files (not IO61_ASYNC, IO61_URING, IO61_LZ or
+// IO61_PIPE) get their buffer on the first refill or flush, not at
+// open, and hold no more than an equal share of the pool budget
+// (BUFBUDGET, or IO61_POOL bytes in the environment), in multiples of
+// POOL_MIN. When a new buffer would exceed the budget, the buffers of
+// the least recently refilled or flushed files are reclaimed: output is
+// written out, unread input is given back with lseek, and the file
+// attaches a buffer again when next used. So thousands of open files
+// cost a fixed amount of memory.
 #define BUFSZ 16384
+#define BUFMIN 4096
+#define BUFMAX (1 << 20)
+#define BUFMAX_HUGE (8 << 20)
+#define BUFBUDGET (16 << 20)
+#define POOL_MIN 512
+#define PAGESZ 4096
+#define HUGEPAGESZ (2 << 20)
+
+// IO61_DIRECT files move whole DIRECT_ALIGN-byte blocks between the
+// disk and a fixed DIRECT_BUFSZ cache with O_DIRECT, at explicit
+// offsets. Unaligned pieces (after a seek, or at end of file) go
+// through the page cache instead.
+#define DIRECT_ALIGN 4096
+#define DIRECT_BUFSZ (1 << 20)
+#ifndef O_DIRECT
+#define O_DIRECT __O_DIRECT
+#endif
+
+// Sparse files: a regular input with holes (fewer blocks allocated
+// than its size suggests) finds them with SEEK_DATA and fills its cache
+// with zeros instead of reading them. Regular output skips whole
+// SPARSE_BLOCK-aligned blocks of zeros past the end of the file on
+// disk, found with simd61_allzero, by seeking over them; io61_flush
+// extends the file over a trailing hole with ftruncate. So copies keep
+// their holes.
+#define SPARSE_BLOCK 4096
+#ifndef SEEK_DATA
+#define SEEK_DATA 3
+#define SEEK_HOLE 4
+#endif
+
+static size_t io61_bufbytes;    // bytes in all files' cache buffers
+static size_t io61_pool_budget; // limit on io61_bufbytes
+static size_t io61_npooled;     // open files using the pool
+static io61_file* io61_lru_head; // pooled files with buffers, most
+static io61_file* io61_lru_tail; // recently used first
+
+// IO61_ASYNC read-ahead ring: the background thread fills up to
+// ASYNC_NBUF buffers of ASYNC_BUFSZ bytes ahead of the reader.
+#define ASYNC_NBUF 4
+#define ASYNC_BUFSZ 65536
+
+typedef struct io61_async {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int fd;
+    int stop;                   // set to ask the thread to exit
+    int holding;                // 1 if the reader is using slot `head`
+    int err;                    // errno of a failed read
+    size_t head;                // next slot to consume
+    size_t tail;                // next slot to fill
+    ssize_t len[ASYNC_NBUF];    // bytes in each filled slot; <= 0 at EOF
+    unsigned char* buf[ASYNC_NBUF];
+} io61_async;
+
+// IO61_URING buffers: each file keeps up to URING_NBUF requests in
+// flight on a ring shared by every io_uring file in the process.
+// Queued requests go to the kernel once URING_BATCH have accumulated,
+// or sooner if someone has to wait for a completion.
+#define URING_NBUF 4
+#define URING_ENTRIES 64
+#define URING_BATCH 16
+
+typedef struct io61_uslot {
+    unsigned char* buf;
+    off_t off;                  // file offset, or -1 for current position
+    size_t len;                 // bytes requested
+    ssize_t res;                // result once complete
+    int inflight;
+} io61_uslot;
+
+static uring61* io61_ring;      // shared IO61_URING ring
+static int io61_ring_failed;    // 1 if io_uring is unavailable
+
+// Write scheduler: full buffers of regular output files are queued as
+// chunks rather than written one at a time. A file's queue goes out in
+// a single writev when the file is flushed, seeked or closed, when it
+// holds WSCHED_MAXCHUNKS chunks, or when all files together have more
+// than WSCHED_BUDGET bytes queued (the file with the most goes first).
+// Buffers of WSCHED_DIRECT bytes or more are not worth copying; they go
+// out at once, behind the file's queue.
+#define WSCHED_MAXCHUNKS 64
+#define WSCHED_BUDGET (1 << 20)
+#define WSCHED_DIRECT (4 * BUFSZ)
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+typedef struct io61_wchunk {
+    struct io61_wchunk* next;
+    size_t len;
+    unsigned char data[BUFSZ];
+} io61_wchunk;
+
+// io61_copy: regular files are split into COPY_CHUNK-byte chunks that
+// worker threads claim in order and copy with copy_file_range, or with
+// pread/pwrite through a COPY_BUFSZ buffer where the kernel can't.
+#define COPY_CHUNK (8 << 20)
+#define COPY_BUFSZ (1 << 20)
+#define COPY_MAXTHREADS 64
+#define KCOPY_MAX (1 << 30)     // bytes per splice or sendfile call
+
+// Batches: io61_read_batch and io61_write_batch sort their requests by
+// offset and merge neighbours into preadv/pwritev calls (or io_uring
+// readv/writev requests) of up to IOV_MAX buffers. Reads less than
+// BATCH_GAP bytes apart are merged too; the gap lands in a scratch
+// buffer.
+#define BATCH_GAP 4096
+
+typedef struct io61_batch_key {
+    off_t off;
+    size_t i;                   // index in the caller's array
+} io61_batch_key;
+
+typedef struct io61_batch_run {
+    off_t off;
+    size_t first;               // first buffer in the iovec array
+    int iovcnt;
+    ssize_t result;
+    io61_uslot slot;            // IO61_URING request
+} io61_batch_run;
+
+static unsigned char io61_batch_scratch[BATCH_GAP];
+
+// Compression: an IO61_LZ file is a series of frames. Each holds up to
+// LZ_FRAME bytes of data, compressed with lz61 (or stored as is if that
+// doesn't make it smaller), behind a header of two little-endian 32-bit
+// words: the data length and the stored length. The cache holds one
+// frame's data. Frames are independent, so a seek decompresses just the
+// frame holding the new position; frames are found by hopping over
+// headers, and remembered in an index.
+#define LZ_FRAME 65536
+#define LZ_HEADER 8
+
+typedef struct io61_lzframe {
+    off_t pos;                  // offset of first data byte
+    off_t off;                  // file offset of header
+} io61_lzframe;
+
+typedef struct io61_lz {
+    unsigned char* zbuf;        // a header and compressed frame
+    io61_lzframe* index;        // frame starts found so far, in order;
+    size_t nindex;              // the last may be end of file
+    size_t capindex;
+    int complete;               // 1 if the index reaches end of file
+    off_t zoff;                 // file offset of the next frame to read
+    int err;                    // errno of a failed read, until a seek
+} io61_lz;
+
+typedef struct io61_copyjob {
+    int infd;
+    int outfd;
+    off_t inoff;                // input offset of the range
+    off_t outoff;               // output offset of the range
+    size_t len;                 // bytes in the range
+    size_t next;                // start of the next unclaimed chunk
+    int err;                    // errno of the first failure
+    int sparse;                 // 1 if input holes are skipped
+    unsigned long ncalls;       // copying system calls, for statistics
+} io61_copyjob;
+
+// Shared files: an io61_shared caches immutable SHARED_BLOCK-byte
+// blocks of a read-only file for io61_pread, which any number of
+// threads may call at once. The cache is split by block number into
+// SHARED_NSHARDS shards, each with its own lock, so threads reading
+// different blocks seldom wait for each other. A shard holds
+// SHARED_SHARDBLOCKS blocks in sets of SHARED_WAYS, replaced least
+// recently used first within a set. Locks are held only to find or
+// install a block: misses are read, and hits copied out, unlocked. A
+// reference count keeps an evicted block alive until its last reader
+// is done with it; then it goes on its shard's free list for reuse.
+// Reads of SHARED_BYPASS bytes or more skip the cache.
+#define SHARED_BLOCK 16384
+#define SHARED_NSHARDS 16
+#define SHARED_SHARDBLOCKS 64
+#define SHARED_WAYS 8
+#define SHARED_BYPASS (16 * SHARED_BLOCK)
+
+typedef struct io61_sblock {
+    off_t index;                // block number
+    size_t len;                 // bytes; less than SHARED_BLOCK at end of file
+    int refs;                   // the shard's reference plus readers'
+    unsigned long stamp;        // shard clock at last use
+    struct io61_sblock* next;   // next free block
+    unsigned char data[SHARED_BLOCK];
+} io61_sblock;
+
+typedef struct io61_sshard {
+    pthread_mutex_t lock;
+    unsigned long clock;
+    io61_sblock* free;
+    io61_sblock* blocks[SHARED_SHARDBLOCKS];
+} __attribute__((aligned(64))) io61_sshard; // a cache line each
+
+struct io61_shared {
+    int fd;
+    io61_sshard shards[SHARED_NSHARDS];
+};
+
+// Line index: entry i of an io61_index_lines index is the file offset
+// of line i * `every`, so io61_seek_line costs one lookup plus a scan
+// of fewer than `every` lines. A saved index is a header of
+// LINDEX_HEADER little-endian 64-bit words (LINDEX_MAGIC, `every`, the
+// line count, and the data file's size, modification time in
+// nanoseconds and entry count) followed by the entries. It is loaded
+// only while the data file's size and time still match.
+#define LINDEX_MAGIC 0x0031584C31364F49ULL // "IO61LX1"
+#define LINDEX_HEADER 6
+
+// Fan-out: an io61_fanout file writes its cache to several sinks.
+// When two or more pipe sinks are caught up, a flush copies the data
+// into the kernel once, into a private pipe, and tee(2)s it to each of
+// them; the pipe is then drained by splicing it into a regular file
+// sink, or into /dev/null. Other sinks get plain writes. Pipe and
+// socket sinks are made nonblocking, so one that is full doesn't hold
+// up the rest: what it doesn't take waits in its own lag buffer, and
+// the writer waits for it only once it falls FANOUT_LAG bytes behind.
+#define FANOUT_BUFSZ (1 << 20)
+#define FANOUT_PIPESZ (1 << 20)
+#define FANOUT_TEEMIN 16384     // smaller flushes are written, not teed
+#define FANOUT_LAG (4 << 20)
+
+typedef struct io61_sink {
+    int fd;
+    int oflags;                 // file status flags, restored at close
+    int pipe;                   // 1 if a pipe, so tee can feed it
+    int splice;                 // 1 if a regular file splice can feed
+    int err;                    // errno of a failed write; 0 if live
+    size_t done;                // bytes of the current flush sent
+    unsigned char* lag;         // data the sink hasn't taken yet is
+    size_t lagoff;              // [lagoff, laglen)
+    size_t laglen;
+    size_t lagcap;
+} io61_sink;
+
+typedef struct io61_fan {
+    io61_sink* sinks;
+    int nsinks;
+    int nlive;                  // sinks without errors
+    int tee[2];                 // private pipe; -1s if tee is unusable
+    size_t teesz;               // its capacity
+    int devnull;
+    int err;                    // errno of the first failed sink
+    struct pollfd* pfds;
+} io61_fan;
+
+// Polling: an io61_poller reports a file ready without a system call
+// while its cache holds unread data (IO61_POLLIN) or has room
+// (IO61_POLLOUT). Otherwise it asks a level-triggered epoll set, which
+// holds the descriptors of pipes and sockets. Regular files and
+// read-ahead files can't be waited for that way, so they are always
+// ready.
+typedef struct io61_pollent {
+    io61_file* f;
+    int events;                 // IO61_POLLIN and/or IO61_POLLOUT
+    void* data;
+    int epolled;                // 1 if `f->fd` is in the epoll set
+    unsigned stamp;             // io61_poll call that last reported `f`
+} io61_pollent;
+
+struct io61_poller {
+    int epfd;
+    io61_pollent** ents;
+    size_t nents;
+    size_t capents;
+    size_t next;                // where the next cache scan starts
+    unsigned stamp;             // io61_poll calls so far
+};
+
+static io61_file* io61_wfiles;  // files with queued chunks
+static size_t io61_wqueued;     // bytes queued in all files
+static io61_wchunk* io61_wfree; // unused chunks
+
+// Statistics: if IO61_STATS is set in the environment, each file counts
+// its system calls, cache hits and misses, refills, flushes and seek
+// distances, and io61_stats_report summarizes them for the profile.
+// Otherwise `f->stats` is NULL and each count costs one well-predicted
+// branch. A file's counts outlive it, so the report covers closed files.
+#define STATS_NSEEK 6           // seek distances 0, <64, <4K, <256K, <16M, more
+#define STATS_NREPORT 8         // files listed separately in the report
+
+typedef struct io61_stats {
+    int fd;
+    int mode;
+    unsigned long nread;        // read-type system calls
+    unsigned long nwrite;       // write-type system calls
+    unsigned long nseek;        // lseek calls
+    unsigned long long rbytes;  // bytes moved by read-type calls
+    unsigned long long wbytes;  // bytes moved by write-type calls
+    unsigned long hits;         // reads served from the cache
+    unsigned long misses;       // reads that needed a refill
+    unsigned long fills;        // cache refills
+    unsigned long flushes;      // cache write-backs
+    unsigned long seekback;     // seeks to an earlier position
+    unsigned long seekhist[STATS_NSEEK];
+    struct io61_stats* next;
+} io61_stats;
+
+static io61_stats* io61_allstats; // every file's counts, newest first
+
+// Checksums of closed output files, for io61_stats_report
+typedef struct io61_sum {
+    int fd;
+    off_t bytes;
+    uint32_t crc;
+    struct io61_sum* next;
+} io61_sum;
+
+static io61_sum* io61_allsums;  // oldest first
+static io61_sum** io61_sumtail = &io61_allsums;
+
+#define IO61_STAT(f, field, n) \
+    do { \
+        if (__builtin_expect((f)->stats != NULL, 0)) \
+            (f)->stats->field += (n); \
+    } while (0)
 
 struct io61_file {	
     int fd;
+    io61_stats* stats; // non-NULL if counting (IO61_STATS)
     int mode;
-    int counter;
-    unsigned char* memory;
+    int flags;
     size_t file_size;
-    size_t first;
-    size_t last;
-    unsigned char cbuf[BUFSZ];
-    size_t cache_size;
+    unsigned char* cbuf; // cache buffer; NULL while reclaimed by the pool
+    size_t bufsz; // size of cbuf; 0 while reclaimed
+    int bufadapt; // 1 if bufsz adapts to the access pattern
+    int pooled; // 1 if cbuf comes from the buffer pool
+    int pinned; // 1 while io61_copy or a record reader uses cbuf
+    size_t bufwant; // size to ask for when reattaching cbuf
+    io61_file* lru_prev; // neighbours in the pool's LRU list
+    io61_file* lru_next;
+    int pipe; // 1 if an IO61_PIPE pipe or socket
+    int direct; // 1 if an IO61_DIRECT regular file
+    int nonblock; // 1 if an IO61_NONBLOCK pipe or socket
+    int sparse; // 1 if a regular input with holes, or regular output
+    off_t sparse_size; // sparse output: size of the file on disk
+    off_t sparse_end; // sparse output: end of data skipped past it
+    off_t* lindex; // line index: offsets of every lindex_every'th line
+    size_t lindex_n; // entries in lindex
+    size_t lindex_every;
+    size_t lindex_lines; // newlines in the file when indexed
+    size_t recsize; // io61_records_next record size; 0 if unset
+    unsigned char* rcarry; // a record straddling a refill
+    size_t rcarrylen; // bytes of it gathered so far
+    int nfull; // consecutive full refills or flushes
+    int nsparse; // consecutive refills or flushes using < 1/4 of cbuf
+    size_t lastfill; // size of the last refill
+    unsigned char* rbuf; // read cache holding [tag, end_tag)
+    io61_async* async; // non-NULL if reading ahead (IO61_ASYNC)
+    io61_uslot* uslots; // non-NULL if using io_uring (IO61_URING)
+    io61_lz* lz; // non-NULL if compressing frames (IO61_LZ)
+    io61_fan* fanout; // non-NULL if writing to several sinks
+    int crcstate; // 1 if checksumming (IO61_CRC), -1 once that fails
+    uint32_t crc; // CRC32C of the data before crc_tag
+    off_t crc_tag; // file offset up to which `crc` runs
+    size_t uhead; // oldest slot in use
+    size_t utail; // next slot to queue
+    int uholding; // 1 if reading from slot `uhead`
+    int useekable; // 1 if requests carry explicit offsets
+    int uerr; // errno of a failed write
+    off_t uoff; // file offset of next queued request
+    int wsched; // 1 if full buffers go through the write scheduler
+    int werr; // errno of a failed scheduled write
+    io61_wchunk* whead; // queued chunks, oldest first
+    io61_wchunk* wtail;
+    size_t wbytes; // bytes in queued chunks
+    int wcount; // number of queued chunks
+    io61_file* wnext; // next file in io61_wfiles
+    io61_file** wpprev; // link pointing to this file in io61_wfiles
     off_t tag; // file offset of first character in cache
-    off_t prev_tag; // offset of previous next
+    off_t seek_tag; // target of the previous seek
     off_t end_tag; // file offset one past last valid char in cache
     off_t pos_tag; // file offset of next char to read in cache
+    off_t dirty_tag; // O_RDWR: file offset of first modified char
+    off_t dirty_end_tag; // O_RDWR: one past last modified char
 };
 
+static unsigned char* io61_bufalloc(size_t sz, int flags);
+static void io61_buffree(unsigned char* buf, size_t sz, int flags);
+static void io61_pool_use(io61_file* f);
+static void io61_lru_unlink(io61_file* f);
+static io61_async* io61_async_start(int fd);
+static void io61_async_stop(io61_async* a);
+static void io61_uring_attach(io61_file* f);
+static int io61_uring_drain(io61_file* f);
+static void io61_uring_detach(io61_file* f);
+static int io61_readc_slow(io61_file* f);
+static int io61_flush_buffers(io61_file* f);
+static void io61_crc_fold(io61_file* f);
+static int io61_reposition(io61_file* f, off_t off);
+static void io61_mark_dirty(io61_file* f, off_t pos, size_t sz);
+static int io61_flush_dirty(io61_file* f);
+static io61_lz* io61_lz_start(void);
+static off_t io61_lz_size(io61_file* f);
+static int io61_lz_locate(io61_file* f, off_t pos);
+static int io61_direct_start(io61_file* f);
+static int io61_nonblock_flush(io61_file* f);
+static int io61_sparse_start(io61_file* f);
+static int io61_sparse_flush(io61_file* f);
+static int io61_fanout_flush(io61_file* f);
+static int io61_fanout_drain(io61_file* f);
+static void io61_fanout_notee(io61_fan* fo);
+static int io61_fanout_free(io61_fan* fo);
+static int io61_wsched_flush(io61_file* f, const struct iovec* extra,
+                             int nextra);
+
+
+// io61_stat_read(f, n), io61_stat_write(f, n)
+//    Count a read-type or write-type system call that returned `n`.
+
+static inline void io61_stat_read(io61_file* f, ssize_t n) {
+    if (__builtin_expect(f->stats != NULL, 0)) {
+        ++f->stats->nread;
+        f->stats->rbytes += n > 0 ? n : 0;
+    }
+}
+
+static inline void io61_stat_write(io61_file* f, ssize_t n) {
+    if (__builtin_expect(f->stats != NULL, 0)) {
+        ++f->stats->nwrite;
+        f->stats->wbytes += n > 0 ? n : 0;
+    }
+}
+
+
+// io61_stat_access(f, hit)
+//    Count a read request as a cache hit or a miss.
+
+static inline void io61_stat_access(io61_file* f, int hit) {
+    if (__builtin_expect(f->stats != NULL, 0)) {
+        if (hit)
+            ++f->stats->hits;
+        else
+            ++f->stats->misses;
+    }
+}
+
+
+// io61_fdopen(fd, mode)
+//    Return a new io61_file for file descriptor `fd`. `mode` is
+//    O_RDONLY for a read-only file, O_WRONLY for a write-only file, or
+//    O_RDWR for a read/write file. A read/write file has one cache that
+//    serves reads and absorbs writes; it must be seekable, and it
+//    ignores IO61_ASYNC and IO61_URING.
+//    `mode` may also include IO61_ASYNC, which makes a read-only file
+//    fill its cache on a background thread while the caller consumes it,
+//    or IO61_URING, which queues reads ahead and batches writes through
+//    io_uring. IO61_URING falls back to read/write if io_uring is
+//    unavailable; IO61_ASYNC takes precedence if both are given.
+//    IO61_PIPE suits request/response traffic on pipes and sockets, and
+//    overrides both: io61_read returns as soon as it has any data, like
+//    read(2), and a write that doesn't fit in the buffer goes out with
+//    the buffered data in one writev. It is ignored for regular files.
+//    IO61_LZ compresses a write-only file's data, and decompresses a
+//    read-only file's, in frames (see LZ_FRAME); it overrides the other
+//    flags and is ignored for read/write files. Compressed input can
+//    seek, though a seek costs a frame's decompression; compressed
+//    output cannot.
+//    IO61_CRC, or IO61_CHECKSUM in the environment, keeps a CRC32C
+//    checksum of the data passing through a read-only or write-only
+//    file; see io61_checksum.
+//    IO61_DIRECT reads or writes a regular read-only or write-only file
+//    with O_DIRECT, keeping its data out of the page cache; it
+//    overrides IO61_ASYNC and IO61_URING and gives way to IO61_LZ. If
+//    the file system refuses O_DIRECT, the file is buffered as usual.
+
+io61_file* io61_fdopen(int fd, int mode) {
+    assert(fd >= 0);
+    io61_file* f = (io61_file*) malloc(sizeof(io61_file));
+    f->fd = fd;
+    f->mode = mode & O_ACCMODE;
+    f->flags = mode & IO61_FLAGMASK;
+    static int envstats = -1;
+    if (envstats < 0)
+        envstats = getenv("IO61_STATS") != NULL;
+    f->stats = NULL;
+    if (envstats) {
+        f->stats = (io61_stats*) calloc(1, sizeof(io61_stats));
+        f->stats->fd = fd;
+        f->stats->mode = f->mode;
+        f->stats->next = io61_allstats;
+        io61_allstats = f->stats;
+    }
+    f->dirty_tag = f->dirty_end_tag = 0;
+    f->lz = NULL;
+    f->fanout = NULL;
+    f->lindex = NULL;
+    f->lindex_n = f->lindex_every = f->lindex_lines = 0;
+    f->recsize = f->rcarrylen = 0;
+    f->rcarry = NULL;
+    f->file_size = io61_filesize(f);
+    f->async = NULL;
+    f->uslots = NULL;
+    f->tag = f->end_tag = f->pos_tag = f->seek_tag = 0;
+    // Read/write files use explicit offsets, starting where `fd` is
+    if (f->mode == O_RDWR) {
+        off_t off = lseek(fd, 0, SEEK_CUR);
+        IO61_STAT(f, nseek, 1);
+        if (off > 0)
+            f->tag = f->end_tag = f->pos_tag = off;
+    }
+    if ((f->flags & IO61_LZ) && f->mode != O_RDWR)
+        f->lz = io61_lz_start();
+    f->direct = (f->flags & IO61_DIRECT) && f->mode != O_RDWR && !f->lz
+        && io61_filesize(f) >= 0 && io61_direct_start(f);
+    static int envcrc = -1;
+    if (envcrc < 0)
+        envcrc = getenv("IO61_CHECKSUM") != NULL;
+    f->crcstate = ((f->flags & IO61_CRC) || envcrc) && f->mode != O_RDWR;
+    f->crc = 0;
+    f->crc_tag = f->tag;
+    // A nonblocking file's reads and writes return -1 with errno EAGAIN
+    // instead of waiting; see io61_poll
+    f->nonblock = (f->flags & IO61_NONBLOCK) && f->mode != O_RDWR
+        && !f->lz && io61_filesize(f) < 0
+        && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0;
+    f->pipe = (f->flags & IO61_PIPE) && f->mode != O_RDWR && !f->lz
+        && !f->nonblock && io61_filesize(f) < 0;
+    if (f->mode == O_RDONLY && (f->flags & IO61_ASYNC) && !f->pipe
+        && !f->lz && !f->direct && !f->nonblock)
+        f->async = io61_async_start(fd);
+    else if ((f->flags & IO61_URING) && f->mode != O_RDWR && !f->pipe
+             && !f->lz && !f->direct && !f->nonblock)
+        io61_uring_attach(f);
+
+    // io_uring slots hold BUFSZ bytes, so those files keep that size
+    static size_t envbufsz = (size_t) -1;
+    if (envbufsz == (size_t) -1) {
+        const char* env = getenv("IO61_BUFSZ");
+        envbufsz = env ? strtoul(env, NULL, 0) : 0;
+        env = getenv("IO61_POOL");
+        io61_pool_budget = env ? strtoul(env, NULL, 0) : 0;
+        if (io61_pool_budget == 0)
+            io61_pool_budget = BUFBUDGET;
+    }
+    f->bufsz = envbufsz && !f->uslots ? envbufsz : BUFSZ;
+    f->bufadapt = !envbufsz && !f->uslots;
+    // Compressed files' caches hold exactly one frame
+    if (f->lz) {
+        f->bufsz = LZ_FRAME;
+        f->bufadapt = 0;
+    } else if (f->direct) {
+        f->bufsz = DIRECT_BUFSZ;
+        f->bufadapt = 0;
+    }
+    f->nfull = f->nsparse = 0;
+    f->lastfill = 0;
+    f->pooled = !f->async && !f->uslots && !f->lz && !f->pipe
+        && !f->direct;
+    f->pinned = 0;
+    f->bufwant = f->bufsz;
+    f->lru_prev = f->lru_next = NULL;
+    if (f->pooled) {
+        // The buffer comes with the first refill or flush
+        ++io61_npooled;
+        f->cbuf = NULL;
+        f->bufsz = 0;
+    } else
+        f->cbuf = io61_bufalloc(f->bufsz, f->flags);
+    f->rbuf = f->cbuf;
+
+    f->wsched = f->mode == O_WRONLY && !f->uslots && !f->direct
+        && io61_filesize(f) >= 0;
+    f->sparse = io61_sparse_start(f);
+    f->sparse_size = f->sparse_end = f->file_size;
+    f->werr = 0;
+    f->whead = f->wtail = NULL;
+    f->wbytes = f->wcount = 0;
+    return f;
+}
+
+
+// io61_close(f)
+//    Close the io61_file `f` and release all its resources.
+
+int io61_close(io61_file* f) {
+    int fr = 0;
+    // Output still buffered goes out now, however long that takes
+    if (f->nonblock)
+        fcntl(f->fd, F_SETFL, fcntl(f->fd, F_GETFL) & ~O_NONBLOCK);
+    if((f->mode & O_ACCMODE) != O_RDONLY)
+	fr = io61_flush(f);
+    if (f->mode == O_WRONLY && io61_checksum(f) >= 0) {
+        io61_sum* sum = (io61_sum*) malloc(sizeof(io61_sum));
+        sum->fd = f->fd;
+        sum->bytes = f->crc_tag;
+        sum->crc = f->crc;
+        sum->next = NULL;
+        *io61_sumtail = sum;
+        io61_sumtail = &sum->next;
+    }
+    if (f->async)
+        io61_async_stop(f->async);
+    int ur = 0;
+    if (f->uslots) {
+        ur = io61_uring_drain(f);
+        io61_uring_detach(f);
+    }
+    if (f->lz) {
+        free(f->lz->zbuf);
+        free(f->lz->index);
+        free(f->lz);
+    }
+    if (f->fanout && io61_fanout_free(f->fanout) < 0)
+        fr = -1;
+    int r = close(f->fd);
+    if (r == 0 && (ur < 0 || fr < 0))
+        r = -1;
+    if (f->pooled) {
+        if (f->cbuf)
+            io61_lru_unlink(f);
+        --io61_npooled;
+    }
+    if (f->cbuf)
+        io61_buffree(f->cbuf, f->bufsz, f->flags);
+    free(f->lindex);
+    free(f->rcarry);
+    free(f);
+    return r;
+}
+
+
+// io61_bufalloc(sz, flags), io61_buffree(buf, sz, flags)
+//    Allocate and free page-aligned cache buffers. With IO61_HUGE,
+//    buffers of a huge page or more come straight from mmap and are
+//    marked for transparent huge pages.
+
+static unsigned char* io61_bufalloc(size_t sz, int flags) {
+    void* p;
+    if ((flags & IO61_HUGE) && sz >= HUGEPAGESZ) {
+        p = mmap(NULL, sz, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        assert(p != MAP_FAILED);
+#ifdef MADV_HUGEPAGE
+        madvise(p, sz, MADV_HUGEPAGE);
+#endif
+    } else {
+        // Small pool shares needn't waste most of a page on alignment
+        int r = posix_memalign(&p, sz >= PAGESZ ? PAGESZ : 64, sz);
+        assert(r == 0);
+    }
+    io61_bufbytes += sz;
+    return (unsigned char*) p;
+}
+
+static void io61_buffree(unsigned char* buf, size_t sz, int flags) {
+    io61_bufbytes -= sz;
+    if ((flags & IO61_HUGE) && sz >= HUGEPAGESZ)
+        munmap(buf, sz);
+    else
+        free(buf);
+}
+
+
+// io61_buf_resize(f, sz)
+//    Replace `f`'s cache buffer with one of `sz` bytes. The cache must
+//    be empty.
+
+static void io61_buf_resize(io61_file* f, size_t sz) {
+    int reading = f->rbuf == f->cbuf;
+    io61_buffree(f->cbuf, f->bufsz, f->flags);
+    f->cbuf = io61_bufalloc(sz, f->flags);
+    f->bufsz = sz;
+    if (reading)
+        f->rbuf = f->cbuf;
+}
+
+
+// io61_buf_adapt(f, used)
+//    Adjust the size of `f`'s empty cache given that the last refill or
+//    flush moved `used` bytes.
+
+static size_t io61_pool_share(void);
+
+static void io61_buf_adapt(io61_file* f, size_t used) {
+    if (!f->bufadapt || used == 0)
+        return;
+    size_t sz = f->bufsz;
+    size_t max = f->flags & IO61_HUGE ? BUFMAX_HUGE : BUFMAX;
+    if (f->pooled && max > io61_pool_share())
+        max = io61_pool_share();
+    if (used == f->bufsz) {
+        f->nsparse = 0;
+        if (++f->nfull >= 2 && sz < max
+            && io61_bufbytes + sz <= io61_pool_budget)
+            sz *= 2;
+    } else if (used < f->bufsz / 4) {
+        f->nfull = 0;
+        if (++f->nsparse >= 2 && sz > BUFMIN)
+            sz /= 2;
+    } else
+        f->nfull = f->nsparse = 0;
+    if (sz != f->bufsz) {
+        f->nfull = f->nsparse = 0;
+        io61_buf_resize(f, sz);
+    }
+}
+
+
+// io61_set_bufsize(f, sz)
+//    Give `f` a cache buffer of `sz` bytes and stop adapting its size.
+//    Writes out buffered data first; cached input is dropped, which
+//    requires a seekable file if any is unread. Not supported for
+//    IO61_ASYNC, IO61_URING or IO61_LZ files; IO61_DIRECT files need a
+//    multiple of 4096. Returns 0 on success and -1 on failure.
+
+int io61_set_bufsize(io61_file* f, size_t sz) {
+    if (sz == 0 || f->async || f->uslots || f->lz
+        || (f->direct && sz % DIRECT_ALIGN != 0))
+        return -1;
+    if (f->mode != O_RDONLY && io61_flush(f) < 0)
+        return -1;
+    if (f->mode == O_RDONLY && f->pos_tag < f->end_tag) {
+        IO61_STAT(f, nseek, 1);
+        if (lseek(f->fd, f->pos_tag, SEEK_SET) != f->pos_tag)
+            return -1;
+        f->tag = f->end_tag = f->pos_tag;
+    }
+    f->bufadapt = 0;
+    f->bufwant = sz;
+    if (f->cbuf && sz != f->bufsz)
+        io61_buf_resize(f, sz);
+    return 0;
+}
+
+
+// io61_pool_share()
+//    Return the most buffer memory one pooled file may hold.
+
+static size_t io61_pool_share(void) {
+    size_t share = io61_pool_budget / (io61_npooled ? io61_npooled : 1);
+    share &= ~(size_t) (POOL_MIN - 1);
+    return share > POOL_MIN ? share : POOL_MIN;
+}
+
+
+// io61_lru_unlink(f), io61_lru_push(f)
+//    Remove `f` from the pool's LRU list, or add it as most recent.
+
+static void io61_lru_unlink(io61_file* f) {
+    if (f->lru_prev)
+        f->lru_prev->lru_next = f->lru_next;
+    else
+        io61_lru_head = f->lru_next;
+    if (f->lru_next)
+        f->lru_next->lru_prev = f->lru_prev;
+    else
+        io61_lru_tail = f->lru_prev;
+}
+
+static void io61_lru_push(io61_file* f) {
+    f->lru_prev = NULL;
+    f->lru_next = io61_lru_head;
+    if (io61_lru_head)
+        io61_lru_head->lru_prev = f;
+    else
+        io61_lru_tail = f;
+    io61_lru_head = f;
+}
+
+
+// io61_pool_detach(f)
+//    Reclaim pooled file `f`'s buffer, writing out or giving back what
+//    it caches. Returns 0 on success and -1 if the cache can't be
+//    emptied.
+
+static int io61_pool_detach(io61_file* f) {
+    io61_crc_fold(f);
+    if (f->mode == O_RDONLY && f->pos_tag < f->end_tag) {
+        IO61_STAT(f, nseek, 1);
+        if (lseek(f->fd, f->pos_tag, SEEK_SET) != f->pos_tag)
+            return -1;
+    } else if (f->mode != O_RDONLY && io61_flush_buffers(f) < 0)
+        return -1;
+    f->tag = f->end_tag = f->pos_tag;
+    io61_lru_unlink(f);
+    io61_buffree(f->cbuf, f->bufsz, f->flags);
+    f->bufwant = f->bufsz;
+    f->cbuf = f->rbuf = NULL;
+    f->bufsz = 0;
+    f->nfull = f->nsparse = 0;
+    f->lastfill = 0;
+    return 0;
+}
+
+
+// io61_pool_attach(f)
+//    Give pooled file `f` a buffer, reclaiming others' least recently
+//    used buffers as needed to stay within the budget. If none can be
+//    reclaimed, the budget gives way.
+
+static void io61_pool_attach(io61_file* f) {
+    size_t sz = f->bufwant;
+    if (sz > io61_pool_share())
+        sz = io61_pool_share();
+    io61_file* v = io61_lru_tail;
+    while (io61_bufbytes + sz > io61_pool_budget && v) {
+        io61_file* prev = v->lru_prev;
+        if (!v->pinned)
+            io61_pool_detach(v);
+        v = prev;
+    }
+    f->cbuf = f->rbuf = io61_bufalloc(sz, f->flags);
+    f->bufsz = sz;
+    io61_lru_push(f);
+}
+
+
+// io61_pool_use(f)
+//    Note that `f` is about to refill or flush its cache: attach a
+//    buffer if it has none, and make it the most recently used.
+
+static void io61_pool_use(io61_file* f) {
+    if (!f->pooled)
+        return;
+    else if (!f->cbuf)
+        io61_pool_attach(f);
+    else if (io61_lru_head != f) {
+        io61_lru_unlink(f);
+        io61_lru_push(f);
+    }
+}
+
+
+// io61_async_thread(arg)
+//    Body of the read-ahead thread. Fills free slots in order until it
+//    reads end-of-file or an error, or until asked to stop. The thread
+//    may only be cancelled while blocked in read(); io61_async_stop
+//    relies on that to interrupt a read from a quiet pipe.
+
+static void* io61_async_thread(void* arg) {
+    io61_async* a = (io61_async*) arg;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    pthread_mutex_lock(&a->lock);
+    while (!a->stop) {
+        if (a->tail - a->head == ASYNC_NBUF) {
+            pthread_cond_wait(&a->cond, &a->lock);
+            continue;
+        }
+        size_t slot = a->tail % ASYNC_NBUF;
+        pthread_mutex_unlock(&a->lock);
+
+        ssize_t n;
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        do {
+            n = read(a->fd, a->buf[slot], ASYNC_BUFSZ);
+        } while (n < 0 && errno == EINTR);
+        int err = errno;
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+        pthread_mutex_lock(&a->lock);
+        a->len[slot] = n;
+        a->err = n < 0 ? err : 0;
+        ++a->tail;
+        pthread_cond_signal(&a->cond);
+        if (n <= 0)
+            break;
+    }
+    pthread_mutex_unlock(&a->lock);
+    return NULL;
+}
+
+
+// io61_async_start(fd)
+//    Start reading ahead from `fd`'s current offset. Returns NULL if the
+//    thread cannot be created; the caller then reads synchronously.
+
+static io61_async* io61_async_start(int fd) {
+    io61_async* a = (io61_async*) malloc(sizeof(io61_async));
+    a->fd = fd;
+    a->stop = a->holding = a->err = 0;
+    a->head = a->tail = 0;
+    for (int i = 0; i != ASYNC_NBUF; ++i)
+        a->buf[i] = (unsigned char*) malloc(ASYNC_BUFSZ);
+    pthread_mutex_init(&a->lock, NULL);
+    pthread_cond_init(&a->cond, NULL);
+    if (pthread_create(&a->thread, NULL, io61_async_thread, a) != 0) {
+        // No thread to stop: release everything here
+        pthread_cond_destroy(&a->cond);
+        pthread_mutex_destroy(&a->lock);
+        for (int i = 0; i != ASYNC_NBUF; ++i)
+            free(a->buf[i]);
+        free(a);
+        return NULL;
+    }
+    return a;
+}
+
+
+// io61_async_stop(a)
+//    Stop the read-ahead thread and free `a`. Data the thread read
+//    ahead is discarded, so the fd offset is meaningless afterwards.
+
+static void io61_async_stop(io61_async* a) {
+    pthread_mutex_lock(&a->lock);
+    a->stop = 1;
+    pthread_cond_signal(&a->cond);
+    pthread_mutex_unlock(&a->lock);
+    pthread_cancel(a->thread);
+    pthread_join(a->thread, NULL);
+    pthread_cond_destroy(&a->cond);
+    pthread_mutex_destroy(&a->lock);
+    for (int i = 0; i != ASYNC_NBUF; ++i)
+        free(a->buf[i]);
+    free(a);
+}
+
+
+// io61_async_next(f)
+//    Release the slot the reader was using and wait for the next one.
+//    Points `f->rbuf` at it and returns its length, or returns 0 or -1
+//    at end-of-file or error (repeatedly, if called again).
+
+static ssize_t io61_async_next(io61_file* f) {
+    io61_async* a = f->async;
+    pthread_mutex_lock(&a->lock);
+    if (a->holding) {
+        ++a->head;
+        a->holding = 0;
+        pthread_cond_signal(&a->cond);
+    }
+    while (a->head == a->tail)
+        pthread_cond_wait(&a->cond, &a->lock);
+    size_t slot = a->head % ASYNC_NBUF;
+    ssize_t n = a->len[slot];
+    if (n > 0) {
+        io61_stat_read(f, n); // made by the background thread
+        f->rbuf = a->buf[slot];
+        a->holding = 1;
+    } else if (n < 0)
+        errno = a->err;
+    pthread_mutex_unlock(&a->lock);
+    return n;
+}
+
+
+// io61_uring_attach(f)
+//    Set up io_uring buffers for `f`, opening the shared ring on first
+//    use. Leaves `f` on the read/write path if io_uring is unavailable.
+
+static void io61_uring_attach(io61_file* f) {
+    if (!io61_ring && !io61_ring_failed) {
+        io61_ring = uring61_open(URING_ENTRIES);
+        io61_ring_failed = !io61_ring;
+    }
+    if (!io61_ring)
+        return;
+    // Regular files get explicit offsets, so several requests may be in
+    // flight at once. Pipes and devices use the file position, so their
+    // requests run one at a time to stay in order.
+    off_t off = lseek(f->fd, 0, SEEK_CUR);
+    IO61_STAT(f, nseek, 1);
+    f->useekable = io61_filesize(f) >= 0 && off >= 0;
+    f->uoff = f->useekable ? off : -1;
+    f->uhead = f->utail = 0;
+    f->uholding = f->uerr = 0;
+    f->uslots = (io61_uslot*) calloc(URING_NBUF, sizeof(io61_uslot));
+    for (int i = 0; i != URING_NBUF; ++i)
+        f->uslots[i].buf = (unsigned char*) malloc(BUFSZ);
+}
+
+
+// io61_uring_detach(f)
+//    Free `f`'s io_uring buffers. All its requests must be complete.
+
+static void io61_uring_detach(io61_file* f) {
+    for (int i = 0; i != URING_NBUF; ++i)
+        free(f->uslots[i].buf);
+    free(f->uslots);
+    f->uslots = NULL;
+}
+
+
+// io61_uring_reap()
+//    Record every available completion in its slot. Completions may
+//    belong to any io_uring file.
+
+static void io61_uring_reap(void) {
+    uint64_t data;
+    int res;
+    while (uring61_reap(io61_ring, &data, &res)) {
+        io61_uslot* slot = (io61_uslot*) (uintptr_t) data;
+        slot->res = res;
+        slot->inflight = 0;
+    }
+}
+
+
+// io61_uring_submit(min_complete)
+//    Submit queued requests and wait for `min_complete` completions. If
+//    the kernel refuses them for a reason other than a busy ring, every
+//    unsubmitted request fails with that error and this returns -1.
+
+static int io61_uring_submit(unsigned min_complete) {
+    if (uring61_submit(io61_ring, min_complete) >= 0
+        || errno == EBUSY || errno == EAGAIN)
+        return 0;
+    int err = errno;
+    uint64_t data;
+    while (uring61_unprep(io61_ring, &data)) {
+        io61_uslot* slot = (io61_uslot*) (uintptr_t) data;
+        slot->res = -err;
+        slot->inflight = 0;
+    }
+    errno = err;
+    return -1;
+}
+
+
+// io61_uring_wait(slot)
+//    Wait for `slot`'s request to complete. Submits anything still
+//    queued, so waiting on one file also pushes out other files' writes.
+//    Returns -1 with `errno` set if the request failed.
+
+static int io61_uring_wait(io61_uslot* slot) {
+    io61_uring_reap();
+    while (slot->inflight) {
+        if (io61_uring_submit(1) < 0 && slot->inflight) {
+            // The kernel has the request but won't let us wait for it
+            slot->res = -errno;
+            slot->inflight = 0;
+        }
+        io61_uring_reap();
+    }
+    if (slot->res < 0) {
+        errno = -slot->res;
+        return -1;
+    }
+    return 0;
+}
+
+
+// io61_uring_finish(f, slot)
+//    Wait for the write in `slot`, and finish it synchronously if it
+//    was short, as writes to pipes can be. Returns -1 with `errno` set
+//    if it failed.
+
+static int io61_uring_finish(io61_file* f, io61_uslot* slot) {
+    if (io61_uring_wait(slot) < 0)
+        return -1;
+    size_t done = slot->res;
+    while (done < slot->len) {
+        ssize_t n = slot->off >= 0
+            ? pwrite(f->fd, slot->buf + done, slot->len - done,
+                     slot->off + done)
+            : write(f->fd, slot->buf + done, slot->len - done);
+        io61_stat_write(f, n);
+        if (n < 0 && errno == EINTR)
+            continue;
+        else if (n <= 0)
+            return -1;
+        done += n;
+    }
+    return 0;
+}
+
+
+// io61_uring_queue(f, write, len)
+//    Queue a request for the slot at `f->utail` covering `len` bytes at
+//    `f->uoff`. If the ring is full, waits for some room first.
+
+static void io61_uring_queue(io61_file* f, int write, size_t len) {
+    io61_uslot* slot = &f->uslots[f->utail % URING_NBUF];
+    slot->off = f->uoff;
+    slot->len = len;
+    slot->inflight = 1;
+    uint64_t data = (uintptr_t) slot;
+    while ((write
+            ? uring61_prep_write(io61_ring, f->fd, slot->buf, len,
+                                 slot->off, data)
+            : uring61_prep_read(io61_ring, f->fd, slot->buf, len,
+                                slot->off, data)) < 0) {
+        if (io61_uring_submit(1) < 0) {
+            // The slot fails when it is waited for
+            slot->res = -errno;
+            slot->inflight = 0;
+            break;
+        }
+        io61_uring_reap();
+    }
+    if (f->useekable)
+        f->uoff += len;
+    ++f->utail;
+    if (uring61_unsubmitted(io61_ring) >= URING_BATCH)
+        io61_uring_submit(0);
+}
+
+
+// io61_uring_drain(f)
+//    Wait for all of `f`'s requests and release its slots. Returns -1
+//    if a queued write failed.
+
+static int io61_uring_drain(io61_file* f) {
+    for (; f->uhead != f->utail; ++f->uhead) {
+        io61_uslot* slot = &f->uslots[f->uhead % URING_NBUF];
+        if (f->mode == O_RDONLY)
+            io61_uring_wait(slot);
+        else if (io61_uring_finish(f, slot) < 0 && !f->uerr)
+            f->uerr = errno;
+    }
+    f->uholding = 0;
+    if (f->mode != O_RDONLY && f->useekable) {
+        lseek(f->fd, f->uoff, SEEK_SET);
+        IO61_STAT(f, nseek, 1);
+    }
+    if (f->uerr) {
+        errno = f->uerr;
+        return -1;
+    }
+    return 0;
+}
+
+
+// io61_uring_next(f)
+//    io_uring version of a cache refill. Keeps reads queued ahead of the
+//    reader and returns the oldest one's result, like io61_async_next.
+
+static ssize_t io61_uring_next(io61_file* f) {
+    if (f->uholding) {
+        ++f->uhead;
+        f->uholding = 0;
+    }
+    size_t depth = f->useekable ? URING_NBUF : 1;
+    while (f->utail - f->uhead < depth)
+        io61_uring_queue(f, 0, BUFSZ);
+
+    io61_uslot* slot = &f->uslots[f->uhead % URING_NBUF];
+    io61_uring_wait(slot);
+    ssize_t n = slot->res;
+    io61_stat_read(f, n);
+    if (n < 0) {
+        errno = -n;
+        return -1;
+    } else if (n == 0)
+        return 0;
+    f->rbuf = slot->buf;
+    f->uholding = 1;
+
+    // A short read means the requests queued behind this one started at
+    // the wrong offsets. Throw them away and resume right after it.
+    if (f->useekable && n < BUFSZ) {
+        size_t cur = f->uhead++;
+        io61_uring_drain(f);
+        f->uhead = cur;
+        f->utail = cur + 1;
+        f->uholding = 1;
+        f->uoff = slot->off + n;
+    }
+    return n;
+}
+
+
+// io61_uring_write(f, buf, sz)
+//    Queue a write of `sz` (at most BUFSZ) bytes. The request reaches
+//    the kernel at the next submission, batched with other files'.
+
+static ssize_t io61_uring_write(io61_file* f, const unsigned char* buf,
+                                size_t sz) {
+    // Pipes allow one write in flight, so output stays in order
+    size_t depth = f->useekable ? URING_NBUF : 1;
+    while (f->utail - f->uhead >= depth) {
+        io61_uslot* slot = &f->uslots[f->uhead % URING_NBUF];
+        if (io61_uring_finish(f, slot) < 0 && !f->uerr)
+            f->uerr = errno;
+        ++f->uhead;
+    }
+    if (f->uerr) {
+        errno = f->uerr;
+        return -1;
+    }
+    memcpy(f->uslots[f->utail % URING_NBUF].buf, buf, sz);
+    io61_uring_queue(f, 1, sz);
+    io61_stat_write(f, sz);
+    return sz;
+}
+
+
+// io61_writev_all(f, iov, iovcnt)
+//    Write all of `iov` to `f`'s file descriptor, in as few writev calls
+//    as possible. Modifies `iov`. Returns 0 on success and -1 on error.
+
+static int io61_writev_all(io61_file* f, struct iovec* iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(f->fd, iov, iovcnt > IOV_MAX ? IOV_MAX : iovcnt);
+        io61_stat_write(f, n);
+        if (n < 0 && errno == EINTR)
+            continue;
+        else if (n <= 0)
+            return -1;
+        while (iovcnt > 0 && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char*) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+
+// io61_wsched_flush(f, extra, nextra)
+//    Write `f`'s queued chunks, followed by the `nextra` buffers in
+//    `extra`, with one writev. Returns -1 if this or an earlier
+//    scheduled write of `f` failed.
+
+static int io61_wsched_flush(io61_file* f, const struct iovec* extra,
+                             int nextra) {
+    int n = f->wcount + nextra;
+    if (n != 0) {
+        struct iovec stackiov[WSCHED_MAXCHUNKS + 2];
+        struct iovec* iov = stackiov;
+        if (n > WSCHED_MAXCHUNKS + 2)
+            iov = (struct iovec*) malloc(sizeof(struct iovec) * n);
+        int i = 0;
+        for (io61_wchunk* c = f->whead; c; c = c->next, ++i) {
+            iov[i].iov_base = c->data;
+            iov[i].iov_len = c->len;
+        }
+        memcpy(&iov[i], extra, sizeof(struct iovec) * nextra);
+        if (io61_writev_all(f, iov, n) < 0 && !f->werr)
+            f->werr = errno;
+        if (iov != stackiov)
+            free(iov);
+    }
+
+    if (f->whead) {
+        f->wtail->next = io61_wfree;
+        io61_wfree = f->whead;
+        f->whead = f->wtail = NULL;
+        io61_wqueued -= f->wbytes;
+        f->wbytes = f->wcount = 0;
+        *f->wpprev = f->wnext;
+        if (f->wnext)
+            f->wnext->wpprev = f->wpprev;
+    }
+    if (f->werr) {
+        errno = f->werr;
+        return -1;
+    }
+    return 0;
+}
+
+
+// io61_wsched_queue(f, buf, sz)
+//    Queue `sz` bytes of output for `f`, then write out queues until the
+//    scheduler is back within its limits.
+
+static ssize_t io61_wsched_queue(io61_file* f, const unsigned char* buf,
+                                 size_t sz) {
+    for (size_t n = 0; n != sz; ) {
+        io61_wchunk* c = f->wtail;
+        if (!c || c->len == BUFSZ) {
+            if ((c = io61_wfree))
+                io61_wfree = c->next;
+            else
+                c = (io61_wchunk*) malloc(sizeof(io61_wchunk));
+            c->next = NULL;
+            c->len = 0;
+            if (f->wtail)
+                f->wtail->next = c;
+            else {
+                f->whead = c;
+                f->wnext = io61_wfiles;
+                f->wpprev = &io61_wfiles;
+                if (io61_wfiles)
+                    io61_wfiles->wpprev = &f->wnext;
+                io61_wfiles = f;
+            }
+            f->wtail = c;
+            ++f->wcount;
+        }
+        size_t m = sz - n;
+        if (m > BUFSZ - c->len)
+            m = BUFSZ - c->len;
+        memcpy(c->data + c->len, buf + n, m);
+        c->len += m;
+        n += m;
+    }
+    f->wbytes += sz;
+    io61_wqueued += sz;
+
+    if (f->wcount == WSCHED_MAXCHUNKS && f->wtail->len == BUFSZ)
+        io61_wsched_flush(f, NULL, 0);
+    while (io61_wqueued > WSCHED_BUDGET) {
+        io61_file* victim = io61_wfiles;
+        for (io61_file* wf = io61_wfiles; wf; wf = wf->wnext)
+            if (wf->wbytes > victim->wbytes)
+                victim = wf;
+        io61_wsched_flush(victim, NULL, 0);
+    }
+    return f->werr ? -1 : (ssize_t) sz;
+}
+
+
+// io61_lz_start()
+//    Return the compression state for a new IO61_LZ file. Its index
+//    starts with the first frame, at file offset 0.
+
+static io61_lz* io61_lz_start(void) {
+    io61_lz* z = (io61_lz*) malloc(sizeof(io61_lz));
+    z->zbuf = (unsigned char*) malloc(LZ_HEADER + LZ_FRAME);
+    z->capindex = 64;
+    z->index = (io61_lzframe*) malloc(sizeof(io61_lzframe) * z->capindex);
+    z->index[0].pos = z->index[0].off = 0;
+    z->nindex = 1;
+    z->complete = 0;
+    z->zoff = 0;
+    z->err = 0;
+    return z;
+}
+
+
+// io61_lz_frame(z, buf, sz)
+//    Build the frame for `sz` bytes of data at `buf` in `z->zbuf`.
+//    Returns its length, header included.
+
+static size_t io61_lz_frame(io61_lz* z, const unsigned char* buf,
+                            size_t sz) {
+    unsigned char* p = z->zbuf + LZ_HEADER;
+    size_t zlen = lz61_compress(p, sz - 1, buf, sz);
+    if (zlen == 0) {
+        memcpy(p, buf, sz);
+        zlen = sz;
+    }
+    uint32_t h[2] = { htole32(sz), htole32(zlen) };
+    memcpy(z->zbuf, h, LZ_HEADER);
+    return LZ_HEADER + zlen;
+}
+
+
+// io61_lz_header(hdr, len, zlen)
+//    Decode the frame header `hdr` into data length `*len` and stored
+//    length `*zlen`. Returns -1, with errno set to EIO, if it is
+//    invalid.
+
+static int io61_lz_header(const unsigned char* hdr, size_t* len,
+                          size_t* zlen) {
+    uint32_t h[2];
+    memcpy(h, hdr, LZ_HEADER);
+    *len = le32toh(h[0]);
+    *zlen = le32toh(h[1]);
+    if (*len == 0 || *len > LZ_FRAME || *zlen > *len) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+
+// io61_lz_record(z, pos, off)
+//    Note that a frame starting at data offset `pos` has its header at
+//    file offset `off`, if that extends the index.
+
+static void io61_lz_record(io61_lz* z, off_t pos, off_t off) {
+    if (z->index[z->nindex - 1].pos >= pos)
+        return;
+    if (z->nindex == z->capindex) {
+        z->capindex *= 2;
+        z->index = (io61_lzframe*) realloc(z->index, sizeof(io61_lzframe) * z->capindex);
+    }
+    z->index[z->nindex].pos = pos;
+    z->index[z->nindex].off = off;
+    ++z->nindex;
+}
+
+
+// io61_lz_readall(f, buf, sz)
+//    Read `sz` bytes from `f`'s file descriptor, unless end of file
+//    comes first. Returns the number read, or -1 on error.
+
+static ssize_t io61_lz_readall(io61_file* f, unsigned char* buf,
+                               size_t sz) {
+    size_t nread = 0;
+    while (nread != sz) {
+        ssize_t n = read(f->fd, buf + nread, sz - nread);
+        io61_stat_read(f, n);
+        if (n < 0 && errno == EINTR)
+            continue;
+        else if (n < 0)
+            return -1;
+        else if (n == 0)
+            break;
+        nread += n;
+    }
+    return nread;
+}
+
+
+// io61_lz_fill(f)
+//    Read the next frame of `f` and decompress it into the cache.
+//    Returns its data length, 0 at end of file, or -1 on error; a
+//    truncated or corrupt frame is an error, with errno EIO. Errors
+//    repeat until the next seek, since the frames after a bad one can't
+//    be found.
+
+static ssize_t io61_lz_fill(io61_file* f) {
+    io61_lz* z = f->lz;
+    size_t len, zlen;
+    if (z->err) {
+        errno = z->err;
+        return -1;
+    }
+    ssize_t n = io61_lz_readall(f, z->zbuf, LZ_HEADER);
+    if (n <= 0)
+        return n;
+    if (n != LZ_HEADER || io61_lz_header(z->zbuf, &len, &zlen) < 0) {
+        errno = z->err = EIO;
+        return -1;
+    }
+    // Stored frames go straight to the cache
+    unsigned char* p = zlen == len ? f->rbuf : z->zbuf + LZ_HEADER;
+    n = io61_lz_readall(f, p, zlen);
+    if (n != (ssize_t) zlen
+        || (p != f->rbuf
+            && lz61_decompress(f->rbuf, len, p, zlen) != (ssize_t) len)) {
+        if (n >= 0)
+            errno = EIO;
+        z->err = errno;
+        return -1;
+    }
+    z->zoff += LZ_HEADER + zlen;
+    io61_lz_record(z, f->tag + len, z->zoff);
+    return len;
+}
+
+
+// io61_lz_extend(f, pos)
+//    Hop over frame headers, extending `f`'s index, until it reaches
+//    past data offset `pos` or to end of file. Returns 0 on success and
+//    -1 on error (for instance, if the file is a pipe).
+
+static int io61_lz_extend(io61_file* f, off_t pos) {
+    io61_lz* z = f->lz;
+    while (!z->complete && z->index[z->nindex - 1].pos <= pos) {
+        io61_lzframe last = z->index[z->nindex - 1];
+        unsigned char hdr[LZ_HEADER];
+        size_t len, zlen;
+        ssize_t n = pread(f->fd, hdr, LZ_HEADER, last.off);
+        io61_stat_read(f, n);
+        if (n == 0)
+            z->complete = 1;
+        else if (n != LZ_HEADER || io61_lz_header(hdr, &len, &zlen) < 0) {
+            if (n >= 0)
+                errno = EIO;
+            return -1;
+        } else
+            io61_lz_record(z, last.pos + len, last.off + LZ_HEADER + zlen);
+    }
+    return 0;
+}
+
+
+// io61_lz_size(f)
+//    Return the length of compressed file `f`'s data, or -1 if it
+//    can't be found without reading through it.
+
+static off_t io61_lz_size(io61_file* f) {
+    if (io61_lz_extend(f, INT64_MAX) < 0)
+        return -1;
+    return f->lz->index[f->lz->nindex - 1].pos;
+}
+
+
+// io61_lz_locate(f, pos)
+//    Empty `f`'s cache and move its file offset to the frame holding
+//    data offset `pos` (or to end of file), so that the next refill
+//    decompresses that frame. Returns 0 on success and -1 on failure.
+
+static int io61_lz_locate(io61_file* f, off_t pos) {
+    io61_lz* z = f->lz;
+    if (io61_lz_extend(f, pos) < 0)
+        return -1;
+    size_t lo = 0, hi = z->nindex;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (z->index[mid].pos <= pos)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    IO61_STAT(f, nseek, 1);
+    if (lseek(f->fd, z->index[lo].off, SEEK_SET) != z->index[lo].off)
+        return -1;
+    z->zoff = z->index[lo].off;
+    z->err = 0;
+    f->tag = f->end_tag = z->index[lo].pos;
+    return 0;
+}
+
+
+// io61_direct_set(f, on)
+//    Turn O_DIRECT on or off for `f`'s descriptor. Returns 0 on success
+//    and -1 on failure or if it was already that way.
+
+static int io61_direct_set(io61_file* f, int on) {
+    int fl = fcntl(f->fd, F_GETFL);
+    if (fl < 0 || !(fl & O_DIRECT) == !on)
+        return -1;
+    return fcntl(f->fd, F_SETFL, on ? fl | O_DIRECT : fl & ~O_DIRECT);
+}
+
+
+// io61_direct_start(f)
+//    Turn on O_DIRECT for IO61_DIRECT file `f` and start its cache at the
+//    descriptor's offset. Returns 1 on success and 0 if the file system
+//    refuses, or if the file is in append mode, where pwrite ignores its
+//    offset.
+
+static int io61_direct_start(io61_file* f) {
+    int fl = fcntl(f->fd, F_GETFL);
+    if (fl < 0 || (fl & O_APPEND) || io61_direct_set(f, 1) < 0)
+        return 0;
+    off_t off = lseek(f->fd, 0, SEEK_CUR);
+    IO61_STAT(f, nseek, 1);
+    if (off > 0)
+        f->tag = f->end_tag = f->pos_tag = off;
+    return 1;
+}
+
+
+// io61_direct_io(f, write, buf, sz, off)
+//    pread or pwrite up to `sz` bytes at `off` for IO61_DIRECT file `f`,
+//    retrying after EINTR. A file system that took O_DIRECT at open but
+//    refuses the transfer loses O_DIRECT for good, and the transfer is
+//    retried through the page cache. Returns what pread or pwrite did.
+
+static ssize_t io61_direct_io(io61_file* f, int write, unsigned char* buf,
+                              size_t sz, off_t off) {
+    while (1) {
+        ssize_t n;
+        if (write) {
+            n = pwrite(f->fd, buf, sz, off);
+            io61_stat_write(f, n);
+        } else {
+            n = pread(f->fd, buf, sz, off);
+            io61_stat_read(f, n);
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        else if (n < 0 && errno == EINVAL && f->direct > 0
+                 && io61_direct_set(f, 0) == 0) {
+            f->direct = -1;
+            continue;
+        }
+        return n;
+    }
+}
+
+
+// io61_direct_write(f, odirect, buf, sz, off)
+//    Write all `sz` bytes at `off`, with O_DIRECT if `odirect` is set
+//    and through the page cache otherwise. Returns 0 on success and -1
+//    on error.
+
+static int io61_direct_write(io61_file* f, int odirect,
+                             unsigned char* buf, size_t sz, off_t off) {
+    int toggle = !odirect && f->direct > 0 && io61_direct_set(f, 0) == 0;
+    while (sz != 0) {
+        ssize_t n = io61_direct_io(f, 1, buf, sz, off);
+        if (n <= 0)
+            break;
+        buf += n;
+        sz -= n;
+        off += n;
+    }
+    if (toggle)
+        io61_direct_set(f, 1);
+    return sz == 0 ? 0 : -1;
+}
+
+
+// io61_direct_fill(f)
+//    Refill IO61_DIRECT input `f`'s cache with the aligned window holding
+//    `f->end_tag`. Returns the number of characters read past
+//    `f->end_tag`, like io61_fill.
+
+static ssize_t io61_direct_fill(io61_file* f) {
+    off_t start = f->end_tag & ~(off_t) (DIRECT_ALIGN - 1);
+    ssize_t n = io61_direct_io(f, 0, f->rbuf, f->bufsz, start);
+    if (n < 0)
+        return -1;
+    f->tag = start;
+    return start + n > f->end_tag ? start + n - f->end_tag : 0;
+}
+
+
+// io61_direct_flush(f)
+//    Write out IO61_DIRECT output `f`'s cache. Whole aligned blocks go
+//    out with O_DIRECT. A partial block at the start of the cache (after
+//    a seek) or at its end goes through the page cache; a partial last
+//    block also stays cached, so the next flush rewrites it whole.
+//    Returns 0 on success and -1 on error.
+
+static int io61_direct_flush(io61_file* f) {
+    size_t n = f->end_tag - f->tag;
+    size_t head = (DIRECT_ALIGN - f->tag % DIRECT_ALIGN) % DIRECT_ALIGN;
+    if (head > n)
+        head = n;
+    if (head != 0) {
+        if (io61_direct_write(f, 0, f->cbuf, head, f->tag) < 0)
+            return -1;
+        memmove(f->cbuf, f->cbuf + head, n - head);
+        f->tag += head;
+        n -= head;
+    }
+    size_t tail = n % DIRECT_ALIGN;
+    size_t whole = n - tail;
+    if ((whole != 0
+         && io61_direct_write(f, 1, f->cbuf, whole, f->tag) < 0)
+        || (tail != 0
+            && io61_direct_write(f, 0, f->cbuf + whole, tail,
+                                 f->tag + whole) < 0))
+        return -1;
+    if (whole != 0 && tail != 0)
+        memmove(f->cbuf, f->cbuf + whole, tail);
+    f->tag += whole;
+    return 0;
+}
+
+
+// io61_crc_fold(f)
+//    Extend `f`'s checksum over the data consumed from, or written to,
+//    its cache since the last fold. If data was skipped or revisited
+//    since then, the checksum no longer describes one stream, and
+//    checksumming stops.
+
+static void io61_crc_fold(io61_file* f) {
+    if (f->crcstate <= 0)
+        return;
+    off_t end = f->mode == O_WRONLY ? f->end_tag : f->pos_tag;
+    if (f->crc_tag < f->tag || f->crc_tag > end) {
+        f->crcstate = -1;
+        return;
+    }
+    const unsigned char* buf = f->mode == O_WRONLY ? f->cbuf : f->rbuf;
+    f->crc = simd61_crc32c(f->crc, buf + (f->crc_tag - f->tag),
+                           end - f->crc_tag);
+    f->crc_tag = end;
+}
+
+
+// io61_crc_iov(f, iov, off, sz)
+//    Extend `f`'s checksum over `sz` bytes that bypassed its cache,
+//    found in `iov` starting `off` bytes into `iov[0]`.
+
+static void io61_crc_iov(io61_file* f, const struct iovec* iov, size_t off,
+                         size_t sz) {
+    if (f->crcstate <= 0)
+        return;
+    f->crc_tag += sz;
+    for (; sz != 0; ++iov, off = 0) {
+        size_t n = iov->iov_len - off;
+        if (n > sz)
+            n = sz;
+        f->crc = simd61_crc32c(f->crc,
+                               (const unsigned char*) iov->iov_base + off, n);
+        sz -= n;
+    }
+}
+
+
+// io61_writeout(f, buf, sz)
+//    Send `sz` buffered bytes to the file.
+
+static ssize_t io61_writeout(io61_file* f, const unsigned char* buf,
+                             size_t sz) {
+    if (sz == 0)
+        return 0;
+    else if (f->uslots)
+        return io61_uring_write(f, buf, sz);
+
+    // A compressed file writes a frame in place of the data
+    size_t len = sz;
+    if (f->lz) {
+        len = io61_lz_frame(f->lz, buf, sz);
+        buf = f->lz->zbuf;
+    }
+    if (f->wsched && len < WSCHED_DIRECT)
+        return io61_wsched_queue(f, buf, len) < 0 ? -1 : (ssize_t) sz;
+
+    struct iovec iov;
+    iov.iov_base = (void*) buf;
+    iov.iov_len = len;
+    int r;
+    if (f->wsched)
+        r = io61_wsched_flush(f, &iov, 1);
+    else
+        r = io61_writev_all(f, &iov, 1);
+    return r < 0 ? -1 : (ssize_t) sz;
+}
+
+
+// io61_sparse_start(f)
+//    Return 1 if `f` should look for holes: a plain read-only regular
+//    file with fewer blocks than its size, or a plain write-only regular
+//    file (not O_APPEND) at offset 0, so that its tags are offsets.
+
+static int io61_sparse_start(io61_file* f) {
+    struct stat s;
+    if (f->mode == O_RDWR || f->async || f->uslots || f->lz || f->direct
+        || fstat(f->fd, &s) != 0 || !S_ISREG(s.st_mode))
+        return 0;
+    else if (f->mode == O_RDONLY)
+        return (off_t) s.st_blocks * 512 < s.st_size;
+    IO61_STAT(f, nseek, 1);
+    return !(fcntl(f->fd, F_GETFL) & O_APPEND)
+        && lseek(f->fd, 0, SEEK_CUR) == 0;
+}
+
+
+// io61_hole_fill(f)
+//    If sparse input `f` is positioned in a hole, fill its cache with
+//    the hole's zeros, up to a buffer's worth, and move past them.
+//    Returns the number of zeros, or 0 if `f` is at data or end of
+//    file, or if the file system can't tell.
+
+static ssize_t io61_hole_fill(io61_file* f) {
+    IO61_STAT(f, nseek, 2);
+    off_t off = lseek(f->fd, 0, SEEK_CUR);
+    off_t data = off < 0 ? -1 : lseek(f->fd, off, SEEK_DATA);
+    struct stat s;
+    if (data < 0 && errno == ENXIO && fstat(f->fd, &s) == 0)
+        // No data after `off`: a hole runs to end of file
+        data = s.st_size;
+    else if (data < 0) {
+        f->sparse = 0;
+        return 0;
+    }
+    if (data <= off)
+        return 0;
+    size_t n = data - off < (off_t) f->bufsz ? (size_t) (data - off)
+        : f->bufsz;
+    memset(f->rbuf, 0, n);
+    IO61_STAT(f, nseek, 1);
+    if (lseek(f->fd, off + n, SEEK_SET) != off + (off_t) n)
+        return -1;
+    return n;
+}
+
+
+// io61_sparse_zeros(f, buf, sz, off)
+//    Return the index in `buf` of the first SPARSE_BLOCK-aligned block of
+//    zeros that would land past the end of sparse output `f` if `buf`
+//    were written at file offset `off`, or `sz` if there is none.
+
+static size_t io61_sparse_zeros(io61_file* f, const unsigned char* buf,
+                                size_t sz, off_t off) {
+    off_t start = off > f->sparse_size ? off : f->sparse_size;
+    start = (start + SPARSE_BLOCK - 1) & ~(off_t) (SPARSE_BLOCK - 1);
+    for (off_t i = start - off; i + SPARSE_BLOCK <= (off_t) sz;
+         i += SPARSE_BLOCK)
+        if (simd61_allzero(buf + i, SPARSE_BLOCK))
+            return i;
+    return sz;
+}
+
+
+// io61_sparse_wrote(f, end)
+//    Note that data reaching file offset `end` went to sparse output `f`
+//    without io61_sparse_flush, so later zeros before `end` are written.
+
+static inline void io61_sparse_wrote(io61_file* f, off_t end) {
+    if (f->sparse && end > f->sparse_size)
+        f->sparse_size = end;
+}
+
+
+// io61_sparse_flush(f)
+//    Write sparse output `f`'s cache, seeking over blocks of zeros past
+//    the end of the file instead of writing them. Returns 0 on success
+//    or -1 on error.
+
+static int io61_sparse_flush(io61_file* f) {
+    const unsigned char* buf = f->cbuf;
+    size_t n = f->end_tag - f->tag;
+    size_t start = 0;           // first byte not yet written or skipped
+    while (start != n) {
+        size_t z = start + io61_sparse_zeros(f, buf + start, n - start,
+                                             f->tag + start);
+        if (z != start
+            && io61_writeout(f, buf + start, z - start) != (ssize_t) (z - start))
+            return -1;
+        if (z != start)
+            io61_sparse_wrote(f, f->tag + z);
+        if (z == n)
+            break;
+        size_t e = z + SPARSE_BLOCK;
+        while (e + SPARSE_BLOCK <= n && simd61_allzero(buf + e, SPARSE_BLOCK))
+            e += SPARSE_BLOCK;
+        // Queued writes go out before the seek
+        if (f->wsched && io61_wsched_flush(f, NULL, 0) < 0)
+            return -1;
+        IO61_STAT(f, nseek, 1);
+        if (lseek(f->fd, f->tag + e, SEEK_SET) != f->tag + (off_t) e)
+            return -1;
+        if (f->tag + (off_t) e > f->sparse_end)
+            f->sparse_end = f->tag + e;
+        start = e;
+    }
+    f->pos_tag = f->tag = f->end_tag;
+    io61_buf_adapt(f, n);
+    return 0;
+}
+
+
+// io61_fill(f)
+//    Refill the read cache of `f` with the data following `f->end_tag`.
+//    Returns the number of characters read, 0 at end-of-file, or -1 on
+//    error.
+
+static ssize_t io61_fill(io61_file* f) {
+    // A read/write file refills at the read position, which may be
+    // anywhere in the cache, so its modified data must go out first.
+    if (f->mode == O_RDWR && io61_flush_dirty(f) < 0)
+        return -1;
+    io61_crc_fold(f);
+    f->tag = f->end_tag; // mark cache as empty
+    ssize_t n;
+    if (f->async)
+        n = io61_async_next(f);
+    else if (f->uslots)
+        n = io61_uring_next(f);
+    else if (f->lz)
+        n = io61_lz_fill(f);
+    else if (f->direct)
+        n = io61_direct_fill(f);
+    else {
+        io61_pool_use(f);
+        io61_buf_adapt(f, f->lastfill);
+        if (f->mode == O_RDWR)
+            n = pread(f->fd, f->rbuf, f->bufsz, f->tag);
+        else if (f->sparse && (n = io61_hole_fill(f)) > 0)
+            /* the cache holds a hole's zeros */;
+        else
+            n = read(f->fd, f->rbuf, f->bufsz);
+        io61_stat_read(f, n);
+        f->lastfill = n > 0 ? n : 0;
+    }
+    IO61_STAT(f, fills, 1);
+    if (n > 0)
+        f->end_tag += n;
+    return n;
+}
+
+
+// io61_readc(f)
+//    Read a single (unsigned) character from `f` and return it. Returns EOF
+//    (which is -1) on error or end-of-file.
+
+int io61_readc(io61_file* f) {
+    if (f->pos_tag < f->end_tag && f->mode != O_WRONLY && !f->stats) {
+        f->pos_tag++;
+        return *(f->rbuf + f->pos_tag - f->tag - 1);
+    }
+    return io61_readc_slow(f);
+}
+
+// io61_readc_slow(f)
+//    The rest of io61_readc: refills, and every character when counting
+//    IO61_STATS. Kept out of line so io61_readc stays a leaf function.
+
+static __attribute__((noinline)) int io61_readc_slow(io61_file* f) {
+    if (f->mode == O_WRONLY)
+        return -1;
+    if (f->pos_tag < f->end_tag) {
+        IO61_STAT(f, hits, 1);
+        f->pos_tag++;
+        return *(f->rbuf + f->pos_tag - f->tag - 1);
+    }else {
+        IO61_STAT(f, misses, 1);
+        // An IO61_DIRECT refill may end before the position
+        ssize_t size;
+        do {
+            size = io61_fill(f);
+        } while (size > 0 && f->pos_tag >= f->end_tag);
+        if (size > 0) {
+            f->pos_tag++;
+            return *(f->rbuf + f->pos_tag - f->tag - 1);
+        }else{
+            return EOF;
+	}
+    }
+}
+
+
+// io61_read(f, buf, sz)
+//    Read up to `sz` characters from `f` into `buf`. Returns the number of
+//    characters read on success; normally this is `sz`. Returns a short
+//    count, which might be zero, if the file ended before `sz` characters
+//    could be read. Returns -1 if an error occurred before any characters
+//    were read.
+
+ssize_t io61_read(io61_file* f, char* buf, size_t sz) { 
+    io61_stat_access(f, f->end_tag - f->pos_tag >= (off_t) sz);
+    size_t nread = 0;
+    while (nread != sz) {
+    	if(f->pos_tag < f->end_tag) {
+        	ssize_t n = sz - nread;
+                if (n > f->end_tag - f->pos_tag)
+                	n = f->end_tag - f->pos_tag;
+                memcpy(&buf[nread], &f->rbuf[f->pos_tag - f->tag], n);
+                f->pos_tag += n;
+                nread += n;
+         }else{
+                // A pipe returns what has arrived rather than wait for
+                // more, and large requests skip the cache
+                if (f->pipe && nread != 0)
+                        return nread;
+                ssize_t n;
+                if (f->pipe && sz >= f->bufsz) {
+                        io61_crc_fold(f);
+                        n = read(f->fd, buf, sz);
+                        io61_stat_read(f, n);
+                        if (n > 0) {
+                                struct iovec iov = { buf, n };
+                                io61_crc_iov(f, &iov, 0, n);
+                                f->tag = f->end_tag = f->pos_tag = f->pos_tag + n;
+                        }
+                        return n;
+                }
+                n = io61_fill(f);
+                if(n <= 0)
+                	return nread ? (ssize_t) nread : (ssize_t) n;
+ 	}        
+    }  
+    return nread;
+}	
+
+
+// io61_readuntil(f, buf, sz, delim)
+//    Read characters from `f` up to and including the next `delim`, but
+//    no more than `sz` of them, into `buf`; if `buf` is NULL, skip them.
+//    Each cached window is searched for `delim` with simd61_memchr.
+//    Returns the number of characters read, 0 at end of file, or -1 if
+//    an error occurred before any characters were read.
+
+static ssize_t io61_readuntil(io61_file* f, char* buf, size_t sz,
+                              int delim) {
+    if (f->mode == O_WRONLY)
+        return -1;
+    size_t nread = 0;
+    int hit = 1;
+    while (nread != sz) {
+        while (f->pos_tag >= f->end_tag) {
+            if (hit)
+                io61_stat_access(f, hit = 0);
+            ssize_t r = io61_fill(f);
+            if (r <= 0)
+                return nread ? (ssize_t) nread : r;
+        }
+        const unsigned char* p = &f->rbuf[f->pos_tag - f->tag];
+        size_t n = f->end_tag - f->pos_tag;
+        if (n > sz - nread)
+            n = sz - nread;
+        const unsigned char* d = simd61_memchr(p, delim, n);
+        if (d)
+            n = d - p + 1;
+        if (buf)
+            memcpy(&buf[nread], p, n);
+        f->pos_tag += n;
+        nread += n;
+        if (d)
+            break;
+    }
+    if (hit)
+        io61_stat_access(f, 1);
+    return nread;
+}
+
+
+// io61_readline(f, buf, sz)
+//    Read one line from `f` into `buf`, including its newline, but no
+//    more than `sz` characters. The line is not null-terminated. Returns
+//    the number of characters read, like io61_read; a return value of
+//    `sz` without a final newline means the line continues.
+
+ssize_t io61_readline(io61_file* f, char* buf, size_t sz) {
+    return io61_readuntil(f, buf, sz, '\n');
+}
+
+
+// io61_scan(f, delim)
+//    Skip past the next `delim` character in `f`. Returns the number of
+//    characters skipped, including the `delim`; fewer if the file ended
+//    first; 0 at end of file; or -1 on error.
+
+ssize_t io61_scan(io61_file* f, int delim) {
+    return io61_readuntil(f, NULL, SSIZE_MAX, delim);
+}
+
+
+// io61_read_reverse(f, buf, sz)
+//    Read up to `sz` characters preceding the file position of read-only
+//    file `f` into `buf`, last character first, and move the position
+//    back past them. Each cached window is copied out with one
+//    simd61_reverse; when the cache runs out, it is refilled with the
+//    window that ends at the position. Returns the number of characters
+//    read, which is less than `sz` if the start of the file (or, past
+//    end of file, the end) came first, or -1 on error before any
+//    characters were read.
+
+ssize_t io61_read_reverse(io61_file* f, char* buf, size_t sz) {
+    if (f->mode != O_RDONLY)
+        return -1;
+    io61_stat_access(f, f->pos_tag - f->tag >= (off_t) sz
+                     && f->pos_tag <= f->end_tag);
+    size_t nread = 0;
+    while (nread != sz && f->pos_tag > 0) {
+        if (f->pos_tag <= f->tag || f->pos_tag > f->end_tag) {
+            io61_pool_use(f);
+            off_t pos = f->pos_tag;
+            off_t start = pos > (off_t) f->bufsz ? pos - (off_t) f->bufsz : 0;
+            // Compressed files refill with the frame that ends by `pos`;
+            // direct files, with an aligned window that reaches `pos`
+            if (f->lz)
+                start = pos - 1;
+            else if (f->direct)
+                start = (start + DIRECT_ALIGN - 1) & ~(off_t) (DIRECT_ALIGN - 1);
+            if (io61_reposition(f, start) < 0)
+                return nread ? (ssize_t) nread : -1;
+            ssize_t r = io61_fill(f);
+            if (r <= 0 || f->end_tag < pos) {
+                f->pos_tag = f->tag;
+                return nread ? (ssize_t) nread : (r < 0 ? -1 : 0);
+            }
+            f->pos_tag = pos;
+        }
+        size_t n = f->pos_tag - f->tag;
+        if (n > sz - nread)
+            n = sz - nread;
+        simd61_reverse((unsigned char*) &buf[nread],
+                       &f->rbuf[f->pos_tag - f->tag - n], n);
+        f->pos_tag -= n;
+        nread += n;
+    }
+    return nread;
+}
+
+
+// io61_set_recsize(f, sz)
+//    Set the record size for io61_records_next on `f` to `sz` bytes.
+//    Returns 0 on success and -1 if `sz` is 0 or a record is partly
+//    gathered.
+
+int io61_set_recsize(io61_file* f, size_t sz) {
+    if (sz == 0 || f->rcarrylen != 0)
+        return -1;
+    f->rcarry = (unsigned char*) realloc(f->rcarry, sz);
+    f->recsize = sz;
+    return 0;
+}
+
+
+// io61_records_next(f, ptr, count)
+//    Return the next fixed-size records of `f` without copying them:
+//    point `*ptr` at as many whole records as the cache holds, set
+//    `*count` to their number, and return their size in bytes. A
+//    record that straddles a refill is gathered in a carry buffer and
+//    returned alone. The records stay valid until the next call on `f`.
+//    A partial record at end of file is returned with `*count` 0; after
+//    that, returns 0. Returns -1 on error, or if the record size isn't
+//    set (see io61_set_recsize); a nonblocking file keeps a partly
+//    gathered record for the next call.
+
+ssize_t io61_records_next(io61_file* f, const char** ptr, size_t* count) {
+    *count = 0;
+    if (f->mode == O_WRONLY || f->recsize == 0)
+        return -1;
+    f->pinned = 0;
+    size_t rs = f->recsize;
+    if (f->rcarrylen == 0) {
+        if (f->pos_tag >= f->end_tag) {
+            ssize_t r = io61_fill(f);
+            if (r <= 0)
+                return r;
+        }
+        size_t n = f->end_tag - f->pos_tag;
+        io61_stat_access(f, n >= rs);
+        if (n >= rs) {
+            n -= n % rs;
+            *ptr = (const char*) &f->rbuf[f->pos_tag - f->tag];
+            *count = n / rs;
+            f->pos_tag += n;
+            // Writing the records to another file mustn't reclaim this
+            // cache for the buffer pool
+            f->pinned = 1;
+            return n;
+        }
+        memcpy(f->rcarry, &f->rbuf[f->pos_tag - f->tag], n);
+        f->rcarrylen = n;
+        f->pos_tag = f->end_tag;
+    }
+    while (f->rcarrylen != rs) {
+        if (f->pos_tag >= f->end_tag) {
+            ssize_t r = io61_fill(f);
+            if (r < 0)
+                return -1;
+            else if (r == 0)
+                break;
+        }
+        size_t n = f->end_tag - f->pos_tag;
+        if (n > rs - f->rcarrylen)
+            n = rs - f->rcarrylen;
+        memcpy(&f->rcarry[f->rcarrylen], &f->rbuf[f->pos_tag - f->tag], n);
+        f->rcarrylen += n;
+        f->pos_tag += n;
+    }
+    size_t n = f->rcarrylen;
+    f->rcarrylen = 0;
+    *ptr = (const char*) f->rcarry;
+    *count = n == rs;
+    return n;
+}
+
+
+// io61_skip_lines(f, k)
+//    Move `f`'s position past the next `k` newlines, counting them a
+//    cached window at a time with simd61_memchr_nth. Returns the number
+//    skipped, which is less than `k` if the file ended first, or -1 on
+//    error.
+
+static ssize_t io61_skip_lines(io61_file* f, size_t k) {
+    size_t left = k;
+    while (left != 0) {
+        while (f->pos_tag >= f->end_tag) {
+            ssize_t r = io61_fill(f);
+            if (r < 0)
+                return -1;
+            else if (r == 0)
+                return k - left;
+        }
+        const unsigned char* p = &f->rbuf[f->pos_tag - f->tag];
+        size_t n = f->end_tag - f->pos_tag;
+        const unsigned char* d = simd61_memchr_nth(p, '\n', n, &left);
+        f->pos_tag += d ? d - p + 1 : (off_t) n;
+    }
+    return k;
+}
+
+
+// io61_mtime_ns(s)
+//    Return the modification time in `s` in nanoseconds.
+
+static uint64_t io61_mtime_ns(const struct stat* s) {
+    return (uint64_t) s->st_mtim.tv_sec * 1000000000 + s->st_mtim.tv_nsec;
+}
+
+
+// io61_index_lines(f, every, indexfile)
+//    Build a line index for readable file `f` in one pass from its
+//    start, with an entry every `every` lines, and use it for
+//    io61_seek_line. If `indexfile` is not NULL, save the index there
+//    for io61_load_line_index. Leaves `f` at end of file. Returns 0 on
+//    success and -1 on failure.
+
+int io61_index_lines(io61_file* f, size_t every, const char* indexfile) {
+    if (f->mode == O_WRONLY || every == 0 || io61_seek(f, 0) < 0)
+        return -1;
+    size_t n = 1, cap = 256, lines = 0;
+    off_t* index = (off_t*) malloc(sizeof(off_t) * cap);
+    index[0] = 0;
+    ssize_t r;
+    while ((r = io61_skip_lines(f, every)) == (ssize_t) every) {
+        lines += every;
+        if (n == cap) {
+            cap *= 2;
+            index = (off_t*) realloc(index, sizeof(off_t) * cap);
+        }
+        index[n++] = f->pos_tag;
+    }
+    if (r < 0) {
+        free(index);
+        return -1;
+    }
+    free(f->lindex);
+    f->lindex = index;
+    f->lindex_n = n;
+    f->lindex_every = every;
+    f->lindex_lines = lines + r;
+    if (!indexfile)
+        return 0;
+
+    struct stat s;
+    int fd = open(indexfile, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+        return -1;
+    io61_file* idx = io61_fdopen(fd, O_WRONLY);
+    uint64_t hdr[LINDEX_HEADER] = {
+        LINDEX_MAGIC, every, f->lindex_lines, 0, 0, n
+    };
+    if (fstat(f->fd, &s) == 0) {
+        hdr[3] = s.st_size;
+        hdr[4] = io61_mtime_ns(&s);
+    }
+    for (int i = 0; i != LINDEX_HEADER; ++i)
+        hdr[i] = htole64(hdr[i]);
+    ssize_t w = io61_write(idx, (const char*) hdr, sizeof(hdr));
+    for (size_t i = 0; i != n && w >= 0; ++i) {
+        uint64_t x = htole64(index[i]);
+        w = io61_write(idx, (const char*) &x, sizeof(x));
+    }
+    return io61_close(idx) < 0 || w < 0 ? -1 : 0;
+}
+
+
+// io61_load_line_index(f, indexfile)
+//    Use the line index saved in `indexfile` for io61_seek_line on `f`.
+//    Returns 0 on success and -1 on failure; an index that is malformed,
+//    or stale because `f`'s file changed size or modification time since
+//    it was built, fails with errno EINVAL.
+
+int io61_load_line_index(io61_file* f, const char* indexfile) {
+    struct stat s;
+    if (f->mode == O_WRONLY || fstat(f->fd, &s) < 0)
+        return -1;
+    int fd = open(indexfile, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    io61_file* idx = io61_fdopen(fd, O_RDONLY);
+    uint64_t hdr[LINDEX_HEADER];
+    off_t* index = NULL;
+    size_t n = 0;
+    int ok = io61_read(idx, (char*) hdr, sizeof(hdr)) == sizeof(hdr);
+    for (int i = 0; ok && i != LINDEX_HEADER; ++i)
+        hdr[i] = le64toh(hdr[i]);
+    ok = ok && hdr[0] == LINDEX_MAGIC && hdr[1] != 0
+        && hdr[3] == (uint64_t) s.st_size && hdr[4] == io61_mtime_ns(&s)
+        && hdr[5] != 0 && hdr[5] - 1 <= hdr[2] / hdr[1]
+        && hdr[2] <= (uint64_t) s.st_size;
+    if (ok) {
+        n = hdr[5];
+        index = (off_t*) malloc(sizeof(off_t) * n);
+    }
+    for (size_t i = 0; ok && i != n; ++i) {
+        uint64_t x;
+        ok = io61_read(idx, (char*) &x, sizeof(x)) == sizeof(x);
+        index[i] = le64toh(x);
+        ok = ok && index[i] <= s.st_size
+            && (i == 0 ? index[i] == 0 : index[i] > index[i - 1]);
+    }
+    io61_close(idx);
+    if (!ok) {
+        free(index);
+        errno = EINVAL;
+        return -1;
+    }
+    free(f->lindex);
+    f->lindex = index;
+    f->lindex_n = n;
+    f->lindex_every = hdr[1];
+    f->lindex_lines = hdr[2];
+    return 0;
+}
+
+
+// io61_seek_line(f, n)
+//    Move readable file `f`'s position to the start of line `n`,
+//    counting from 0. With a line index, that takes one lookup and a
+//    scan of fewer than the index's spacing; otherwise the file is
+//    scanned from its start. Returns `n`, or, if the file has fewer
+//    newlines than `n`, their number (leaving `f` at end of file), or
+//    -1 on failure.
+
+ssize_t io61_seek_line(io61_file* f, size_t n) {
+    if (f->mode == O_WRONLY)
+        return -1;
+    size_t i = 0;
+    if (f->lindex) {
+        i = n / f->lindex_every;
+        if (i >= f->lindex_n)
+            i = f->lindex_n - 1;
+    }
+    if (io61_seek(f, f->lindex ? f->lindex[i] : 0) < 0)
+        return -1;
+    size_t base = i * f->lindex_every;
+    ssize_t r = io61_skip_lines(f, n - base);
+    return r < 0 ? -1 : (ssize_t) (base + r);
+}
+
+
+// io61_make_room(f)
+//    Flush `f`'s full cache (or give a pooled file without a buffer
+//    one) so that it can take more characters. Returns 0 on success or
+//    -1 on error. A nonblocking file succeeds if the flush made some
+//    room, even if it could not write everything.
+
+static int io61_make_room(io61_file* f) {
+    if (io61_flush_buffers(f) < 0
+        && !(f->nonblock && errno == EAGAIN
+             && f->end_tag - f->tag < (off_t) f->bufsz))
+        return -1;
+    io61_pool_use(f);
+    return 0;
+}
+
+
+// io61_writec(f)
+//    Write a single character `ch` to `f`. Returns 0 on success or
+//    -1 on error.
+
+int io61_writec(io61_file* f, int ch) {
+    if (f->mode == O_RDONLY)
+        return -1;
+    if (f->pos_tag - f->tag == (off_t) f->bufsz
+        && io61_make_room(f) < 0)
+        return -1;
+    f->cbuf[f->pos_tag - f->tag] = ch;
+    if (f->mode == O_RDWR)
+        io61_mark_dirty(f, f->pos_tag, 1);
+    ++f->pos_tag;
+    if (f->pos_tag > f->end_tag)
+        f->end_tag = f->pos_tag;
+    return 0;
+}
+
+
+// io61_write(f, buf, sz)
+//    Write `sz` characters from `buf` to `f`. Returns the number of
+//    characters written on success; normally this is `sz`. Returns -1 if
+//    an error occurred before any characters were written.
+
+ssize_t io61_write(io61_file* f, const char* buf, size_t sz) {
+   // A pipe sends a message that doesn't fit with what is buffered
+   // (typically its header) in one system call, without copying it
+   if (f->pipe && f->mode == O_WRONLY
+       && f->end_tag - f->tag + sz > f->bufsz) {
+       struct iovec iov;
+       iov.iov_base = (void*) buf;
+       iov.iov_len = sz;
+       return io61_writev(f, &iov, 1);
+   }
+   size_t nwritten = 0;
+   if((f->mode & O_ACCMODE) != O_RDONLY){
+   	while (nwritten != sz) {
+       		if (f->pos_tag - f->tag < (off_t) f->bufsz) { // If there is space in buffer
+           	     size_t n = sz - nwritten;
+           	if (f->bufsz - (f->pos_tag - f->tag) < n)
+               	     n = f->bufsz - (f->pos_tag - f->tag);
+           	memcpy(&f->cbuf[f->pos_tag - f->tag], &buf[nwritten], n);
+           	if (f->mode == O_RDWR)
+           	     io61_mark_dirty(f, f->pos_tag, n);
+           	f->pos_tag += n;
+           	if (f->pos_tag > f->end_tag)
+                     f->end_tag = f->pos_tag;
+           nwritten += n;
+       }
+       // The position should never exceed the end tag.
+       assert(f->pos_tag <= f->end_tag);
+
+       // Check if we've filled the buffer and if so, call flush to write data.
+       if (f->pos_tag - f->tag == (off_t) f->bufsz // Indicates that the buffer is full
+           && io61_make_room(f) < 0)
+           return nwritten ? (ssize_t) nwritten : -1;
+	}
+   }
+   return nwritten;
+}
+
+
+// io61_sparse_iov(f, iov, iovcnt)
+//    Return 1 if writing `iov` after sparse output `f`'s cache would
+//    write a block of zeros past the end of the file, so it should go
+//    through the cache instead.
+
+static int io61_sparse_iov(io61_file* f, const struct iovec* iov,
+                           int iovcnt) {
+    off_t off = f->end_tag;
+    for (int i = 0; i != iovcnt; ++i) {
+        const unsigned char* p = (const unsigned char*) iov[i].iov_base;
+        if (io61_sparse_zeros(f, p, iov[i].iov_len, off) != iov[i].iov_len)
+            return 1;
+        off += iov[i].iov_len;
+    }
+    return 0;
+}
+
+
+// io61_writev(f, iov, iovcnt)
+//    Write the `iovcnt` buffers in `iov` to `f`, in order. Returns the
+//    number of characters written on success; normally this is the sum
+//    of the buffer lengths. Returns -1 if an error occurred before any
+//    characters were written. Requests of a buffer or more (on IO61_PIPE
+//    files, requests that don't fit in the buffer) go out in one writev
+//    together with the buffered and queued data, without copying.
+
+ssize_t io61_writev(io61_file* f, const struct iovec* iov, int iovcnt) {
+    size_t sz = 0;
+    for (int i = 0; i != iovcnt; ++i)
+        sz += iov[i].iov_len;
+    io61_pool_use(f);
+    if (f->mode != O_WRONLY || f->uslots || f->lz || f->direct
+        || f->nonblock || f->fanout
+        || (f->pipe ? f->end_tag - f->tag + sz <= f->bufsz : sz < f->bufsz)
+        || (f->sparse && io61_sparse_iov(f, iov, iovcnt))) {
+        size_t nwritten = 0;
+        for (int i = 0; i != iovcnt; ++i) {
+            ssize_t n = io61_write(f, (const char*) iov[i].iov_base,
+                                   iov[i].iov_len);
+            if (n < 0)
+                return nwritten ? (ssize_t) nwritten : -1;
+            nwritten += n;
+        }
+        return nwritten;
+    }
+
+    io61_crc_fold(f);
+    io61_crc_iov(f, iov, 0, sz);
+    struct iovec* xiov = (struct iovec*) malloc(sizeof(struct iovec) * (iovcnt + 1));
+    xiov[0].iov_base = f->cbuf;
+    xiov[0].iov_len = f->end_tag - f->tag;
+    memcpy(&xiov[1], iov, sizeof(struct iovec) * iovcnt);
+    int r;
+    if (f->wsched)
+        r = io61_wsched_flush(f, xiov, iovcnt + 1);
+    else
+        r = io61_writev_all(f, xiov, iovcnt + 1);
+    free(xiov);
+    if (r < 0)
+        return -1;
+    f->pos_tag = f->tag = f->end_tag = f->end_tag + sz;
+    io61_sparse_wrote(f, f->end_tag);
+    return sz;
+}
+
+
+// io61_readv(f, iov, iovcnt)
+//    Read into the `iovcnt` buffers in `iov`, in order. Returns the number
+//    of characters read, like io61_read. Once the cache is drained, large
+//    requests are read with one readv that also refills the cache.
+
+ssize_t io61_readv(io61_file* f, const struct iovec* iov, int iovcnt) {
+    size_t nread = 0;
+    int i = 0;
+    size_t off = 0; // characters of iov[i] already filled
+
+    // Serve what the cache holds
+    while (i != iovcnt && f->pos_tag < f->end_tag) {
+        size_t n = iov[i].iov_len - off;
+        if (n == 0) {
+            ++i;
+            off = 0;
+            continue;
+        }
+        if (n > (size_t) (f->end_tag - f->pos_tag))
+            n = f->end_tag - f->pos_tag;
+        ssize_t r = io61_read(f, (char*) iov[i].iov_base + off, n);
+        if (r <= 0)
+            return nread ? (ssize_t) nread : r;
+        nread += r;
+        off += r;
+        if (off == iov[i].iov_len) {
+            ++i;
+            off = 0;
+        }
+    }
+
+    size_t rest = 0;
+    for (int j = i; j != iovcnt; ++j)
+        rest += iov[j].iov_len;
+    rest -= off;
+    io61_pool_use(f);
+    if (rest >= f->bufsz && !f->async && !f->uslots && !f->lz && !f->direct
+        && f->mode == O_RDONLY
+        && f->pos_tag == f->end_tag && iovcnt - i < IOV_MAX) {
+        struct iovec* xiov = (struct iovec*) malloc(sizeof(struct iovec) * (iovcnt - i + 1));
+        memcpy(xiov, &iov[i], sizeof(struct iovec) * (iovcnt - i));
+        xiov[0].iov_base = (char*) xiov[0].iov_base + off;
+        xiov[0].iov_len -= off;
+        xiov[iovcnt - i].iov_base = f->rbuf;
+        xiov[iovcnt - i].iov_len = f->bufsz;
+        io61_crc_fold(f);
+        ssize_t n;
+        do {
+            n = readv(f->fd, xiov, iovcnt - i + 1);
+            io61_stat_read(f, n);
+        } while (n < 0 && errno == EINTR);
+        free(xiov);
+        if (n <= 0)
+            return nread ? (ssize_t) nread : n;
+        io61_crc_iov(f, &iov[i], off, (size_t) n < rest ? (size_t) n : rest);
+        // Anything past the caller's buffers landed in the cache
+        f->end_tag += n;
+        if ((size_t) n > rest) {
+            f->tag = f->pos_tag = f->end_tag - (n - rest);
+            return nread + rest;
+        }
+        f->tag = f->pos_tag = f->end_tag;
+        nread += n;
+        // Advance past what readv filled
+        off += n;
+        while (i != iovcnt && off >= iov[i].iov_len) {
+            off -= iov[i].iov_len;
+            ++i;
+        }
+    }
+
+    // Anything left (small requests, short reads) goes through the cache
+    for (; i != iovcnt; ++i, off = 0) {
+        size_t want = iov[i].iov_len - off;
+        ssize_t r = io61_read(f, (char*) iov[i].iov_base + off, want);
+        if (r < 0)
+            return nread ? (ssize_t) nread : r;
+        nread += r;
+        if ((size_t) r != want)
+            break;
+    }
+    return nread;
+}
+
+
+// io61_batch_compare(a, b)
+//    qsort comparator for batch requests: by offset, then by caller
+//    order.
+
+static int io61_batch_compare(const void* a, const void* b) {
+    const io61_batch_key* ka = (const io61_batch_key*) a;
+    const io61_batch_key* kb = (const io61_batch_key*) b;
+    if (ka->off != kb->off)
+        return ka->off < kb->off ? -1 : 1;
+    return ka->i < kb->i ? -1 : ka->i > kb->i;
+}
+
+
+// io61_batch_transfer(f, write, iov, iovcnt, off)
+//    preadv or pwritev all of `iov` at `off`, continuing after short
+//    transfers until end of file. Modifies `iov`. Returns the number of
+//    bytes transferred, or -1 if an error occurred before any were.
+
+static ssize_t io61_batch_transfer(io61_file* f, int write,
+                                   struct iovec* iov, int iovcnt,
+                                   off_t off) {
+    size_t ndone = 0;
+    while (iovcnt > 0) {
+        ssize_t n;
+        if (write) {
+            n = pwritev(f->fd, iov, iovcnt, off + ndone);
+            io61_stat_write(f, n);
+        } else {
+            n = preadv(f->fd, iov, iovcnt, off + ndone);
+            io61_stat_read(f, n);
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        else if (n < 0)
+            return ndone ? (ssize_t) ndone : -1;
+        else if (n == 0)
+            break;
+        ndone += n;
+        while (iovcnt > 0 && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char*) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return ndone;
+}
+
+
+// io61_batch(f, write, ops, n)
+//    The body of io61_read_batch and io61_write_batch.
+
+static ssize_t io61_batch(io61_file* f, int write, io61_batch_op* ops,
+                          size_t n) {
+    if (f->mode == (write ? O_RDONLY : O_WRONLY)
+        || (write && (f->lz || f->fanout)))
+        return -1;
+    // Callers' buffers needn't be aligned, so batches on IO61_DIRECT
+    // files go through the page cache
+    if (f->direct > 0 && io61_direct_set(f, 0) == 0) {
+        f->direct = -1;
+        ssize_t r = io61_batch(f, write, ops, n);
+        f->direct = 1;
+        io61_direct_set(f, 1);
+        return r;
+    }
+    // Batched writes change the file outside the checksummed stream
+    if (write && f->crcstate > 0)
+        f->crcstate = -1;
+    // Buffered output goes first. Writes must land after it, and a
+    // read/write cache may hold changes that reads must see; flushing
+    // also empties that cache, so nothing stale survives the batch.
+    if ((write || f->mode == O_RDWR) && io61_flush(f) < 0)
+        return -1;
+    // A direct file's cached last block is on disk already
+    if (f->direct && f->mode == O_WRONLY)
+        f->tag = f->end_tag;
+    if (write && f->uslots && io61_uring_drain(f) < 0)
+        return -1;
+    for (size_t i = 0; write && i != n; ++i)
+        io61_sparse_wrote(f, ops[i].off + ops[i].len);
+
+    io61_batch_key* keys = (io61_batch_key*) malloc(sizeof(io61_batch_key) * n);
+    for (size_t i = 0; i != n; ++i) {
+        keys[i].off = ops[i].off;
+        keys[i].i = i;
+        ops[i].result = 0;
+    }
+    qsort(keys, n, sizeof(io61_batch_key), io61_batch_compare);
+    // Compressed files have no offsets to batch; read in order, outside
+    // the checksummed stream
+    if (f->lz) {
+        off_t pos = f->pos_tag;
+        io61_crc_fold(f);
+        int crcstate = f->crcstate;
+        f->crcstate = 0;
+        ssize_t total = 0;
+        int err = 0;
+        for (size_t k = 0; k != n; ++k) {
+            io61_batch_op* op = &ops[keys[k].i];
+            if (io61_seek(f, op->off) < 0
+                || (op->result = io61_read(f, op->buf, op->len)) < 0) {
+                op->result = -1;
+                err = 1;
+            } else
+                total += op->result;
+        }
+        free(keys);
+        int r = io61_seek(f, pos);
+        f->crcstate = crcstate;
+        if (r < 0 || (err && total == 0))
+            return -1;
+        return total;
+    }
+    // Overlapping writes must land in caller order, so later ones win
+    for (size_t k = 1; write && k < n; ++k)
+        if (keys[k - 1].off + (off_t) ops[keys[k - 1].i].len > keys[k].off) {
+            for (size_t i = 0; i != n; ++i) {
+                keys[i].off = ops[i].off;
+                keys[i].i = i;
+            }
+            break;
+        }
+
+    // Merge requests into runs. Each request adds at most two buffers:
+    // itself and a gap before it.
+    struct iovec* iov = (struct iovec*) malloc(sizeof(struct iovec) * 2 * n);
+    size_t* owner = (size_t*) malloc(sizeof(size_t) * 2 * n);
+    io61_batch_run* runs = (io61_batch_run*) malloc(sizeof(io61_batch_run) * n);
+    size_t niov = 0, nruns = 0;
+    off_t end = 0;
+    for (size_t k = 0; k != n; ++k) {
+        io61_batch_op* op = &ops[keys[k].i];
+        if (op->len == 0)
+            continue;
+        io61_batch_run* r = nruns ? &runs[nruns - 1] : NULL;
+        off_t gap = op->off - end;
+        if (!r || r->iovcnt >= IOV_MAX - 1
+            || !(gap == 0 || (!write && gap > 0 && gap <= BATCH_GAP))) {
+            r = &runs[nruns];
+            ++nruns;
+            r->off = op->off;
+            r->first = niov;
+            r->iovcnt = 0;
+        } else if (gap > 0) {
+            iov[niov].iov_base = io61_batch_scratch;
+            iov[niov].iov_len = gap;
+            owner[niov] = (size_t) -1;
+            ++niov;
+            ++r->iovcnt;
+        }
+        iov[niov].iov_base = op->buf;
+        iov[niov].iov_len = op->len;
+        owner[niov] = keys[k].i;
+        ++niov;
+        ++r->iovcnt;
+        end = op->off + op->len;
+    }
+    free(keys);
+
+    // IO61_URING files send every run to the kernel at once
+    if (f->uslots) {
+        for (size_t i = 0; i != nruns; ++i) {
+            io61_batch_run* r = &runs[i];
+            r->slot.inflight = 1;
+            uint64_t data = (uintptr_t) &r->slot;
+            while ((write
+                    ? uring61_prep_writev(io61_ring, f->fd, &iov[r->first],
+                                          r->iovcnt, r->off, data)
+                    : uring61_prep_readv(io61_ring, f->fd, &iov[r->first],
+                                         r->iovcnt, r->off, data)) < 0) {
+                if (io61_uring_submit(1) < 0) {
+                    r->slot.res = -errno;
+                    r->slot.inflight = 0;
+                    break;
+                }
+                io61_uring_reap();
+            }
+        }
+        io61_uring_submit(0);
+    }
+    struct iovec tmp[IOV_MAX];
+    for (size_t i = 0; i != nruns; ++i) {
+        io61_batch_run* r = &runs[i];
+        memcpy(tmp, &iov[r->first], sizeof(struct iovec) * r->iovcnt);
+        struct iovec* rest = tmp;
+        int restcnt = r->iovcnt;
+        r->result = 0;
+        if (f->uslots) {
+            io61_uring_wait(&r->slot);
+            if (write)
+                io61_stat_write(f, r->slot.res);
+            else
+                io61_stat_read(f, r->slot.res);
+            if (r->slot.res < 0) {
+                errno = -r->slot.res;
+                r->result = -1;
+                continue;
+            }
+            // Finish a short transfer synchronously
+            r->result = r->slot.res;
+            size_t skip = r->result;
+            while (restcnt > 0 && skip >= rest->iov_len) {
+                skip -= rest->iov_len;
+                ++rest;
+                --restcnt;
+            }
+            if (restcnt > 0) {
+                rest->iov_base = (char*) rest->iov_base + skip;
+                rest->iov_len -= skip;
+            }
+            if (r->result == 0)
+                restcnt = 0;
+        }
+        if (restcnt > 0) {
+            ssize_t x = io61_batch_transfer(f, write, rest, restcnt,
+                                            r->off + r->result);
+            if (x < 0 && r->result == 0)
+                r->result = -1;
+            else if (x > 0)
+                r->result += x;
+        }
+    }
+
+    // Hand each request its share of its run's result
+    ssize_t total = 0;
+    int err = 0;
+    for (size_t i = 0; i != nruns; ++i) {
+        ssize_t left = runs[i].result;
+        if (left < 0)
+            err = errno;
+        for (size_t j = runs[i].first; j != runs[i].first + runs[i].iovcnt; ++j) {
+            size_t m = left > 0 ? (size_t) left : 0;
+            if (m > iov[j].iov_len)
+                m = iov[j].iov_len;
+            if (owner[j] != (size_t) -1) {
+                ops[owner[j]].result = left < 0 ? -1 : (ssize_t) m;
+                total += m;
+            }
+            if (left > 0)
+                left -= m;
+        }
+    }
+    free(iov);
+    free(owner);
+    free(runs);
+    if (err && total == 0) {
+        errno = err;
+        return -1;
+    }
+    return total;
+}
+
+
+// io61_read_batch(f, ops, n)
+//    Perform the `n` reads in `ops`: read `ops[i].len` bytes at offset
+//    `ops[i].off` into `ops[i].buf`, setting `ops[i].result` to the
+//    number of bytes read (fewer at end of file) or -1 on error. The
+//    requests are sorted and merged, so their order in `ops` does not
+//    matter. The file position does not change. Returns the total
+//    number of bytes read, or -1 if an error occurred before any were.
+
+ssize_t io61_read_batch(io61_file* f, io61_batch_op* ops, size_t n) {
+    return io61_batch(f, 0, ops, n);
+}
+
+
+// io61_write_batch(f, ops, n)
+//    Perform the `n` writes in `ops`: write `ops[i].len` bytes from
+//    `ops[i].buf` at offset `ops[i].off`, after any buffered output.
+//    Sets each `ops[i].result` and returns like io61_read_batch. Writes
+//    that overlap land in caller order.
+
+ssize_t io61_write_batch(io61_file* f, io61_batch_op* ops, size_t n) {
+    return io61_batch(f, 1, ops, n);
+}
+
+
+// io61_flush(f)
+//    Forces a write of all buffered data written to `f`.
+//    If `f` was opened read-only, io61_flush(f) may either drop all
+//    data buffered for reading, or do nothing.
+
+int io61_flush(io61_file* f) {
+    int r = io61_flush_buffers(f);
+    if (f->fanout && io61_fanout_drain(f) < 0)
+        r = -1;
+    if (f->wsched && io61_wsched_flush(f, NULL, 0) < 0)
+        r = -1;
+    // A trailing hole has no data to extend the file
+    if (f->sparse && f->mode == O_WRONLY && f->sparse_end > f->sparse_size) {
+        if (ftruncate(f->fd, f->sparse_end) < 0)
+            r = -1;
+        else
+            f->sparse_size = f->sparse_end;
+    }
+    // Queued io_uring writes go to the kernel now, with any other
+    // files' writes that are waiting.
+    if (f->uslots && io61_uring_submit(0) < 0)
+        r = -1;
+    return r;
+}
+
+
+// io61_flush_buffers(f)
+//    Hand `f`'s buffered data to io61_writeout. In IO61_URING mode the
+//    writes may still be queued in user space afterwards.
+
+static int io61_flush_buffers(io61_file* f) {
+    if (f->mode == O_RDWR)
+        return io61_flush_dirty(f);
+    else if (f->mode != O_WRONLY)
+        return 0;
+    size_t n = f->end_tag - f->tag;
+    if (n != 0)
+        IO61_STAT(f, flushes, 1);
+    io61_crc_fold(f);
+    if (f->direct)
+        return io61_direct_flush(f);
+    else if (f->fanout)
+        return io61_fanout_flush(f);
+    else if (f->nonblock)
+        return io61_nonblock_flush(f);
+    else if (f->sparse)
+        return io61_sparse_flush(f);
+    if (n != 0 && io61_writeout(f, f->cbuf, n) != (ssize_t) n)
+        return -1;
+    f->pos_tag = f->tag = f->end_tag;
+    io61_buf_adapt(f, n);
+    return 0;
+}
+
+
+// io61_nonblock_flush(f)
+//    Write as much of nonblocking file `f`'s cache as the descriptor
+//    takes now, and keep the rest at the start of the cache. Returns 0
+//    if it all went out, or -1 (errno EAGAIN if the pipe was full) if
+//    some is left.
+
+static int io61_nonblock_flush(io61_file* f) {
+    size_t n = f->end_tag - f->tag;
+    size_t off = 0;
+    while (off != n) {
+        ssize_t w = write(f->fd, f->cbuf + off, n - off);
+        io61_stat_write(f, w);
+        if (w < 0 && errno == EINTR)
+            continue;
+        else if (w <= 0)
+            break;
+        off += w;
+    }
+    if (off != 0 && off != n)
+        memmove(f->cbuf, f->cbuf + off, n - off);
+    f->tag += off;
+    if (off == n)
+        io61_buf_adapt(f, n);
+    return off == n ? 0 : -1;
+}
+
+
+// io61_mark_dirty(f, pos, sz), io61_flush_dirty(f)
+//    A read/write file's cache records the smallest range covering its
+//    modified characters. io61_flush_dirty writes that range back to
+//    the file and empties the cache, leaving it at the read position.
+//    Clean caches are dropped without a system call.
+
+static void io61_mark_dirty(io61_file* f, off_t pos, size_t sz) {
+    if (f->dirty_tag == f->dirty_end_tag)
+        f->dirty_tag = f->dirty_end_tag = pos;
+    if (pos < f->dirty_tag)
+        f->dirty_tag = pos;
+    if (pos + (off_t) sz > f->dirty_end_tag)
+        f->dirty_end_tag = pos + sz;
+}
+
+static int io61_flush_dirty(io61_file* f) {
+    if (f->dirty_tag != f->dirty_end_tag)
+        IO61_STAT(f, flushes, 1);
+    while (f->dirty_tag != f->dirty_end_tag) {
+        ssize_t n = pwrite(f->fd, &f->cbuf[f->dirty_tag - f->tag],
+                           f->dirty_end_tag - f->dirty_tag, f->dirty_tag);
+        io61_stat_write(f, n);
+        if (n < 0 && errno == EINTR)
+            continue;
+        else if (n <= 0)
+            return -1;
+        f->dirty_tag += n;
+    }
+    f->tag = f->end_tag = f->dirty_tag = f->dirty_end_tag = f->pos_tag;
+    return 0;
+}
+
+
+// io61_reposition(f, off)
+//    Empty `f`'s cache and move its file offset to `off`, so that the
+//    next refill starts there; compressed files start at the frame
+//    holding `off`. Returns 0 on success and -1 on failure.
+
+static int io61_reposition(io61_file* f, off_t off) {
+    if (f->lz)
+        return io61_lz_locate(f, off);
+    // Read-ahead runs from the old offset: stop it, move, restart.
+    if (f->async) {
+        IO61_STAT(f, nseek, 1);
+        if (lseek(f->fd, 0, SEEK_CUR) < 0)
+            return -1;
+        io61_async_stop(f->async);
+        f->async = NULL;
+        f->rbuf = f->cbuf;
+    }
+    IO61_STAT(f, nseek, 1);
+    if (lseek(f->fd, off, SEEK_SET) != off)
+        return -1;
+    f->tag = f->end_tag = off;
+    if (f->flags & IO61_ASYNC)
+        f->async = io61_async_start(f->fd);
+    // Queued io_uring reads are for the old position; writes carry
+    // their own offsets and can stay in flight.
+    if (f->uslots && f->mode == O_RDONLY) {
+        io61_uring_drain(f);
+        f->rbuf = f->cbuf;
+    }
+    if (f->uslots && f->useekable)
+        f->uoff = f->end_tag;
+    // A seek ends any sequential stream
+    f->nfull = 0;
+    if (f->bufadapt && f->bufsz > BUFSZ)
+        io61_buf_resize(f, BUFSZ);
+    return 0;
+}
+
+
+// io61_stat_seek(f, pos)
+//    Count a seek from the current position to `pos` in the seek
+//    distance histogram: buckets grow by factors of 64 from 0.
+
+static void io61_stat_seek(io61_file* f, off_t pos) {
+    off_t d = pos - f->pos_tag;
+    if (d < 0) {
+        ++f->stats->seekback;
+        d = -d;
+    }
+    int b = 0;
+    if (d != 0) {
+        b = 1 + (63 - __builtin_clzll(d)) / 6;
+        if (b >= STATS_NSEEK)
+            b = STATS_NSEEK - 1;
+    }
+    ++f->stats->seekhist[b];
+}
+
+
+// io61_seek(f, pos)
+//    Change the file pointer for file `f` to `pos` bytes into the file.
+//    Returns 0 on success and -1 on failure.
+
+int io61_seek(io61_file* f, off_t pos) {
+   if (__builtin_expect(f->stats != NULL, 0))
+	io61_stat_seek(f, pos);
+   f->rcarrylen = 0;
+   // Skipping or revisiting data ends the checksummed stream
+   io61_crc_fold(f);
+   if (f->crcstate > 0 && pos != f->crc_tag)
+	f->crcstate = -1;
+   // A read/write file keeps its cache, dirty or not, while `pos` stays
+   // inside it, and writes back only when the position leaves.
+   if (f->mode == O_RDWR) {
+	if (pos < f->tag || pos > f->end_tag) {
+		if (io61_flush_dirty(f) < 0)
+			return -1;
+		f->tag = f->end_tag = pos;
+		f->nfull = 0;
+		if (f->bufadapt && f->bufsz > BUFSZ)
+			io61_buf_resize(f, BUFSZ);
+	}
+	f->pos_tag = pos;
+	return 0;
+   }
+   // Compressed and fan-out output can only go forward, in order
+   if ((f->lz || f->fanout) && f->mode == O_WRONLY)
+	return pos == f->pos_tag ? 0 : -1;
+   if((f->mode & O_ACCMODE) != O_RDONLY)
+		io61_flush(f);
+   if(pos < f->tag || pos > f->end_tag || (f->mode & O_ACCMODE) != O_RDONLY) {
+	// Moving backward by less than a buffer (reverse61, or reading
+	// blocks in reverse order) means the caller will next want what
+	// lies before `pos`. Place the window so it ends where the previous
+	// seek went, not so it starts at `pos`.
+	off_t start = pos;
+	if (f->mode == O_RDONLY && pos < f->seek_tag && !f->lz
+	    && f->seek_tag - pos <= (off_t) f->bufsz)
+		start = f->seek_tag > (off_t) f->bufsz
+			? f->seek_tag - (off_t) f->bufsz : 0;
+	if (io61_reposition(f, start) < 0)
+		return -1;
+    }
+    f->pos_tag = pos;
+    f->seek_tag = pos;
+    return 0;
+}
+
+
+// io61_checksum(f)
+//    Return the CRC32C checksum of the data read from or written to `f`
+//    so far, or -1 if `f` is not checksumming (see IO61_CRC) or its
+//    data stopped forming one stream: a seek skipped or revisited data,
+//    or io61_write_batch wrote some. Reads count as the caller consumes
+//    them. Data read or written in order from the start of the file
+//    gives the checksum of the file's contents (of a compressed file,
+//    its data).
+
+int64_t io61_checksum(io61_file* f) {
+    io61_crc_fold(f);
+    return f->crcstate > 0 ? (int64_t) f->crc : -1;
+}
+
+
+// io61_copy_thread(arg)
+//    Body of an io61_copy worker: claim chunks of the job until none
+//    are left or some worker has failed.
+
+static void* io61_copy_thread(void* arg) {
+    io61_copyjob* j = (io61_copyjob*) arg;
+    unsigned char* buf = NULL;
+    int kernel = 1;             // 1 while copy_file_range works
+    size_t start;
+    while ((start = __atomic_fetch_add(&j->next, COPY_CHUNK, __ATOMIC_RELAXED))
+           < j->len
+           && !__atomic_load_n(&j->err, __ATOMIC_RELAXED)) {
+        size_t n = j->len - start < COPY_CHUNK ? j->len - start : COPY_CHUNK;
+        loff_t inoff = j->inoff + start, outoff = j->outoff + start;
+        while (n != 0) {
+            // Holes in the input stay holes in the output. The shared
+            // file position moves, but nothing else here uses it.
+            size_t m = n;
+            if (j->sparse) {
+                off_t data = lseek(j->infd, inoff, SEEK_DATA);
+                off_t hole = data < 0 ? -1 : lseek(j->infd, data, SEEK_HOLE);
+                if (data < 0 && errno == ENXIO)
+                    data = inoff + n;
+                if (data > inoff) {
+                    size_t skip = data - inoff < (off_t) n
+                        ? (size_t) (data - inoff) : n;
+                    inoff += skip;
+                    outoff += skip;
+                    n -= skip;
+                    continue;
+                } else if (hole > inoff && hole - inoff < (off_t) n)
+                    m = hole - inoff;
+            }
+            ssize_t r;
+            __atomic_fetch_add(&j->ncalls, 1, __ATOMIC_RELAXED);
+            if (kernel) {
+                r = syscall(__NR_copy_file_range, j->infd, &inoff,
+                            j->outfd, &outoff, m, 0);
+                if (r < 0 && (errno == ENOSYS || errno == EXDEV
+                              || errno == EINVAL || errno == EOPNOTSUPP)) {
+                    kernel = 0;
+                    continue;
+                }
+            } else {
+                if (!buf)
+                    buf = (unsigned char*) malloc(COPY_BUFSZ);
+                r = pread(j->infd, buf, m < COPY_BUFSZ ? m : COPY_BUFSZ,
+                          inoff);
+                for (ssize_t w = 0; r > 0 && w != r; ) {
+                    ssize_t x = pwrite(j->outfd, buf + w, r - w, outoff + w);
+                    if (x < 0 && errno == EINTR)
+                        continue;
+                    else if (x <= 0)
+                        r = -1;
+                    else
+                        w += x;
+                }
+                if (r > 0) {
+                    inoff += r;
+                    outoff += r;
+                }
+            }
+            if (r < 0 && errno == EINTR)
+                continue;
+            else if (r <= 0) {
+                // the input shrank under us, or a real error
+                int err = r < 0 ? errno : EIO, noerr = 0;
+                __atomic_compare_exchange_n(&j->err, &noerr, err, 0,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+                break;
+            }
+            n -= r;
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+
+// io61_copy_stream(inf, outf, size, fill)
+//    Write up to `size` bytes from `inf`'s cache to `outf`. If `fill` is
+//    set, keep refilling the cache until end of file; otherwise stop once
+//    the cache is drained. Returns the number of bytes copied, or -1 if
+//    an error occurred before any were.
+
+static ssize_t io61_copy_stream(io61_file* inf, io61_file* outf,
+                                size_t size, int fill) {
+    size_t ncopied = 0;
+    while (ncopied != size) {
+        if (inf->pos_tag >= inf->end_tag) {
+            ssize_t r = fill ? io61_fill(inf) : 0;
+            if (r < 0 && ncopied == 0)
+                return -1;
+            else if (r <= 0)
+                break;
+        }
+        size_t n = inf->end_tag - inf->pos_tag;
+        if (n > size - ncopied)
+            n = size - ncopied;
+        // Writing may need a buffer from the pool; not this one
+        inf->pinned = 1;
+        ssize_t w = io61_write(outf,
+                               (const char*) &inf->rbuf[inf->pos_tag - inf->tag],
+                               n);
+        inf->pinned = 0;
+        if (w > 0) {
+            inf->pos_tag += w;
+            ncopied += w;
+        }
+        if (w != (ssize_t) n)
+            return ncopied ? (ssize_t) ncopied : -1;
+    }
+    return ncopied;
+}
+
+
+// io61_copy_kernel(inf, outf, size)
+//    Move up to `size` bytes from `inf`'s file position to `outf`'s
+//    inside the kernel: splice if either end is a pipe, sendfile
+//    otherwise. Both caches must be empty. Returns the number of bytes
+//    moved, or -1 if nothing was moved because of an error. errno is
+//    EINVAL or ENOSYS if the kernel can't move data between these files.
+
+static ssize_t io61_copy_kernel(io61_file* inf, io61_file* outf,
+                                size_t size) {
+    struct stat s;
+    int pipes = (fstat(inf->fd, &s) == 0 && S_ISFIFO(s.st_mode))
+        || (fstat(outf->fd, &s) == 0 && S_ISFIFO(s.st_mode));
+    size_t ncopied = 0;
+    while (ncopied != size) {
+        size_t n = size - ncopied < KCOPY_MAX ? size - ncopied : KCOPY_MAX;
+        ssize_t r;
+        if (pipes)
+            r = syscall(__NR_splice, inf->fd, NULL, outf->fd, NULL, n, 0);
+        else
+            r = syscall(__NR_sendfile, outf->fd, inf->fd, NULL, n);
+        io61_stat_read(inf, r);
+        io61_stat_write(outf, r);
+        if (r < 0 && errno == EINTR)
+            continue;
+        else if (r < 0 && ncopied == 0)
+            return -1;
+        else if (r <= 0)
+            break;
+        ncopied += r;
+    }
+    inf->tag = inf->end_tag = inf->pos_tag = inf->pos_tag + ncopied;
+    outf->tag = outf->end_tag = outf->pos_tag = outf->pos_tag + ncopied;
+    io61_sparse_wrote(outf, outf->end_tag);
+    return ncopied;
+}
+
+
+// io61_copy_parallel(inf, outf, size, nthreads)
+//    Copy up to `size` bytes between regular files, from `inf`'s file
+//    position to `outf`'s, on `nthreads` threads. Both caches must be
+//    empty. Returns the number of bytes copied or -1 on error.
+
+static ssize_t io61_copy_parallel(io61_file* inf, io61_file* outf,
+                                  size_t size, long nthreads) {
+    io61_copyjob j;
+    j.infd = inf->fd;
+    j.outfd = outf->fd;
+    j.inoff = lseek(inf->fd, 0, SEEK_CUR);
+    j.outoff = lseek(outf->fd, 0, SEEK_CUR);
+    off_t insize = io61_filesize(inf);
+    if (j.inoff < 0 || j.outoff < 0)
+        return -1;
+    j.len = insize > j.inoff ? insize - j.inoff : 0;
+    if (j.len > size)
+        j.len = size;
+    j.next = 0;
+    j.err = 0;
+    j.ncalls = 0;
+    // Skipping holes is safe where the output has no data yet
+    struct stat s;
+    j.sparse = inf->sparse && fstat(j.outfd, &s) == 0
+        && s.st_size <= j.outoff;
+
+    long nchunks = (j.len + COPY_CHUNK - 1) / COPY_CHUNK;
+    if (nthreads > nchunks)
+        nthreads = nchunks;
+    if (nthreads > COPY_MAXTHREADS)
+        nthreads = COPY_MAXTHREADS;
+    // The calling thread is one of the workers
+    pthread_t threads[COPY_MAXTHREADS];
+    long nstarted = 0;
+    while (nstarted < nthreads - 1
+           && pthread_create(&threads[nstarted], NULL,
+                             io61_copy_thread, &j) == 0)
+        ++nstarted;
+    if (j.len != 0)
+        io61_copy_thread(&j);
+    for (long i = 0; i != nstarted; ++i)
+        pthread_join(threads[i], NULL);
+    // Each call both reads `inf` and writes `outf`
+    IO61_STAT(inf, nread, j.ncalls);
+    IO61_STAT(inf, rbytes, j.len);
+    IO61_STAT(outf, nwrite, j.ncalls);
+    IO61_STAT(outf, wbytes, j.len);
+    IO61_STAT(inf, nseek, 2);
+    IO61_STAT(outf, nseek, 2);
+    if (j.err) {
+        errno = j.err;
+        return -1;
+    }
+    if (j.sparse && fstat(j.outfd, &s) == 0
+        && s.st_size < j.outoff + (off_t) j.len
+        && ftruncate(j.outfd, j.outoff + j.len) < 0)
+        return -1;
+
+    // Leave both files positioned after the copied range
+    if (lseek(inf->fd, j.inoff + j.len, SEEK_SET) < 0
+        || lseek(outf->fd, j.outoff + j.len, SEEK_SET) < 0)
+        return -1;
+    inf->tag = inf->end_tag = inf->pos_tag = inf->pos_tag + j.len;
+    outf->tag = outf->end_tag = outf->pos_tag = outf->pos_tag + j.len;
+    io61_sparse_wrote(outf, outf->end_tag);
+    return j.len;
+}
+
+
+// io61_copy(inf, outf, opts)
+//    Copy data from `inf`, starting at its file position, to `outf`,
+//    until end of file or until `opts->size` bytes have been copied.
+//    Returns the number of bytes copied, or -1 on error. `opts` may be
+//    NULL for the defaults.
+//
+//    Data already in `inf`'s cache is written first. If both files are
+//    plain read-only and write-only files (no IO61_ASYNC, IO61_URING,
+//    IO61_DIRECT or IO61_NONBLOCK), the rest stays in the kernel:
+//    regular files are copied with copy_file_range by `opts->nthreads`
+//    worker threads (default: one per CPU), and other pairs with splice
+//    or sendfile.
+//    Otherwise, or if the kernel refuses, data streams through `inf`'s
+//    cache.
 
-// io61_fdopen(fd, mode)
-//    Return a new io61_file for file descriptor `fd`. `mode` is
-//    either O_RDONLY for a read-only file or O_WRONLY for a
-//    write-only file. You need not support read/write files.
+ssize_t io61_copy(io61_file* inf, io61_file* outf,
+                  const io61_copy_options* opts) {
+    size_t size = opts ? opts->size : (size_t) -1;
+    if (inf->mode == O_WRONLY || outf->mode == O_RDONLY)
+        return -1;
+    int direct = inf->mode == O_RDONLY && !inf->async && !inf->uslots
+        && !inf->lz && inf->crcstate <= 0 && !inf->direct && !inf->nonblock
+        && outf->mode == O_WRONLY && !outf->uslots && !outf->lz
+        && outf->crcstate <= 0 && !outf->direct && !outf->nonblock
+        && !outf->fanout
+        && !(fcntl(outf->fd, F_GETFL) & O_APPEND);
 
-io61_file* io61_fdopen(int fd, int mode) {
-    assert(fd >= 0);
-    io61_file* f = (io61_file*) malloc(sizeof(io61_file));
-    f->fd = fd;
-    f->mode = mode;
-    f->file_size = io61_filesize(f);
-    f->memory = calloc(BUFSZ, sizeof(char));
-    f->tag = f->end_tag = f->pos_tag = f->cache_size = f->first = f->last = f->prev_tag = 0;
-    return f;
+    ssize_t ncopied = io61_copy_stream(inf, outf, size, !direct);
+    if (!direct || ncopied < 0 || (size_t) ncopied == size)
+        return ncopied;
+
+    // Both descriptors now sit where the copy continues
+    if (io61_flush(outf) < 0)
+        return -1;
+    ssize_t n;
+    if (io61_filesize(inf) >= 0 && io61_filesize(outf) >= 0) {
+        long nthreads = opts && opts->nthreads > 0 ? opts->nthreads
+            : sysconf(_SC_NPROCESSORS_ONLN);
+        n = io61_copy_parallel(inf, outf, size - ncopied, nthreads);
+    } else {
+        n = io61_copy_kernel(inf, outf, size - ncopied);
+        if (n < 0 && (errno == EINVAL || errno == ENOSYS))
+            n = io61_copy_stream(inf, outf, size - ncopied, 1);
+    }
+    if (n < 0)
+        return ncopied ? ncopied : -1;
+    return ncopied + n;
 }
 
 
-// io61_close(f)
-//    Close the io61_file `f` and release all its resources.
+// io61_poller_new()
+//    Return a new, empty poller, or NULL on error.
 
-int io61_close(io61_file* f) {
-    if((f->mode & O_ACCMODE) != O_RDONLY)
-	io61_flush(f);
-    int r = close(f->fd);
-    free(f);
-    return r;
+io61_poller* io61_poller_new(void) {
+    int epfd = epoll_create1(0);
+    if (epfd < 0)
+        return NULL;
+    io61_poller* p = (io61_poller*) malloc(sizeof(io61_poller));
+    p->epfd = epfd;
+    p->ents = NULL;
+    p->nents = p->capents = 0;
+    p->next = 0;
+    p->stamp = 0;
+    return p;
 }
 
 
-// io61_readc(f)
-//    Read a single (unsigned) character from `f` and return it. Returns EOF
-//    (which is -1) on error or end-of-file.
+// io61_poller_add(p, f, events, data)
+//    Watch `f` for `events` (IO61_POLLIN and/or IO61_POLLOUT). io61_poll
+//    reports `data` with the file. Returns 0 on success or -1 on error.
+//    Each file may be added once; remove it before closing it.
 
-int io61_readc(io61_file* f) {
-    if (f->mode != O_RDONLY)
+int io61_poller_add(io61_poller* p, io61_file* f, int events, void* data) {
+    io61_pollent* e = (io61_pollent*) malloc(sizeof(io61_pollent));
+    e->f = f;
+    e->events = events;
+    e->data = data;
+    e->epolled = 0;
+    e->stamp = 0;
+    if (!f->async && !f->uslots) {
+        struct epoll_event ev;
+        ev.events = (events & IO61_POLLIN ? EPOLLIN : 0)
+            | (events & IO61_POLLOUT ? EPOLLOUT : 0);
+        ev.data.ptr = e;
+        if (epoll_ctl(p->epfd, EPOLL_CTL_ADD, f->fd, &ev) == 0)
+            e->epolled = 1;
+        else if (errno != EPERM) {
+            free(e);
+            return -1;
+        }
+    }
+    if (p->nents == p->capents) {
+        p->capents = p->capents ? 2 * p->capents : 16;
+        p->ents = (io61_pollent**) realloc(p->ents,
+                                           sizeof(io61_pollent*) * p->capents);
+    }
+    p->ents[p->nents] = e;
+    ++p->nents;
+    return 0;
+}
+
+
+// io61_poller_remove(p, f)
+//    Stop watching `f`. Returns 0 on success or -1 if `p` wasn't
+//    watching it.
+
+int io61_poller_remove(io61_poller* p, io61_file* f) {
+    for (size_t i = 0; i != p->nents; ++i)
+        if (p->ents[i]->f == f) {
+            if (p->ents[i]->epolled)
+                epoll_ctl(p->epfd, EPOLL_CTL_DEL, f->fd, NULL);
+            free(p->ents[i]);
+            p->ents[i] = p->ents[p->nents - 1];
+            --p->nents;
+            if (p->next >= p->nents)
+                p->next = 0;
+            return 0;
+        }
+    errno = ENOENT;
+    return -1;
+}
+
+
+// io61_poll_cached(e)
+//    Return the events of `e` that its file's cache, or its kind of
+//    file, makes ready without asking the kernel.
+
+static int io61_poll_cached(io61_pollent* e) {
+    io61_file* f = e->f;
+    int ready = 0;
+    if ((e->events & IO61_POLLIN)
+        && (!e->epolled || f->pos_tag < f->end_tag))
+        ready |= IO61_POLLIN;
+    if ((e->events & IO61_POLLOUT)
+        && (!e->epolled || !f->cbuf
+            || f->end_tag - f->tag < (off_t) f->bufsz))
+        ready |= IO61_POLLOUT;
+    return ready;
+}
+
+
+// io61_poll(p, evs, nevs, timeout)
+//    Wait until some of `p`'s files are ready, then store up to `nevs`
+//    of them in `evs` and return how many. A file is ready to read if
+//    io61_read would return without waiting: there's data, end of file,
+//    or an error. It is ready to write if io61_write would take at least
+//    a character. Waits at most `timeout` milliseconds (-1 means
+//    forever) and returns 0 if nothing became ready; returns -1 on
+//    error. Files whose caches are ready are found first, taking turns
+//    from call to call so that a busy file can't starve the others.
+
+int io61_poll(io61_poller* p, io61_event* evs, int nevs, int timeout) {
+    if (nevs <= 0) {
+        errno = EINVAL;
         return -1;
-    if (f->pos_tag < f->end_tag) {
-        f->pos_tag++;
-        return *(f->memory + f->pos_tag - f->tag - 1);
-    }else {
-        f->tag = f->end_tag;
-        ssize_t size = read(f->fd, f->memory, BUFSZ);
-        if (size > 0) {
-            f->end_tag += size;
-            f->pos_tag++;
-            return *(f->memory + f->pos_tag - f->tag - 1);
-        }else{
-            return EOF;
-	}
     }
+    ++p->stamp;
+    int n = 0;
+    size_t k = 0;
+    for (; k != p->nents && n != nevs; ++k) {
+        io61_pollent* e = p->ents[(p->next + k) % p->nents];
+        int ready = io61_poll_cached(e);
+        if (ready) {
+            e->stamp = p->stamp;
+            evs[n].f = e->f;
+            evs[n].events = ready;
+            evs[n].data = e->data;
+            ++n;
+        }
+    }
+    if (p->nents != 0)
+        p->next = (p->next + k) % p->nents;
+    if (n == nevs)
+        return n;
+
+    // Ask the kernel about the rest, without waiting if some are ready
+    struct epoll_event kev[64];
+    int nk = nevs - n < 64 ? nevs - n : 64;
+    nk = epoll_wait(p->epfd, kev, nk, n ? 0 : timeout);
+    if (nk < 0)
+        return n ? n : -1;
+    for (int i = 0; i != nk; ++i) {
+        io61_pollent* e = (io61_pollent*) kev[i].data.ptr;
+        int ready = 0;
+        if ((kev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            && (e->events & IO61_POLLIN))
+            ready |= IO61_POLLIN;
+        if ((kev[i].events & (EPOLLOUT | EPOLLERR))
+            && (e->events & IO61_POLLOUT))
+            ready |= IO61_POLLOUT;
+        if (!ready)
+            continue;
+        if (e->stamp == p->stamp) {
+            // Already reported from its cache
+            for (int j = 0; j != n; ++j)
+                if (evs[j].f == e->f)
+                    evs[j].events |= ready;
+        } else {
+            e->stamp = p->stamp;
+            evs[n].f = e->f;
+            evs[n].events = ready;
+            evs[n].data = e->data;
+            ++n;
+        }
+    }
+    return n;
 }
 
 
-// io61_read(f, buf, sz)
-//    Read up to `sz` characters from `f` into `buf`. Returns the number of
-//    characters read on success; normally this is `sz`. Returns a short
-//    count, which might be zero, if the file ended before `sz` characters
-//    could be read. Returns -1 if an error occurred before any characters
-//    were read.
+// io61_poller_free(p)
+//    Free `p`. Its files stay open.
 
-ssize_t io61_read(io61_file* f, char* buf, size_t sz) { 
+void io61_poller_free(io61_poller* p) {
+    for (size_t i = 0; i != p->nents; ++i)
+        free(p->ents[i]);
+    free(p->ents);
+    close(p->epfd);
+    free(p);
+}
+
+
+// io61_stats_printf(buf, sz, len, format, ...)
+//    Append formatted text to `buf`, which holds `len` characters and
+//    has room for `sz`, like snprintf. Returns the new length, which may
+//    exceed `sz`.
+
+static size_t io61_stats_printf(char* buf, size_t sz, size_t len,
+                                const char* format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int n = vsnprintf(buf + (len < sz ? len : sz), len < sz ? sz - len : 0,
+                      format, ap);
+    va_end(ap);
+    return len + (n > 0 ? n : 0);
+}
+
+
+// io61_stats_append(buf, sz, len, st)
+//    Append `st`'s counts to the JSON text in `buf`, which holds `len`
+//    characters, snprintf-style. Returns the new length.
+
+static size_t io61_stats_append(char* buf, size_t sz, size_t len,
+                                const io61_stats* st) {
+    len = io61_stats_printf(buf, sz, len, "\"reads\":%lu, \"rbytes\":%llu, \"writes\":%lu, \"wbytes\":%llu, \"seeks\":%lu, \"hits\":%lu, \"misses\":%lu, \"fills\":%lu, \"flushes\":%lu, \"seekback\":%lu, \"seekhist\":[",
+                            st->nread, st->rbytes, st->nwrite, st->wbytes,
+                            st->nseek, st->hits, st->misses, st->fills,
+                            st->flushes, st->seekback);
+    for (int i = 0; i != STATS_NSEEK; ++i)
+        len = io61_stats_printf(buf, sz, len, i ? ",%lu" : "%lu",
+                                st->seekhist[i]);
+    return io61_stats_printf(buf, sz, len, "]");
+}
+
+
+// io61_stats_report(buf, sz)
+//    Write a JSON object summarizing the IO61_STATS counts into `buf`,
+//    which has room for `sz` characters, like snprintf: the totals over
+//    every file opened so far; under "checksums", the size and checksum
+//    of each output file closed so far with a valid checksum (see
+//    io61_checksum); then, under "files", the STATS_NREPORT files that
+//    made the most system calls. Returns the length of the full report,
+//    or 0 (writing nothing) if neither statistics nor checksums are on.
+
+size_t io61_stats_report(char* buf, size_t sz) {
+    if (!io61_allstats && !io61_allsums)
+        return 0;
+    io61_stats total;
+    memset(&total, 0, sizeof(total));
+    const io61_stats* top[STATS_NREPORT];
+    int ntop = 0, nfiles = 0;
+    for (const io61_stats* st = io61_allstats; st; st = st->next) {
+        total.nread += st->nread;
+        total.nwrite += st->nwrite;
+        total.nseek += st->nseek;
+        total.rbytes += st->rbytes;
+        total.wbytes += st->wbytes;
+        total.hits += st->hits;
+        total.misses += st->misses;
+        total.fills += st->fills;
+        total.flushes += st->flushes;
+        total.seekback += st->seekback;
+        for (int i = 0; i != STATS_NSEEK; ++i)
+            total.seekhist[i] += st->seekhist[i];
+        ++nfiles;
+
+        // Keep `top` sorted by system calls, most first
+        unsigned long ncalls = st->nread + st->nwrite + st->nseek;
+        int i = ntop < STATS_NREPORT ? ntop++ : STATS_NREPORT;
+        while (i > 0 && top[i - 1]->nread + top[i - 1]->nwrite
+               + top[i - 1]->nseek < ncalls) {
+            if (i < STATS_NREPORT)
+                top[i] = top[i - 1];
+            --i;
+        }
+        if (i < STATS_NREPORT)
+            top[i] = st;
+    }
+
+    size_t len = io61_stats_printf(buf, sz, 0, "{");
+    if (io61_allstats) {
+        len = io61_stats_printf(buf, sz, len, "\"nfiles\":%d, ", nfiles);
+        len = io61_stats_append(buf, sz, len, &total);
+    }
+    if (io61_allsums) {
+        len = io61_stats_printf(buf, sz, len, "%s\"checksums\":[",
+                                io61_allstats ? ", " : "");
+        for (const io61_sum* sum = io61_allsums; sum; sum = sum->next)
+            len = io61_stats_printf(buf, sz, len, "%s{\"fd\":%d, \"bytes\":%lld, \"crc32c\":\"%08x\"}",
+                                    sum == io61_allsums ? "" : ", ",
+                                    sum->fd, (long long) sum->bytes,
+                                    sum->crc);
+        len = io61_stats_printf(buf, sz, len, "]");
+    }
+    if (!io61_allstats)
+        return io61_stats_printf(buf, sz, len, "}");
+    len = io61_stats_printf(buf, sz, len, ", \"files\":[");
+    for (int i = 0; i != ntop; ++i) {
+        len = io61_stats_printf(buf, sz, len,
+                                "%s{\"fd\":%d, \"mode\":\"%s\", ",
+                                i ? ", " : "", top[i]->fd,
+                                top[i]->mode == O_RDONLY ? "r"
+                                : top[i]->mode == O_WRONLY ? "w" : "rw");
+        len = io61_stats_append(buf, sz, len, top[i]);
+        len = io61_stats_printf(buf, sz, len, "}");
+    }
+    return io61_stats_printf(buf, sz, len, "]}");
+}
+
+
+// io61_shared_fdopen(fd)
+//    Return a new shared handle for reading file descriptor `fd`, a
+//    regular file, with io61_pread. The file should not change while
+//    the handle is open.
+
+io61_shared* io61_shared_fdopen(int fd) {
+    assert(fd >= 0);
+    io61_shared* s = (io61_shared*) aligned_alloc(64, sizeof(io61_shared));
+    s->fd = fd;
+    for (int i = 0; i != SHARED_NSHARDS; ++i) {
+        pthread_mutex_init(&s->shards[i].lock, NULL);
+        s->shards[i].clock = 0;
+        s->shards[i].free = NULL;
+        memset(s->shards[i].blocks, 0, sizeof(s->shards[i].blocks));
+    }
+    return s;
+}
+
+
+// io61_shared_filesize(s)
+//    Return the size of `s`'s file, or -1 if it has none.
+
+off_t io61_shared_filesize(io61_shared* s) {
+    struct stat st;
+    if (fstat(s->fd, &st) == 0 && S_ISREG(st.st_mode))
+        return st.st_size;
+    return -1;
+}
+
+
+// io61_pread_all(fd, buf, sz, off)
+//    pread up to `sz` bytes at `off`, stopping early only at end of
+//    file. Returns the number read, or -1 on error.
+
+static ssize_t io61_pread_all(int fd, unsigned char* buf, size_t sz,
+                              off_t off) {
     size_t nread = 0;
     while (nread != sz) {
-    	if(f->pos_tag < f->end_tag) {
-        	ssize_t n = sz - nread;
-                if (n > f->end_tag - f->pos_tag)
-                	n = f->end_tag - f->pos_tag;
-                memcpy(&buf[nread], &f->cbuf[f->pos_tag - f->tag], n);
-                f->pos_tag += n;
-                nread += n;
-         }else{
-		f->tag = f->end_tag; // mark cache as empty
-                ssize_t n = read(f->fd, f->cbuf, BUFSZ);
-                if(n > 0)
-            		f->end_tag += n;
-                else
-                	return nread ? (ssize_t) nread : (ssize_t) n;
- 	}        
-    }  
+        ssize_t r = pread(fd, buf + nread, sz - nread, off + nread);
+        if (r == 0)
+            break;
+        else if (r < 0 && errno != EINTR)
+            return nread ? (ssize_t) nread : -1;
+        else if (r > 0)
+            nread += r;
+    }
     return nread;
-}	
+}
 
 
-// io61_writec(f)
-//    Write a single character `ch` to `f`. Returns 0 on success or
-//    -1 on error.
+// io61_sblock_set(sh, index)
+//    Return the set of shard `sh` that may hold block number `index`.
 
-int io61_writec(io61_file* f, int ch) {
-	if (f->mode != O_WRONLY)
-     		return -1;
-	const char* buf = (const char*) &ch;
-	size_t available = BUFSZ - f->cache_size;
-	if (!available) {
-	ssize_t nwritten = write(f->fd, f->memory + f->first, BUFSZ - f->first);
-        if (nwritten >= 0) {
-        	f->first += nwritten;
-        	f->cache_size -= nwritten;
-        	f->first = (BUFSZ == f->first) ? 0 : f->first;
-         	f->last = (BUFSZ == f->last) ? 0 : f->last;
-        
-	}else{
-		return -1;
-	}   
-	}
-    *(f->memory + f->last) = *buf;
-    f->last++;
-    f->cache_size++;
+static io61_sblock** io61_sblock_set(io61_sshard* sh, off_t index) {
+    size_t set = (index / SHARED_NSHARDS) % (SHARED_SHARDBLOCKS / SHARED_WAYS);
+    return &sh->blocks[set * SHARED_WAYS];
+}
+
+
+// io61_sblock_find(sh, index)
+//    Return shard `sh`'s block number `index` with a reference for the
+//    caller, or NULL if it isn't cached. The shard must be locked.
+
+static io61_sblock* io61_sblock_find(io61_sshard* sh, off_t index) {
+    io61_sblock** set = io61_sblock_set(sh, index);
+    for (int i = 0; i != SHARED_WAYS; ++i)
+        if (set[i] && set[i]->index == index) {
+            __atomic_add_fetch(&set[i]->refs, 1, __ATOMIC_RELAXED);
+            set[i]->stamp = ++sh->clock;
+            return set[i];
+        }
+    return NULL;
+}
+
+
+// io61_sblock_put(s, b, locked)
+//    Drop a reference to block `b` of `s`. If that was the last, put it
+//    on its shard's free list, locking the shard unless `locked`.
+
+static void io61_sblock_put(io61_shared* s, io61_sblock* b, int locked) {
+    if (__atomic_sub_fetch(&b->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+    io61_sshard* sh = &s->shards[b->index % SHARED_NSHARDS];
+    if (!locked)
+        pthread_mutex_lock(&sh->lock);
+    b->next = sh->free;
+    sh->free = b;
+    if (!locked)
+        pthread_mutex_unlock(&sh->lock);
+}
+
+
+// io61_shared_get(s, index)
+//    Return block number `index` of `s`'s file with a reference for the
+//    caller, reading it into the cache if necessary. Returns NULL on
+//    error.
+
+static io61_sblock* io61_shared_get(io61_shared* s, off_t index) {
+    io61_sshard* sh = &s->shards[index % SHARED_NSHARDS];
+    pthread_mutex_lock(&sh->lock);
+    io61_sblock* b = io61_sblock_find(sh, index);
+    if (!b && (b = sh->free))
+        sh->free = b->next;
+    pthread_mutex_unlock(&sh->lock);
+    if (b && b->refs != 0)
+        return b;
+
+    if (!b)
+        b = (io61_sblock*) malloc(sizeof(io61_sblock));
+    ssize_t n = io61_pread_all(s->fd, b->data, SHARED_BLOCK,
+                               index * SHARED_BLOCK);
+    b->index = index;
+    b->len = n > 0 ? n : 0;
+    b->refs = 1;
+
+    // Another thread may have read the same block meanwhile
+    pthread_mutex_lock(&sh->lock);
+    io61_sblock* other = io61_sblock_find(sh, index);
+    if (!other && n >= 0) {
+        io61_sblock** set = io61_sblock_set(sh, index);
+        int victim = 0;
+        for (int i = 0; i != SHARED_WAYS && set[victim]; ++i)
+            if (!set[i] || set[i]->stamp < set[victim]->stamp)
+                victim = i;
+        if (set[victim])
+            io61_sblock_put(s, set[victim], 1);
+        b->refs = 2;
+        b->stamp = ++sh->clock;
+        set[victim] = b;
+    } else
+        io61_sblock_put(s, b, 1);
+    pthread_mutex_unlock(&sh->lock);
+    if (other)
+        return other;
+    return n >= 0 ? b : NULL;
+}
+
+
+// io61_pread(s, buf, sz, off)
+//    Read up to `sz` characters at file offset `off` of shared handle
+//    `s` into `buf`. Safe to call from several threads at once. Returns
+//    the number of characters read, which is less than `sz` only at end
+//    of file, or -1 if an error occurred before any were read.
+
+ssize_t io61_pread(io61_shared* s, char* buf, size_t sz, off_t off) {
+    if (off < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (sz >= SHARED_BYPASS)
+        return io61_pread_all(s->fd, (unsigned char*) buf, sz, off);
+    size_t nread = 0;
+    while (nread != sz) {
+        off_t pos = off + nread;
+        io61_sblock* b = io61_shared_get(s, pos / SHARED_BLOCK);
+        if (!b)
+            return nread ? (ssize_t) nread : -1;
+        size_t boff = pos % SHARED_BLOCK;
+        size_t n = b->len > boff ? b->len - boff : 0;
+        if (n > sz - nread)
+            n = sz - nread;
+        memcpy(&buf[nread], &b->data[boff], n);
+        int eof = b->len != SHARED_BLOCK && boff + n >= b->len;
+        io61_sblock_put(s, b, 0);
+        nread += n;
+        if (eof)
+            break;
+    }
+    return nread;
+}
+
+
+// io61_shared_close(s)
+//    Close shared handle `s` and release its cache. No thread may be
+//    using it.
+
+int io61_shared_close(io61_shared* s) {
+    for (int i = 0; i != SHARED_NSHARDS; ++i) {
+        io61_sshard* sh = &s->shards[i];
+        for (int j = 0; j != SHARED_SHARDBLOCKS; ++j)
+            free(sh->blocks[j]);
+        while (sh->free) {
+            io61_sblock* b = sh->free;
+            sh->free = b->next;
+            free(b);
+        }
+        pthread_mutex_destroy(&sh->lock);
+    }
+    int r = close(s->fd);
+    free(s);
+    return r;
+}
+
+
+// io61_cookie_read(cookie, buf, sz), io61_cookie_write(cookie, buf, sz),
+// io61_cookie_seek(cookie, off, whence), io61_cookie_close(cookie)
+//    fopencookie hooks for io61_fopen streams; `cookie` is the
+//    io61_file. The stream's own buffer is small, so the I/O itself
+//    happens through the io61 cache, which grows and shares the buffer
+//    pool like any other.
+
+static ssize_t io61_cookie_read(void* cookie, char* buf, size_t sz) {
+    return io61_read((io61_file*) cookie, buf, sz);
+}
+
+static ssize_t io61_cookie_write(void* cookie, const char* buf, size_t sz) {
+    // stdio takes 0 as the error return
+    ssize_t n = io61_write((io61_file*) cookie, buf, sz);
+    return n > 0 ? n : 0;
+}
+
+static int io61_cookie_seek(void* cookie, off64_t* off, int whence) {
+    io61_file* f = (io61_file*) cookie;
+    off_t pos = *off;
+    if (whence == SEEK_CUR)
+        pos += f->pos_tag;
+    else if (whence == SEEK_END) {
+        if (f->mode != O_RDONLY && io61_flush(f) < 0)
+            return -1;
+        off_t size = io61_filesize(f);
+        if (size < 0)
+            return -1;
+        pos += size;
+    }
+    // ftell asks for the current position; don't flush for that
+    if (pos < 0 || (pos != f->pos_tag && io61_seek(f, pos) < 0))
+        return -1;
+    *off = pos;
     return 0;
 }
 
+static int io61_cookie_close(void* cookie) {
+    return io61_close((io61_file*) cookie);
+}
 
-// io61_write(f, buf, sz)
-//    Write `sz` characters from `buf` to `f`. Returns the number of
-//    characters written on success; normally this is `sz`. Returns -1 if
-//    an error occurred before any characters were written.
 
-ssize_t io61_write(io61_file* f, const char* buf, size_t sz) {
-   size_t nwritten = 0;
-   if((f->mode & O_ACCMODE) != O_RDONLY){
-   	while (nwritten != sz) {
-       		if (f->pos_tag - f->tag < BUFSZ) { // If there is space in buffer
-           	     ssize_t n = sz - nwritten; 
-           	if (BUFSZ - (f->pos_tag - f->tag) < n)
-               	     n = BUFSZ - (f->pos_tag - f->tag);
-           	memcpy(&f->cbuf[f->pos_tag - f->tag], &buf[nwritten], n);
-           	f->pos_tag += n;
-           	if (f->pos_tag > f->end_tag)
-                     f->end_tag = f->pos_tag;
-           nwritten += n;
-       }
-       // The position should never exceed the end tag.
-       assert(f->pos_tag <= f->end_tag);
+// io61_fopen(filename, mode)
+//    Open `filename` as a stdio stream whose reads, writes, seeks and
+//    close go to an io61_file, so code written for FILE* runs on io61's
+//    cache. `mode` is as for fopen(3), but "a+" is not supported:
+//    read/write io61 files write at explicit offsets, which O_APPEND
+//    would ignore. Returns NULL, with errno set, on failure.
 
-       // Check if we've filled the buffer and if so, call flush to write data.
-       if (f->pos_tag - f->tag == BUFSZ) // Indicates that the buffer is full
-           io61_flush(f);
-	}
-   }
-   return nwritten;
+FILE* io61_fopen(const char* filename, const char* mode) {
+    int plus = strchr(mode, '+') != NULL;
+    int flags;
+    if (mode[0] == 'r')
+        flags = plus ? O_RDWR : O_RDONLY;
+    else if (mode[0] == 'w')
+        flags = (plus ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC;
+    else if (mode[0] == 'a' && !plus)
+        flags = O_WRONLY | O_CREAT | O_APPEND;
+    else {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (strchr(mode, 'x'))
+        flags |= O_EXCL;
+    int fd = open(filename, flags, 0666);
+    if (fd < 0)
+        return NULL;
+    io61_file* f = io61_fdopen(fd, flags & O_ACCMODE);
+    // Writes land at end of file, so the stream's position starts there
+    off_t size = (flags & O_APPEND) ? io61_filesize(f) : 0;
+    if (size > 0 && io61_seek(f, size) < 0) {
+        int err = errno;
+        io61_close(f);
+        errno = err;
+        return NULL;
+    }
+    cookie_io_functions_t hooks = {
+        io61_cookie_read, io61_cookie_write,
+        io61_cookie_seek, io61_cookie_close
+    };
+    FILE* stream = fopencookie(f, mode, hooks);
+    if (!stream)
+        io61_close(f);
+    return stream;
 }
 
 
-// io61_flush(f)
-//    Forces a write of all buffered data written to `f`.
-//    If `f` was opened read-only, io61_flush(f) may either drop all
-//    data buffered for reading, or do nothing.
+// io61_fanout(fds, nfds)
+//    Return a new write-only io61_file that writes everything written
+//    to it to each of the `nfds` file descriptors in `fds`, and takes
+//    ownership of them. It can't seek and has no size. A sink whose
+//    writes fail is dropped while the others carry on; io61_flush and
+//    io61_close then return -1. Returns NULL, with errno set, on error.
+
+io61_file* io61_fanout(const int* fds, int nfds) {
+    if (nfds < 1) {
+        errno = EINVAL;
+        return NULL;
+    }
+    io61_fan* fo = (io61_fan*) calloc(1, sizeof(io61_fan));
+    fo->sinks = (io61_sink*) calloc(nfds, sizeof(io61_sink));
+    fo->pfds = (struct pollfd*) malloc(sizeof(struct pollfd) * nfds);
+    fo->nsinks = fo->nlive = nfds;
+    int npipes = 0;
+    for (int i = 0; i != nfds; ++i) {
+        io61_sink* s = &fo->sinks[i];
+        struct stat st;
+        s->fd = fds[i];
+        s->oflags = fcntl(s->fd, F_GETFL);
+        if (fstat(s->fd, &st) < 0 || s->oflags < 0)
+            continue;
+        s->pipe = S_ISFIFO(st.st_mode);
+        s->splice = S_ISREG(st.st_mode) && !(s->oflags & O_APPEND);
+        npipes += s->pipe;
+        // A pipe big enough for a whole flush takes it in one tee
+        if (s->pipe)
+            fcntl(s->fd, F_SETPIPE_SZ, FANOUT_PIPESZ);
+        if (s->pipe || S_ISSOCK(st.st_mode))
+            fcntl(s->fd, F_SETFL, s->oflags | O_NONBLOCK);
+    }
+    fo->tee[0] = fo->tee[1] = fo->devnull = -1;
+    if (npipes >= 2 && pipe2(fo->tee, O_CLOEXEC | O_NONBLOCK) == 0) {
+        int sz = fcntl(fo->tee[1], F_SETPIPE_SZ, FANOUT_PIPESZ);
+        if (sz < 0)
+            sz = fcntl(fo->tee[1], F_GETPIPE_SZ);
+        fo->teesz = sz > 0 ? sz : PAGESZ;
+        fo->devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        if (fo->devnull < 0)
+            io61_fanout_notee(fo);
+    }
+
+    io61_file* f = io61_fdopen(fds[0], O_WRONLY);
+    f->fanout = fo;
+    // The sinks take the cache as it is, through the fan-out's own
+    // writes, and the cache stays big enough for tee to pay
+    f->wsched = 0;
+    f->sparse = 0;
+    if (f->pooled) {
+        --io61_npooled;
+        f->pooled = 0;
+    } else if (f->cbuf)
+        io61_buffree(f->cbuf, f->bufsz, f->flags);
+    f->bufsz = f->bufwant = FANOUT_BUFSZ;
+    f->bufadapt = 0;
+    f->cbuf = f->rbuf = io61_bufalloc(f->bufsz, f->flags);
+    return f;
+}
+
+
+// io61_fanout_notee(fo)
+//    Stop teeing: later flushes write to every sink.
+
+static void io61_fanout_notee(io61_fan* fo) {
+    if (fo->tee[0] >= 0) {
+        close(fo->tee[0]);
+        close(fo->tee[1]);
+    }
+    fo->tee[0] = fo->tee[1] = -1;
+}
+
+
+// io61_sink_fail(fo, s, err)
+//    Drop sink `s`, whose write failed with errno `err`.
+
+static void io61_sink_fail(io61_fan* fo, io61_sink* s, int err) {
+    s->err = err;
+    s->lagoff = s->laglen = 0;
+    --fo->nlive;
+    if (!fo->err)
+        fo->err = err;
+}
+
+
+// io61_sink_drain(f, s)
+//    Write as much of sink `s`'s lag buffer as it takes now. Returns 1
+//    if the lag buffer is empty afterwards, and 0 if the sink is full.
+
+static int io61_sink_drain(io61_file* f, io61_sink* s) {
+    while (s->lagoff != s->laglen) {
+        ssize_t w = write(s->fd, s->lag + s->lagoff, s->laglen - s->lagoff);
+        io61_stat_write(f, w);
+        if (w > 0)
+            s->lagoff += w;
+        else if (w < 0 && errno == EAGAIN)
+            return 0;
+        else if (w == 0 || errno != EINTR)
+            io61_sink_fail(f->fanout, s, w == 0 ? EIO : errno);
+    }
+    s->lagoff = s->laglen = 0;
+    return 1;
+}
 
-int io61_flush(io61_file* f) {
 
-	// If f was opened read-only
-    //if (f->mode == O_RDONLY)
-        if(f->mode != O_WRONLY)
-	  return 0;
+// io61_sink_queue(s, p, len)
+//    Append `len` bytes at `p` to sink `s`'s lag buffer.
 
-	if(f->end_tag != f->tag || (f->mode & O_ACCMODE) != O_RDONLY) {
-		ssize_t n = write(f->fd, f->cbuf, f->end_tag - f->tag);
-		assert(n == f->end_tag - f->tag);
+static void io61_sink_queue(io61_sink* s, const unsigned char* p,
+                            size_t len) {
+    if (s->laglen + len > s->lagcap && s->lagoff != 0) {
+        memmove(s->lag, s->lag + s->lagoff, s->laglen - s->lagoff);
+        s->laglen -= s->lagoff;
+        s->lagoff = 0;
     }
-   	f->pos_tag = f->tag = f->end_tag;
+    if (s->laglen + len > s->lagcap) {
+        size_t cap = s->lagcap ? s->lagcap : FANOUT_BUFSZ;
+        while (cap < s->laglen + len)
+            cap *= 2;
+        s->lag = (unsigned char*) realloc(s->lag, cap);
+        s->lagcap = cap;
+    }
+    memcpy(s->lag + s->laglen, p, len);
+    s->laglen += len;
+}
+
+
+// io61_fanout_wait(f, s)
+//    Wait until sink `s` can take more data, draining the lag buffers
+//    of other sinks that become ready meanwhile. If `s` is NULL, wait
+//    until some lagging sink is ready and drain it.
 
-    while (f->cache_size) {
-        size_t size = f->first ? BUFSZ - f->first : f->last;
-        //write the cache to the file.
-        ssize_t cleared = write(f->fd, f->memory + f->first, size);
-        // If able to write to file
-        if (cleared > 0) {
-            // update cache position and size
-            f->first += cleared;
-            f->cache_size -= cleared;
+static void io61_fanout_wait(io61_file* f, io61_sink* s) {
+    io61_fan* fo = f->fanout;
+    while (1) {
+        int n = 0;
+        for (int i = 0; i != fo->nsinks; ++i) {
+            io61_sink* x = &fo->sinks[i];
+            if (!x->err && (x == s || x->lagoff != x->laglen)) {
+                fo->pfds[n].fd = x->fd;
+                fo->pfds[n].events = POLLOUT;
+                ++n;
+            }
         }
-        // Else if nothing was written
-        else if (cleared == 0) {
-            f->first = cleared;
+        if (n == 0 || (poll(fo->pfds, n, -1) < 0 && errno != EINTR))
+            return;
+        int ready = 0;
+        n = 0;
+        for (int i = 0; i != fo->nsinks; ++i) {
+            io61_sink* x = &fo->sinks[i];
+            if (x->err || (x != s && x->lagoff == x->laglen))
+                continue;
+            if (fo->pfds[n++].revents) {
+                ready = ready || x == s;
+                io61_sink_drain(f, x);
+            }
         }
-        // Else not able to write successfully       
-        else
-            return -1;
+        if (ready || !s)
+            return;
+    }
+}
+
+
+// io61_sink_write(f, s, p, len)
+//    Send `len` bytes at `p` to sink `s`, after its lag buffer. What a
+//    full sink won't take joins the lag buffer, unless that would put
+//    it more than FANOUT_LAG bytes behind; then this waits for it.
+
+static void io61_sink_write(io61_file* f, io61_sink* s,
+                            const unsigned char* p, size_t len) {
+    while (len != 0 && !s->err) {
+        if (io61_sink_drain(f, s) && !s->err) {
+            ssize_t w = write(s->fd, p, len);
+            io61_stat_write(f, w);
+            if (w > 0) {
+                p += w;
+                len -= w;
+                continue;
+            } else if (w < 0 && errno == EINTR)
+                continue;
+            else if (w == 0 || errno != EAGAIN) {
+                io61_sink_fail(f->fanout, s, w == 0 ? EIO : errno);
+                break;
+            }
+        }
+        if (s->laglen - s->lagoff + len <= FANOUT_LAG) {
+            io61_sink_queue(s, p, len);
+            break;
+        }
+        io61_fanout_wait(f, s);
+    }
+}
+
+
+// io61_fanout_tee(f, buf, n)
+//    Send the `n` bytes at `buf` to the caught-up pipe sinks with tee,
+//    a pipe's worth at a time, setting each sink's `done` to the bytes
+//    it took. The private pipe is emptied into a caught-up regular file
+//    sink, which thereby gets the data too, or else into /dev/null.
+
+static void io61_fanout_tee(io61_file* f, const unsigned char* buf,
+                            size_t n) {
+    io61_fan* fo = f->fanout;
+    size_t off = 0;
+    while (off != n && fo->tee[0] >= 0) {
+        size_t len = n - off < fo->teesz ? n - off : fo->teesz;
+        ssize_t w = write(fo->tee[1], buf + off, len);
+        io61_stat_write(f, w);
+        if (w < 0 && errno == EINTR)
+            continue;
+        else if (w <= 0) {
+            io61_fanout_notee(fo);
+            break;
+        }
+
+        io61_sink* dst = NULL;
+        for (int i = 0; i != fo->nsinks; ++i) {
+            io61_sink* s = &fo->sinks[i];
+            if (s->err || s->done != off || s->lagoff != s->laglen)
+                continue;
+            else if (s->pipe) {
+                // A sink that takes less falls back to plain writes
+                ssize_t t = tee(fo->tee[0], s->fd, w, SPLICE_F_NONBLOCK);
+                io61_stat_write(f, t);
+                if (t > 0)
+                    s->done += t;
+            } else if (s->splice && !dst)
+                dst = s;
+        }
+
+        size_t moved = 0;
+        while (moved != (size_t) w) {
+            ssize_t r = splice(fo->tee[0], NULL,
+                               dst ? dst->fd : fo->devnull, NULL,
+                               w - moved, 0);
+            io61_stat_write(f, r);
+            if (r > 0) {
+                moved += r;
+                if (dst)
+                    dst->done += r;
+            } else if (r < 0 && errno == EINTR)
+                continue;
+            else if (dst) {
+                dst->splice = 0;
+                dst = NULL;
+            } else
+                break;
+        }
+        if (moved != (size_t) w)
+            io61_fanout_notee(fo);
+        off += w;
+    }
+}
+
+
+// io61_fanout_flush(f)
+//    Send fan-out file `f`'s cache to every live sink and empty it.
+//    Returns 0, or -1 if no sink is left.
+
+static int io61_fanout_flush(io61_file* f) {
+    io61_fan* fo = f->fanout;
+    size_t n = f->end_tag - f->tag;
+    int nteed = 0;
+    for (int i = 0; i != fo->nsinks; ++i) {
+        io61_sink* s = &fo->sinks[i];
+        s->done = 0;
+        if (io61_sink_drain(f, s) && !s->err && s->pipe)
+            ++nteed;
     }
-    if(f->end_tag != f->tag){
-	strcpy(f->cbuf, f->memory + f->first);
-    	// ssize_t n = write(f->fd, f->cbuf, f->end_tag - f->tag);
-	// assert(n == f->end_tag - f->tag);
+    if (nteed >= 2 && n >= FANOUT_TEEMIN && fo->tee[0] >= 0)
+        io61_fanout_tee(f, f->cbuf, n);
+    for (int i = 0; i != fo->nsinks; ++i) {
+        io61_sink* s = &fo->sinks[i];
+        if (!s->err && s->done != n)
+            io61_sink_write(f, s, f->cbuf + s->done, n - s->done);
     }
     f->pos_tag = f->tag = f->end_tag;
+    if (fo->nlive == 0) {
+        errno = fo->err;
+        return -1;
+    }
     return 0;
 }
 
 
-// io61_seek(f, pos)
-//    Change the file pointer for file `f` to `pos` bytes into the file.
-//    Returns 0 on success and -1 on failure.
+// io61_fanout_drain(f)
+//    Wait until every sink of fan-out file `f` has taken its lag
+//    buffer. Returns 0, or -1 if any sink failed since `f` was opened.
 
-int io61_seek(io61_file* f, off_t pos) {
-   if((f->mode & O_ACCMODE) != O_RDONLY)
-		io61_flush(f);
-   if(pos < f->tag || pos > f->end_tag || (f->mode & O_ACCMODE) != O_RDONLY) {
-	off_t aligned = pos - (pos % BUFSZ);
-	if((int)pos == (f->counter - 1) || (int) pos == (f->counter + 1)){	
-		off_t r = lseek(f->fd, aligned, SEEK_SET);
-                if(r != aligned)
-                	return -1;
-                f->tag = f->end_tag = aligned;
-	}else{
-		off_t r = lseek(f->fd, pos, SEEK_SET);
-		if(r != pos)
-			return -1;
-		f->tag = f->end_tag = pos;
-	}
+static int io61_fanout_drain(io61_file* f) {
+    io61_fan* fo = f->fanout;
+    for (int i = 0; i != fo->nsinks; ++i)
+        while (fo->sinks[i].lagoff != fo->sinks[i].laglen)
+            io61_fanout_wait(f, NULL);
+    if (fo->err) {
+        errno = fo->err;
+        return -1;
     }
-    f->prev_tag = f->pos_tag;
-    f->pos_tag = pos; 
-    f->counter = (int) pos;
     return 0;
 }
 
 
+// io61_fanout_free(fo)
+//    Restore the sinks' file status flags, close all of them but the
+//    first (the io61_file's own descriptor), and free `fo`. Returns -1
+//    if a close failed.
+
+static int io61_fanout_free(io61_fan* fo) {
+    int r = 0;
+    for (int i = 0; i != fo->nsinks; ++i) {
+        io61_sink* s = &fo->sinks[i];
+        if (s->oflags >= 0)
+            fcntl(s->fd, F_SETFL, s->oflags);
+        if (i != 0 && close(s->fd) < 0)
+            r = -1;
+        free(s->lag);
+    }
+    io61_fanout_notee(fo);
+    if (fo->devnull >= 0)
+        close(fo->devnull);
+    free(fo->pfds);
+    free(fo->sinks);
+    free(fo);
+    return r;
+}
+
+
 // You shouldn't need to change these functions.
 
 // io61_open_check(filename, mode)
@@ -254,7 +4242,7 @@ int io61_seek(io61_file* f, off_t pos) {
 io61_file* io61_open_check(const char* filename, int mode) {
     int fd;
     if (filename)
-        fd = open(filename, mode, 0666);
+        fd = open(filename, mode & ~IO61_FLAGMASK, 0666);
     else if ((mode & O_ACCMODE) == O_RDONLY)
         fd = STDIN_FILENO;
     else
@@ -263,7 +4251,7 @@ io61_file* io61_open_check(const char* filename, int mode) {
         fprintf(stderr, "%s: %s\n", filename, strerror(errno));
         exit(1);
     }
-    return io61_fdopen(fd, mode & O_ACCMODE);
+    return io61_fdopen(fd, mode & (O_ACCMODE | IO61_FLAGMASK));
 }
 
 
@@ -272,10 +4260,15 @@ io61_file* io61_open_check(const char* filename, int mode) {
 //    well-defined size (for instance, if it is a pipe).
 
 off_t io61_filesize(io61_file* f) {
+    // A compressed file's size is the size of its data
+    if (f->lz && f->mode == O_RDONLY)
+        return io61_lz_size(f);
+    else if (f->fanout)
+        return -1;
     struct stat s;
     int r = fstat(f->fd, &s);
     if (r >= 0 && S_ISREG(s.st_mode))
-        return s.st_size;
+        return s.st_size > f->dirty_end_tag ? s.st_size : f->dirty_end_tag;
     else
         return -1;
 }
@@ -286,8 +4279,15 @@ off_t io61_filesize(io61_file* f) {
 //    immediately after a `read` call that returned 0 or -1.
 
 int io61_eof(io61_file* f) {
+    if (f->mode == O_RDWR)
+        return f->pos_tag >= io61_filesize(f);
+    else if (f->async)
+        return io61_async_next(f) == 0;
+    else if (f->uslots)
+        return io61_uring_next(f) == 0;
     char x;
     ssize_t nread = read(f->fd, &x, 1);
+    io61_stat_read(f, nread);
     if (nread == 1) {
         fprintf(stderr, "Error: io61_eof called improperly\n\
   (Only call immediately after a read() that returned 0 or -1.)\n");
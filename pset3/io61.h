@@ -6,16 +6,32 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <sys/uio.h>
+#include <stdint.h>
 
 typedef struct io61_file io61_file;
 
+// io61_fdopen flags. Combine with O_RDONLY, O_WRONLY or O_RDWR.
+#define IO61_ASYNC      0x01000000  // read ahead on a background thread
+#define IO61_URING      0x02000000  // read ahead and batch writes with io_uring
+#define IO61_HUGE       0x04000000  // allow a multi-MB, huge-page buffer
+#define IO61_PIPE       0x08000000  // pipes and sockets: return reads early
+#define IO61_LZ         0x10000000  // compress or decompress in frames
+#define IO61_CRC        0x20000000  // keep a CRC32C checksum (io61_checksum)
+#define IO61_DIRECT     0x40000000  // bypass the page cache with O_DIRECT
+#define IO61_NONBLOCK   0x00800000  // pipes and sockets: fail with EAGAIN, don't wait
+#define IO61_FLAGMASK   0x7F800000
+
 io61_file* io61_fdopen(int fd, int mode);
 io61_file* io61_open_check(const char* filename, int mode);
+FILE* io61_fopen(const char* filename, const char* mode);
+io61_file* io61_fanout(const int* fds, int nfds);
 int io61_close(io61_file* f);
 
 off_t io61_filesize(io61_file* f);
 
 int io61_seek(io61_file* f, off_t pos);
+int io61_set_bufsize(io61_file* f, size_t sz);
 
 int io61_readc(io61_file* f);
 int io61_writec(io61_file* f, int ch);
@@ -23,11 +39,71 @@ int io61_writec(io61_file* f, int ch);
 ssize_t io61_read(io61_file* f, char* buf, size_t sz);
 ssize_t io61_write(io61_file* f, const char* buf, size_t sz);
 
+ssize_t io61_readline(io61_file* f, char* buf, size_t sz);
+ssize_t io61_scan(io61_file* f, int delim);
+ssize_t io61_read_reverse(io61_file* f, char* buf, size_t sz);
+
+int io61_set_recsize(io61_file* f, size_t sz);
+ssize_t io61_records_next(io61_file* f, const char** ptr, size_t* count);
+
+int io61_index_lines(io61_file* f, size_t every, const char* indexfile);
+int io61_load_line_index(io61_file* f, const char* indexfile);
+ssize_t io61_seek_line(io61_file* f, size_t n);
+
+ssize_t io61_readv(io61_file* f, const struct iovec* iov, int iovcnt);
+ssize_t io61_writev(io61_file* f, const struct iovec* iov, int iovcnt);
+
+typedef struct {
+    off_t off;                  // file offset
+    size_t len;                 // bytes to transfer
+    char* buf;                  // data to write, or room for data read
+    ssize_t result;             // set to bytes transferred, or -1
+} io61_batch_op;
+
+ssize_t io61_read_batch(io61_file* f, io61_batch_op* ops, size_t n);
+ssize_t io61_write_batch(io61_file* f, io61_batch_op* ops, size_t n);
+
 int io61_eof(io61_file* f);
 int io61_flush(io61_file* f);
+int64_t io61_checksum(io61_file* f);
+
+typedef struct {
+    size_t size;                // bytes to copy; (size_t) -1 means all
+    int nthreads;               // worker threads; 0 means one per CPU
+} io61_copy_options;
+
+ssize_t io61_copy(io61_file* inf, io61_file* outf,
+                  const io61_copy_options* opts);
+
+// io61_poll events
+#define IO61_POLLIN     0x1         // data, end of file or an error to read
+#define IO61_POLLOUT    0x2         // room to write
+
+typedef struct io61_poller io61_poller;
+
+typedef struct {
+    io61_file* f;               // the ready file
+    int events;                 // IO61_POLLIN and/or IO61_POLLOUT
+    void* data;                 // as passed to io61_poller_add
+} io61_event;
+
+io61_poller* io61_poller_new(void);
+int io61_poller_add(io61_poller* p, io61_file* f, int events, void* data);
+int io61_poller_remove(io61_poller* p, io61_file* f);
+int io61_poll(io61_poller* p, io61_event* evs, int nevs, int timeout);
+void io61_poller_free(io61_poller* p);
+
+// Shared read-only files for concurrent readers
+typedef struct io61_shared io61_shared;
+
+io61_shared* io61_shared_fdopen(int fd);
+off_t io61_shared_filesize(io61_shared* s);
+ssize_t io61_pread(io61_shared* s, char* buf, size_t sz, off_t off);
+int io61_shared_close(io61_shared* s);
 
 void io61_profile_begin(void);
 void io61_profile_end(void);
+size_t io61_stats_report(char* buf, size_t sz);
 
 
 typedef struct {
@@ -38,8 +114,18 @@ typedef struct {
     const char* input_file;     // input file. Defaults to NULL
     int n_input_files;          // number of input files; at least 1
     const char** input_files;   // all input files; NULL-terminated array
+    int flags;                  // `-F` option: io61_fdopen flags. Defaults to 0
+    int nthreads;               // `-j` option: copy threads. Defaults to 0
+    int kernel_copy;            // `-k` option: use io61_copy. Defaults to 0
+    int by_line;                // `-l` option: copy by lines. Defaults to 0
+    int decompress;             // `-d` option: decompress. Defaults to 0
+    size_t count;               // `-n` option: count. Defaults to 0
+    int line_index;             // `-x` option: use a line index. Defaults to 0
+    int separate_writers;       // `-w` option: one writer per output. Defaults to 0
+    int append;                 // `-a` option: append to output. Defaults to 0
 } io61_arguments;
 
 io61_arguments io61_parse_arguments(int argc, char* argv[], const char* opts);
+void io61_raise_file_limit(int nfiles);
 
 #endif
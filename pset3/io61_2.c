@@ -163,8 +163,8 @@ int io61_writec(io61_file* f, int ch) {
         ssize_t nwritten = write(f->fd, f->cache->memory + f->cache->first, cache_size - f->cache->first);
 		// If able to write
         if (nwritten >= 0) {
-            f->cache->first += cleared;
-            f->cache->size -= cleared;
+            f->cache->first += nwritten;
+            f->cache->size -= nwritten;
 			// Check if at the end of cache
             f->cache->first = (cache_size == f->cache->first) ? 0 : f->cache->first;
             f->cache->last = (cache_size == f->cache->last) ? 0 : f->cache->last;
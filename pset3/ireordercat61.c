@@ -0,0 +1,66 @@
+#include "io61.h"
+
+// Usage: ./ireordercat61 [-b BLOCKSIZE] [-r RANDOMSEED] [-s SIZE] FILE
+//    Shuffles the blocks of FILE in place: the file is opened for
+//    reading and writing, and random pairs of blocks are swapped, so
+//    every block is read and written back at least once. Default
+//    BLOCKSIZE is 4096.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    srandom(83419);
+    io61_arguments args = io61_parse_arguments(argc, argv, "b:r:s:");
+    size_t block_size = args.block_size ? args.block_size : 4096;
+    if (!args.input_file) {
+        fprintf(stderr, "ireordercat61: FILE required\n");
+        exit(1);
+    }
+
+    // Allocate buffers, open file, measure file size
+    char* buf1 = (char*) malloc(block_size);
+    char* buf2 = (char*) malloc(block_size);
+
+    io61_profile_begin();
+    io61_file* f = io61_open_check(args.input_file, O_RDWR);
+
+    if ((ssize_t) args.input_size < 0)
+        args.input_size = io61_filesize(f);
+    if ((ssize_t) args.input_size < 0) {
+        fprintf(stderr, "ireordercat61: can't get size of file\n");
+        exit(1);
+    }
+
+    size_t nblocks = args.input_size / block_size;
+    if (nblocks > (30 << 20)) {
+        fprintf(stderr, "ireordercat61: file too large\n");
+        exit(1);
+    } else if (nblocks * block_size != args.input_size) {
+        fprintf(stderr, "ireordercat61: file size not a multiple of block size\n");
+        exit(1);
+    }
+
+    // Shuffle blocks: swap each block with a random earlier one
+    for (size_t i = nblocks; i > 1; --i) {
+        size_t pos1 = (i - 1) * block_size;
+        size_t pos2 = (random() % i) * block_size;
+        if (pos1 == pos2)
+            continue;
+
+        if (io61_seek(f, pos1) < 0
+            || io61_read(f, buf1, block_size) != (ssize_t) block_size
+            || io61_seek(f, pos2) < 0
+            || io61_read(f, buf2, block_size) != (ssize_t) block_size) {
+            fprintf(stderr, "ireordercat61: read error\n");
+            exit(1);
+        }
+        io61_seek(f, pos1);
+        io61_write(f, buf2, block_size);
+        io61_seek(f, pos2);
+        io61_write(f, buf1, block_size);
+    }
+
+    io61_close(f);
+    io61_profile_end();
+    free(buf1);
+    free(buf2);
+}
@@ -0,0 +1,29 @@
+#include "io61.h"
+
+// Usage: ./lineindex61 [-b LINES] [-o INDEXFILE] FILE
+//    Builds a line index of FILE in one pass, with an entry every LINES
+//    lines (default 1024), and saves it in INDEXFILE (default
+//    FILE.lx61), where randline61 -x looks for it.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args = io61_parse_arguments(argc, argv, "b:o:");
+    size_t every = args.block_size ? args.block_size : 1024;
+    if (!args.input_file) {
+        fprintf(stderr, "Usage: %s [-b LINES] [-o INDEXFILE] FILE\n", argv[0]);
+        exit(1);
+    }
+    char* indexfile = (char*) malloc(strlen(args.input_file) + 6);
+    sprintf(indexfile, "%s.lx61", args.input_file);
+
+    io61_profile_begin();
+    io61_file* f = io61_open_check(args.input_file, O_RDONLY | args.flags);
+    if (io61_index_lines(f, every,
+                         args.output_file ? args.output_file : indexfile) < 0) {
+        perror("lineindex61");
+        exit(1);
+    }
+    io61_close(f);
+    io61_profile_end();
+    free(indexfile);
+}
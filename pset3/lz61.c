@@ -0,0 +1,186 @@
+#include "lz61.h"
+#include <stdint.h>
+#include <string.h>
+
+// lz61.c
+//    A compressed block is a series of sequences. Each sequence is a
+//    token byte, whose high nibble is a literal count and whose low
+//    nibble is a match length minus LZ61_MINMATCH; then any extra
+//    literal count bytes; the literals; a 2-byte little-endian match
+//    offset; and any extra match length bytes. A nibble of 15 means the
+//    count continues in the following bytes, each added in until one is
+//    less than 255. The last sequence has literals only.
+
+#define LZ61_MINMATCH 4
+#define LZ61_LASTLITERALS 5     // the last bytes of a block are literals
+#define LZ61_MFLIMIT 12         // no match starts this close to the end
+#define LZ61_HASHLOG 13
+
+
+static inline uint32_t lz61_read32(const unsigned char* p) {
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+static inline uint32_t lz61_hash(uint32_t x) {
+    return (x * 2654435761U) >> (32 - LZ61_HASHLOG);
+}
+
+
+// lz61_put_count(op, count)
+//    Write the extra bytes of a count whose nibble was 15. Returns the
+//    new output pointer.
+
+static unsigned char* lz61_put_count(unsigned char* op, size_t count) {
+    for (count -= 15; count >= 255; count -= 255)
+        *op++ = 255;
+    *op++ = count;
+    return op;
+}
+
+
+// lz61_put_sequence(op, oend, lit, nlit, offset, mlen)
+//    Write a sequence of `nlit` literals from `lit` and, if `mlen` is
+//    nonzero, a match. Returns the new output pointer, or NULL if the
+//    sequence would pass `oend`.
+
+static unsigned char* lz61_put_sequence(unsigned char* op,
+                                        unsigned char* oend,
+                                        const unsigned char* lit, size_t nlit,
+                                        size_t offset, size_t mlen) {
+    size_t mcode = mlen ? mlen - LZ61_MINMATCH : 0;
+    if ((size_t) (oend - op) < 1 + nlit / 255 + 1 + nlit + 2 + mcode / 255 + 1)
+        return NULL;
+    unsigned char* token = op++;
+    *token = (nlit < 15 ? nlit : 15) << 4;
+    if (nlit >= 15)
+        op = lz61_put_count(op, nlit);
+    memcpy(op, lit, nlit);
+    op += nlit;
+    if (mlen) {
+        *op++ = offset;
+        *op++ = offset >> 8;
+        *token |= mcode < 15 ? mcode : 15;
+        if (mcode >= 15)
+            op = lz61_put_count(op, mcode);
+    }
+    return op;
+}
+
+
+// lz61_compress(dst, cap, src, n)
+//    Compress the `n` bytes at `src` into `dst`, which has room for
+//    `cap` bytes. Returns the compressed size, or 0 if it would exceed
+//    `cap`. Callers pass `cap < n` to learn whether compression pays.
+
+size_t lz61_compress(unsigned char* dst, size_t cap,
+                     const unsigned char* src, size_t n) {
+    uint32_t table[1 << LZ61_HASHLOG]; // offsets of recent 4-byte strings
+    memset(table, 0, sizeof(table));
+    const unsigned char* ip = src;
+    const unsigned char* anchor = src; // first pending literal
+    const unsigned char* end = src + n;
+    unsigned char* op = dst;
+    unsigned char* oend = dst + cap;
+
+    if (n >= LZ61_MFLIMIT) {
+        const unsigned char* mflimit = end - LZ61_MFLIMIT;
+        const unsigned char* matchlimit = end - LZ61_LASTLITERALS;
+        while (ip < mflimit) {
+            uint32_t seq = lz61_read32(ip);
+            uint32_t h = lz61_hash(seq);
+            const unsigned char* ref = src + table[h];
+            table[h] = ip - src;
+            if (ref >= ip || ip - ref > LZ61_WINDOW
+                || lz61_read32(ref) != seq) {
+                // Step faster through data that doesn't compress
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                --ip;
+                --ref;
+            }
+            size_t mlen = LZ61_MINMATCH;
+            while (ip + mlen < matchlimit && ip[mlen] == ref[mlen])
+                ++mlen;
+            op = lz61_put_sequence(op, oend, anchor, ip - anchor,
+                                   ip - ref, mlen);
+            if (!op)
+                return 0;
+            ip += mlen;
+            anchor = ip;
+            table[lz61_hash(lz61_read32(ip - 2))] = ip - 2 - src;
+        }
+    }
+
+    op = lz61_put_sequence(op, oend, anchor, end - anchor, 0, 0);
+    return op ? (size_t) (op - dst) : 0;
+}
+
+
+// lz61_get_count(ipp, iend, count)
+//    Add the extra bytes of a count whose nibble was 15 to `*count`,
+//    advancing `*ipp`. Returns -1 if the input ends first.
+
+static int lz61_get_count(const unsigned char** ipp,
+                          const unsigned char* iend, size_t* count) {
+    unsigned char b;
+    do {
+        if (*ipp == iend)
+            return -1;
+        b = *(*ipp)++;
+        *count += b;
+    } while (b == 255);
+    return 0;
+}
+
+
+// lz61_decompress(dst, cap, src, n)
+//    Decompress the `n`-byte block at `src` into `dst`, which has room
+//    for `cap` bytes. Returns the decompressed size, or -1 if the block
+//    is malformed or decompresses to more than `cap` bytes.
+
+ssize_t lz61_decompress(unsigned char* dst, size_t cap,
+                        const unsigned char* src, size_t n) {
+    const unsigned char* ip = src;
+    const unsigned char* iend = src + n;
+    unsigned char* op = dst;
+    unsigned char* oend = dst + cap;
+    while (ip != iend) {
+        unsigned token = *ip++;
+        size_t len = token >> 4;
+        if (len == 15 && lz61_get_count(&ip, iend, &len) < 0)
+            return -1;
+        if (len > (size_t) (iend - ip) || len > (size_t) (oend - op))
+            return -1;
+        memcpy(op, ip, len);
+        op += len;
+        ip += len;
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        len = token & 15;
+        if (len == 15 && lz61_get_count(&ip, iend, &len) < 0)
+            return -1;
+        len += LZ61_MINMATCH;
+        if (offset == 0 || offset > (size_t) (op - dst)
+            || len > (size_t) (oend - op))
+            return -1;
+        const unsigned char* ref = op - offset;
+        if (offset >= len)
+            memcpy(op, ref, len);
+        else
+            // Overlapping match: a run that repeats its last `offset` bytes
+            for (size_t i = 0; i != len; ++i)
+                op[i] = ref[i];
+        op += len;
+    }
+    return op - dst;
+}
@@ -0,0 +1,19 @@
+#ifndef LZ61_H
+#define LZ61_H
+#include <stddef.h>
+#include <sys/types.h>
+
+// lz61.h
+//    A small LZ77 block codec in the LZ4 style: byte-aligned sequences
+//    of literals and matches, no entropy coding, one pass with a hash
+//    table. Blocks are independent, and matches reach back at most
+//    LZ61_WINDOW bytes, so blocks up to that size always fit the format.
+
+#define LZ61_WINDOW 65535
+
+size_t lz61_compress(unsigned char* dst, size_t cap,
+                     const unsigned char* src, size_t n);
+ssize_t lz61_decompress(unsigned char* dst, size_t cap,
+                        const unsigned char* src, size_t n);
+
+#endif
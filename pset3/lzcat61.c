@@ -0,0 +1,67 @@
+#include "io61.h"
+
+// Usage: ./lzcat61 [-d] [-b BLOCKSIZE] [-r RANDOMSEED] [-o OUTFILE] [FILE]
+//    Copies the input FILE to OUTFILE, compressing it into IO61_LZ
+//    frames, or, with -d, decompressing it. With -d and -b, the blocks
+//    are read in random order, so the compressed input is seeked frame
+//    by frame; the output should be the same either way.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    srandom(83419);
+    io61_arguments args = io61_parse_arguments(argc, argv, "db:r:o:");
+    size_t block_size = args.block_size ? args.block_size : 4096;
+
+    // Allocate buffer, open files
+    char* buf = (char*) malloc(block_size);
+
+    io61_profile_begin();
+    io61_file* inf = io61_open_check(args.input_file,
+                                     O_RDONLY | (args.decompress ? IO61_LZ : 0));
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC
+                                      | (args.decompress ? 0 : IO61_LZ));
+
+    if (args.decompress && args.block_size) {
+        ssize_t size = io61_filesize(inf);
+        if (size < 0) {
+            fprintf(stderr, "lzcat61: can't get size of input file\n");
+            exit(1);
+        }
+
+        // Calculate random permutation of file's blocks
+        size_t nblocks = (size + block_size - 1) / block_size;
+        size_t* blockpos = (size_t*) malloc(sizeof(size_t) * nblocks);
+        for (size_t i = 0; i < nblocks; ++i)
+            blockpos[i] = i;
+
+        while (nblocks != 0) {
+            size_t index = random() % nblocks;
+            size_t pos = blockpos[index] * block_size;
+            blockpos[index] = blockpos[nblocks - 1];
+            --nblocks;
+
+            if (io61_seek(inf, pos) < 0) {
+                fprintf(stderr, "lzcat61: input file is not seekable\n");
+                exit(1);
+            }
+            ssize_t amount = io61_read(inf, buf, block_size);
+            if (amount <= 0)
+                break;
+            io61_seek(outf, pos);
+            io61_write(outf, buf, amount);
+        }
+        free(blockpos);
+    } else
+        while (1) {
+            ssize_t amount = io61_read(inf, buf, block_size);
+            if (amount <= 0)
+                break;
+            io61_write(outf, buf, amount);
+        }
+
+    io61_close(inf);
+    io61_close(outf);
+    io61_profile_end();
+    free(buf);
+}
@@ -4,6 +4,9 @@
 #include <time.h>
 #include <signal.h>
 #include <sys/wait.h>
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ 1031       // Linux: set pipe capacity
+#endif
 
 struct message_set {
     int request_batch;
@@ -22,6 +25,10 @@ static const struct message_set messages[] = {
     { 20, 10000, 10000 }
 };
 
+// Each phase repeats ROUNDS times; the requester reports its round-trip
+// latency and throughput on standard error.
+#define ROUNDS 200
+
 // Requester algorithm:
 //    for (i = 0; i < request_batch; ++i)
 //        send request of size request_size;
@@ -35,6 +42,30 @@ static const struct message_set messages[] = {
 //    }
 
 
+static void alarm_handler(int signo) {
+    (void) signo;
+}
+
+static double timestamp(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// read_message(f, buf, sz)
+//    Read a whole message. In IO61_PIPE mode io61_read may return early.
+
+static ssize_t read_message(io61_file* f, char* buf, size_t sz) {
+    size_t nread = 0;
+    while (nread != sz) {
+        ssize_t r = io61_read(f, buf + nread, sz - nread);
+        if (r <= 0)
+            return nread ? (ssize_t) nread : r;
+        nread += r;
+    }
+    return nread;
+}
+
 static size_t max_message_size(void) {
     size_t nmessages = sizeof(messages) / sizeof(messages[0]);
     size_t sz = 0;
@@ -62,22 +93,32 @@ void requester(io61_file* outf, io61_file* inf) {
 
     for (size_t mindex = 0; mindex < nmessages; ++mindex) {
         const struct message_set* m = &messages[mindex];
-        printf("requester: phase %zd/%zd\n", mindex, nmessages);
-        for (int i = 0; i < m->request_batch; ++i) {
-            memcpy(buf, &requestid, sizeof(size_t));
-            ++requestid;
-            ssize_t r = io61_write(outf, buf, m->request_size);
-            assert((size_t) r == m->request_size);
-        }
-        int x = io61_flush(outf);
-        assert(x >= 0);
-        for (int i = 0; i < m->request_batch; ++i) {
-            ssize_t r = io61_read(inf, buf, m->response_size);
-            assert((size_t) r == m->response_size);
-            memcpy(&id, buf, sizeof(size_t));
-            assert(id == responseid);
-            ++responseid;
+        double start = timestamp();
+        for (int round = 0; round < ROUNDS; ++round) {
+            for (int i = 0; i < m->request_batch; ++i) {
+                memcpy(buf, &requestid, sizeof(size_t));
+                ++requestid;
+                ssize_t r = io61_write(outf, buf, m->request_size);
+                assert((size_t) r == m->request_size);
+            }
+            int x = io61_flush(outf);
+            assert(x >= 0);
+            for (int i = 0; i < m->request_batch; ++i) {
+                ssize_t r = read_message(inf, buf, m->response_size);
+                assert((size_t) r == m->response_size);
+                memcpy(&id, buf, sizeof(size_t));
+                assert(id == responseid);
+                ++responseid;
+            }
         }
+        double elapsed = timestamp() - start;
+        size_t nbytes = ROUNDS * m->request_batch
+            * (m->request_size + m->response_size);
+        printf("requester: phase %zd/%zd\n", mindex, nmessages);
+        fprintf(stderr, "requester: phase %zd/%zd (%d x %zu/%zu bytes): %.1f us/round trip, %.1f MB/s\n",
+                mindex, nmessages, m->request_batch, m->request_size,
+                m->response_size, elapsed * 1e6 / ROUNDS,
+                nbytes / elapsed / 1e6);
     }
 
     printf("requester: done!\n");
@@ -95,8 +136,8 @@ void responder(io61_file* outf, io61_file* inf) {
 
     for (size_t mindex = 0; mindex < nmessages; ++mindex) {
         const struct message_set* m = &messages[mindex];
-        for (int i = 0; i < m->request_batch; ++i) {
-            ssize_t r = io61_read(inf, buf, m->request_size);
+        for (int i = 0; i < ROUNDS * m->request_batch; ++i) {
+            ssize_t r = read_message(inf, buf, m->request_size);
             assert((size_t) r == m->request_size);
             r = io61_write(outf, buf, m->response_size);
             assert((size_t) r == m->response_size);
@@ -112,7 +153,8 @@ void responder(io61_file* outf, io61_file* inf) {
 }
 
 int main(int argc, char* argv[]) {
-    (void) argc, (void) argv;
+    io61_arguments args = io61_parse_arguments(argc, argv, "F:");
+    io61_profile_begin();
 
     // create a connected socket pair for communicating between processes
     int request_fds[2], response_fds[2];
@@ -122,13 +164,28 @@ int main(int argc, char* argv[]) {
         exit(1);
     }
 
+    // A batch must fit in the pipe: the requester sends a whole batch
+    // before reading any reply, so the responder would block writing
+    size_t nmessages = sizeof(messages) / sizeof(messages[0]);
+    size_t batchsz = 0;
+    for (size_t mindex = 0; mindex < nmessages; ++mindex) {
+        const struct message_set* m = &messages[mindex];
+        size_t sz = m->request_batch * (m->request_size > m->response_size
+                                        ? m->request_size : m->response_size);
+        if (sz > batchsz)
+            batchsz = sz;
+    }
+    if (fcntl(request_fds[1], F_SETPIPE_SZ, (int) batchsz) < 0
+        || fcntl(response_fds[1], F_SETPIPE_SZ, (int) batchsz) < 0)
+        perror("F_SETPIPE_SZ");
+
     // fork two children
     pid_t p1 = fork();
     if (p1 == 0) {
         close(request_fds[0]);
         close(response_fds[1]);
-        requester(io61_fdopen(request_fds[1], O_WRONLY),
-                  io61_fdopen(response_fds[0], O_RDONLY));
+        requester(io61_fdopen(request_fds[1], O_WRONLY | args.flags),
+                  io61_fdopen(response_fds[0], O_RDONLY | args.flags));
     } else if (p1 < 0) {
         perror("fork");
         exit(1);
@@ -138,31 +195,44 @@ int main(int argc, char* argv[]) {
     if (p2 == 0) {
         close(request_fds[1]);
         close(response_fds[0]);
-        responder(io61_fdopen(response_fds[1], O_WRONLY),
-                  io61_fdopen(request_fds[0], O_RDONLY));
+        responder(io61_fdopen(response_fds[1], O_WRONLY | args.flags),
+                  io61_fdopen(request_fds[0], O_RDONLY | args.flags));
     } else if (p2 < 0) {
         perror("fork");
         exit(1);
     }
 
-    time_t start_time = time(0);
-    while ((p1 > 0 || p2 > 0) && time(0) < start_time + 5) {
+    // Wait up to 5 seconds. The alarm interrupts waitpid; blocking
+    // rather than polling leaves the CPU to the children.
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = alarm_handler;
+    sigaction(SIGALRM, &sa, NULL);
+    alarm(5);
+    int status1 = -1, status2 = -1;
+    while (p1 > 0 || p2 > 0) {
         int status;
-        if (p1 > 0 && waitpid(p1, &status, WNOHANG) == p1) {
-            printf("requester exits with status %d\n",
-                   WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+        pid_t p = waitpid(-1, &status, 0);
+        if (p < 0)
+            break;
+        status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+        if (p == p1) {
+            status1 = status;
             p1 = -1;            /* child1 has died */
-        }
-        if (p2 > 0 && waitpid(p2, &status, WNOHANG) == p2) {
-            printf("responder exits with status %d\n",
-                   WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+        } else if (p == p2) {
+            status2 = status;
             p2 = -1;            /* child2 has died */
         }
     }
+    if (p1 < 0)
+        printf("requester exits with status %d\n", status1);
+    if (p2 < 0)
+        printf("responder exits with status %d\n", status2);
 
     if (p1 > 0)
         kill(p1, SIGKILL);
     if (p2 > 0)
         kill(p2, SIGKILL);
+    io61_profile_end();
     exit(p1 < 0 && p2 < 0 ? 0 : 1);
 }
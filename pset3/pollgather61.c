@@ -0,0 +1,90 @@
+#include "io61.h"
+#include <errno.h>
+
+// Usage: ./pollgather61 [-b BLOCKSIZE] [-l] [-o OUTFILE] [-F FLAGS]
+//                       [FILE1 FILE2...]
+//    Like gather61, copies the input FILEs to OUTFILE block by block,
+//    but the FILEs are opened IO61_NONBLOCK and read in the order
+//    io61_poll reports them ready, so a slow input (a pipe fed by a
+//    slow process) doesn't hold back the others. The output order
+//    depends on timing. With -l, each block written holds whole lines
+//    from one FILE (unless a line is longer than BLOCKSIZE), so the
+//    output has the same lines as the inputs. Default BLOCKSIZE is 4096.
+
+typedef struct input {
+    io61_file* f;
+    char* buf;
+    size_t len;                 // -l: bytes of a partial line in `buf`
+} input;
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args = io61_parse_arguments(argc, argv, "b:lo:F:#");
+    size_t block_size = args.block_size ? args.block_size : 4096;
+
+    // Allocate buffers, open files
+    int nfiles = args.n_input_files;
+    io61_raise_file_limit(nfiles);
+    input* ins = (input*) calloc(nfiles, sizeof(input));
+    io61_event* evs = (io61_event*) malloc(sizeof(io61_event) * nfiles);
+
+    io61_profile_begin();
+    io61_poller* p = io61_poller_new();
+    if (!p) {
+        perror("pollgather61");
+        exit(1);
+    }
+    for (int i = 0; i < nfiles; ++i) {
+        ins[i].f = io61_open_check(args.input_files[i],
+                                   O_RDONLY | IO61_NONBLOCK | args.flags);
+        ins[i].buf = (char*) malloc(block_size);
+        io61_poller_add(p, ins[i].f, IO61_POLLIN, &ins[i]);
+    }
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC | args.flags);
+
+    // Copy file data as it arrives
+    int nlive = nfiles;
+    while (nlive != 0) {
+        int nev = io61_poll(p, evs, nfiles, -1);
+        if (nev < 0 && errno != EINTR) {
+            perror("pollgather61");
+            exit(1);
+        }
+        for (int e = 0; e < nev; ++e) {
+            input* in = (input*) evs[e].data;
+            ssize_t amount = io61_read(in->f, in->buf + in->len,
+                                       block_size - in->len);
+            if (amount < 0 && errno == EAGAIN)
+                continue;
+            size_t n = in->len + (amount > 0 ? amount : 0);
+            if (amount > 0 && args.by_line) {
+                // Hold back a partial line, unless it fills the buffer
+                size_t end = n;
+                while (end != 0 && in->buf[end - 1] != '\n')
+                    --end;
+                if (end != 0 || n != block_size) {
+                    in->len = n - end;
+                    n = end;
+                } else
+                    in->len = 0;
+            } else
+                in->len = 0;
+            io61_write(outf, in->buf, n);
+            if (amount > 0 && in->len != 0)
+                memmove(in->buf, in->buf + n, in->len);
+            if (amount <= 0) {
+                io61_poller_remove(p, in->f);
+                io61_close(in->f);
+                free(in->buf);
+                --nlive;
+            }
+        }
+    }
+
+    io61_close(outf);
+    io61_poller_free(p);
+    io61_profile_end();
+    free(evs);
+    free(ins);
+}
@@ -0,0 +1,106 @@
+#include "io61.h"
+#include <errno.h>
+#include <pthread.h>
+
+// Usage: ./prandblockcat61 [-j THREADS] [-b MAXBLOCKSIZE] [-n COUNT]
+//                          [-r RANDOMSEED] [-o OUTFILE] FILE
+//    Copies the input FILE to OUTFILE with THREADS threads (default one
+//    per CPU) reading one shared handle. FILE is cut into blocks with
+//    random sizes between 1 and MAXBLOCKSIZE (default 4096); the
+//    threads claim the blocks in random order and read each one into
+//    place in memory with io61_pread. If COUNT is more than the number
+//    of blocks, the rest of the COUNT reads are of randomly chosen
+//    blocks, read again. The copy is written out at the end.
+
+typedef struct readjob {
+    io61_shared* s;
+    char* data;                 // the copy of FILE
+    size_t* starts;             // block i is [starts[i], starts[i + 1])
+    size_t* order;              // blocks in the order they are claimed
+    size_t nreads;              // reads in `order`
+    size_t next;                // next position in `order` to claim
+    int err;
+} readjob;
+
+static void* reader(void* arg) {
+    readjob* j = (readjob*) arg;
+    size_t i;
+    while ((i = __atomic_fetch_add(&j->next, 1, __ATOMIC_RELAXED))
+           < j->nreads) {
+        size_t b = j->order[i];
+        size_t off = j->starts[b], len = j->starts[b + 1] - off;
+        if (io61_pread(j->s, j->data + off, len, off) != (ssize_t) len)
+            __atomic_store_n(&j->err, errno ? errno : EIO, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    srandom(83419);
+    io61_arguments args = io61_parse_arguments(argc, argv, "j:b:n:r:o:");
+    size_t max_blocksize = args.block_size ? args.block_size : 4096;
+    int nthreads = args.nthreads ? args.nthreads
+        : (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads <= 0)
+        nthreads = 1;
+    int fd = args.input_file ? open(args.input_file, O_RDONLY) : -1;
+    if (fd < 0) {
+        fprintf(stderr, "prandblockcat61: %s\n",
+                args.input_file ? strerror(errno) : "need an input FILE");
+        exit(1);
+    }
+
+    io61_profile_begin();
+    readjob j;
+    j.s = io61_shared_fdopen(fd);
+    ssize_t size = io61_shared_filesize(j.s);
+    if (size < 0) {
+        fprintf(stderr, "prandblockcat61: can't get size of input file\n");
+        exit(1);
+    }
+
+    // Cut the file into blocks and shuffle them
+    j.starts = (size_t*) malloc(sizeof(size_t) * (size + 2));
+    size_t nblocks = 0;
+    for (size_t pos = 0; pos < (size_t) size; ++nblocks) {
+        j.starts[nblocks] = pos;
+        pos += (random() % max_blocksize) + 1;
+    }
+    j.starts[nblocks] = size;
+    // An empty file has no blocks to read again
+    j.nreads = args.count > nblocks && nblocks != 0 ? args.count : nblocks;
+    j.order = (size_t*) malloc(sizeof(size_t) * (j.nreads + 1));
+    for (size_t i = 0; i != nblocks; ++i) {
+        size_t k = random() % (i + 1);
+        j.order[i] = j.order[k];
+        j.order[k] = i;
+    }
+    for (size_t i = nblocks; i != j.nreads; ++i)
+        j.order[i] = random() % nblocks;
+    j.data = (char*) malloc(size + 1);
+    j.next = 0;
+    j.err = 0;
+
+    // Read the blocks on `nthreads` threads
+    pthread_t* threads = (pthread_t*) malloc(sizeof(pthread_t) * nthreads);
+    for (int t = 0; t != nthreads; ++t)
+        pthread_create(&threads[t], NULL, reader, &j);
+    for (int t = 0; t != nthreads; ++t)
+        pthread_join(threads[t], NULL);
+    if (j.err) {
+        fprintf(stderr, "prandblockcat61: %s\n", strerror(j.err));
+        exit(1);
+    }
+
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+    io61_write(outf, j.data, size);
+    io61_close(outf);
+    io61_shared_close(j.s);
+    io61_profile_end();
+    free(threads);
+    free(j.data);
+    free(j.order);
+    free(j.starts);
+}
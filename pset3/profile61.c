@@ -7,10 +7,31 @@
 //    The profile functions measure how much time and memory are used
 //    by your code. The io61_profile_end() function prints a simple
 //    report to standard error. The io61_parse_arguments() function
-//    parses common arguments into a structure.
+//    parses common arguments into a structure, and
+//    io61_raise_file_limit() makes room for many input files.
 
 static struct timeval tv_begin;
 
+
+// io61_syscall_counts(syscr, syscw)
+//    Store the number of read-type and write-type system calls this
+//    process has made, according to /proc/self/io, or -1 if unknown.
+
+static void io61_syscall_counts(long* syscr, long* syscw) {
+    *syscr = *syscw = -1;
+    FILE* f = fopen("/proc/self/io", "r");
+    if (!f)
+        return;
+    char line[100];
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "syscr:", 6) == 0)
+            *syscr = strtol(line + 6, NULL, 10);
+        else if (strncmp(line, "syscw:", 6) == 0)
+            *syscw = strtol(line + 6, NULL, 10);
+    }
+    fclose(f);
+}
+
 void io61_profile_begin(void) {
     int r = gettimeofday(&tv_begin, 0);
     assert(r >= 0);
@@ -27,16 +48,26 @@ void io61_profile_end(void) {
     r = getrusage(RUSAGE_CHILDREN, &cusage);
     assert(r >= 0);
 
+    long syscr, syscw;
+    io61_syscall_counts(&syscr, &syscw);
+
     timersub(&tv_end, &tv_begin, &tv_end);
     timeradd(&usage.ru_utime, &cusage.ru_utime, &usage.ru_utime);
     timeradd(&usage.ru_stime, &cusage.ru_stime, &usage.ru_stime);
 
-    char buf[1000];
-    int len = sprintf(buf, "{\"time\":%ld.%06ld, \"utime\":%ld.%06ld, \"stime\":%ld.%06ld, \"maxrss\":%ld}\n",
+    // With IO61_STATS set, io61's own counts go in an "io61" object
+    size_t statslen = io61_stats_report(NULL, 0);
+    char* buf = (char*) malloc(statslen + 1000);
+    int len = sprintf(buf, "{\"time\":%ld.%06ld, \"utime\":%ld.%06ld, \"stime\":%ld.%06ld, \"maxrss\":%ld, \"syscr\":%ld, \"syscw\":%ld",
                       tv_end.tv_sec, (long) tv_end.tv_usec,
                       usage.ru_utime.tv_sec, (long) usage.ru_utime.tv_usec,
                       usage.ru_stime.tv_sec, (long) usage.ru_stime.tv_usec,
-                      usage.ru_maxrss + cusage.ru_maxrss);
+                      usage.ru_maxrss + cusage.ru_maxrss, syscr, syscw);
+    if (statslen != 0) {
+        len += sprintf(buf + len, ", \"io61\":");
+        len += io61_stats_report(buf + len, statslen + 1);
+    }
+    len += sprintf(buf + len, "}\n");
 
     // Print the report to file descriptor 100 if it's available. Our
     // `check.pl` test harness uses this file descriptor.
@@ -46,6 +77,43 @@ void io61_profile_end(void) {
         fflush(stderr);
     ssize_t nwritten = write(fd, buf, len);
     assert(nwritten == len);
+    free(buf);
+}
+
+
+// io61_parse_flags(str, flags)
+//    Parse a comma-separated list of io61_fdopen flag names, such as
+//    "async", into `*flags`. Returns 0 on success and -1 on error.
+
+static const struct {
+    const char* name;
+    int flag;
+} io61_flag_names[] = {
+    { "async", IO61_ASYNC },
+    { "uring", IO61_URING },
+    { "huge", IO61_HUGE },
+    { "pipe", IO61_PIPE },
+    { "lz", IO61_LZ },
+    { "crc", IO61_CRC },
+    { "direct", IO61_DIRECT },
+    { "nonblock", IO61_NONBLOCK }
+};
+
+static int io61_parse_flags(const char* str, int* flags) {
+    size_t nnames = sizeof(io61_flag_names) / sizeof(io61_flag_names[0]);
+    while (*str) {
+        size_t len = strcspn(str, ",");
+        size_t i = 0;
+        while (i != nnames
+               && (strlen(io61_flag_names[i].name) != len
+                   || memcmp(io61_flag_names[i].name, str, len) != 0))
+            ++i;
+        if (i == nnames)
+            return -1;
+        *flags |= io61_flag_names[i].flag;
+        str += len + (str[len] == ',');
+    }
+    return 0;
 }
 
 
@@ -56,6 +124,15 @@ io61_arguments io61_parse_arguments(int argc, char* argv[], const char* opts) {
     args.stride = 1024;
     args.output_file = args.input_file = NULL;
     args.input_files = NULL;
+    args.flags = 0;
+    args.nthreads = 0;
+    args.kernel_copy = 0;
+    args.by_line = 0;
+    args.decompress = 0;
+    args.count = 0;
+    args.line_index = 0;
+    args.separate_writers = 0;
+    args.append = 0;
 
     int arg;
     char* endptr;
@@ -86,6 +163,38 @@ io61_arguments io61_parse_arguments(int argc, char* argv[], const char* opts) {
         case 'o':
             args.output_file = optarg;
             break;
+        case 'F':
+            if (io61_parse_flags(optarg, &args.flags) < 0)
+                goto usage;
+            break;
+        case 'j':
+            args.nthreads = (int) strtol(optarg, &endptr, 0);
+            if (args.nthreads <= 0 || endptr == optarg || *endptr)
+                goto usage;
+            break;
+        case 'k':
+            args.kernel_copy = 1;
+            break;
+        case 'l':
+            args.by_line = 1;
+            break;
+        case 'd':
+            args.decompress = 1;
+            break;
+        case 'n':
+            args.count = (size_t) strtoul(optarg, &endptr, 0);
+            if (endptr == optarg || *endptr)
+                goto usage;
+            break;
+        case 'x':
+            args.line_index = 1;
+            break;
+        case 'w':
+            args.separate_writers = 1;
+            break;
+        case 'a':
+            args.append = 1;
+            break;
         case '#':
             break;
         default:
@@ -112,9 +221,43 @@ io61_arguments io61_parse_arguments(int argc, char* argv[], const char* opts) {
         fprintf(stderr, " [-t STRIDE]");
     if (strchr(opts, 'o'))
         fprintf(stderr, " [-o OUTFILE]");
+    if (strchr(opts, 'F'))
+        fprintf(stderr, " [-F FLAGS]");
+    if (strchr(opts, 'j'))
+        fprintf(stderr, " [-j THREADS]");
+    if (strchr(opts, 'k'))
+        fprintf(stderr, " [-k]");
+    if (strchr(opts, 'l'))
+        fprintf(stderr, " [-l]");
+    if (strchr(opts, 'd'))
+        fprintf(stderr, " [-d]");
+    if (strchr(opts, 'n'))
+        fprintf(stderr, " [-n COUNT]");
+    if (strchr(opts, 'x'))
+        fprintf(stderr, " [-x]");
+    if (strchr(opts, 'w'))
+        fprintf(stderr, " [-w]");
+    if (strchr(opts, 'a'))
+        fprintf(stderr, " [-a]");
     if (strchr(opts, '#'))
         fprintf(stderr, " [FILE...]\n");
     else
         fprintf(stderr, " [FILE]\n");
     exit(1);
 }
+
+
+// io61_raise_file_limit(nfiles)
+//    Raise the open file limit, as far as the hard limit allows, so
+//    that `nfiles` files can be open at once along with a few others.
+
+void io61_raise_file_limit(int nfiles) {
+    struct rlimit rl;
+    rlim_t want = (rlim_t) nfiles + 8;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0
+        && rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < want) {
+        rl.rlim_cur = rl.rlim_max == RLIM_INFINITY
+            || rl.rlim_max > want ? want : rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
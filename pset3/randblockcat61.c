@@ -1,22 +1,22 @@
 #include "io61.h"
 
-// Usage: ./randblockcat61 [-b MAXBLOCKSIZE] [-r RANDOMSEED] [FILE]
+// Usage: ./randblockcat61 [-b MAXBLOCKSIZE] [-r RANDOMSEED] [-F FLAGS] [FILE]
 //    Copies the input FILE to standard output in blocks. Each block has a
 //    random size between 1 and MAXBLOCKSIZE (which defaults to 4096).
 
 int main(int argc, char* argv[]) {
     // Parse arguments
     srandom(83419);
-    io61_arguments args = io61_parse_arguments(argc, argv, "b:r:o:");
+    io61_arguments args = io61_parse_arguments(argc, argv, "b:r:o:F:");
     size_t max_blocksize = args.block_size ? args.block_size : 4096;
 
     // Allocate buffer, open files
     char* buf = (char*) malloc(max_blocksize);
 
     io61_profile_begin();
-    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY | args.flags);
     io61_file* outf = io61_open_check(args.output_file,
-                                      O_WRONLY | O_CREAT | O_TRUNC);
+                                      O_WRONLY | O_CREAT | O_TRUNC | args.flags);
 
     // Copy file data
     while (1) {
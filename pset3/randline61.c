@@ -0,0 +1,67 @@
+#include "io61.h"
+#include <errno.h>
+
+// Usage: ./randline61 [-x] [-b LINES] [-n COUNT] [-r RANDOMSEED]
+//                     [-o OUTFILE] FILE
+//    Copies COUNT randomly chosen lines of FILE (default 1000) to
+//    OUTFILE, finding each with io61_seek_line. With -x, the seeks use
+//    the line index saved in FILE.lx61, which is built (with an entry
+//    every LINES lines, default 1024) if it is missing or stale;
+//    without it, each seek scans FILE from the start.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    srandom(83419);
+    io61_arguments args = io61_parse_arguments(argc, argv, "xb:n:r:o:");
+    size_t every = args.block_size ? args.block_size : 1024;
+    size_t count = args.count ? args.count : 1000;
+    if (!args.input_file) {
+        fprintf(stderr, "Usage: %s [-x] [-b LINES] [-n COUNT] [-r RANDOMSEED] [-o OUTFILE] FILE\n", argv[0]);
+        exit(1);
+    }
+    char* indexfile = (char*) malloc(strlen(args.input_file) + 6);
+    sprintf(indexfile, "%s.lx61", args.input_file);
+
+    // Allocate buffer, open files
+    size_t bufsz = 65536;
+    char* buf = (char*) malloc(bufsz);
+
+    io61_profile_begin();
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+
+    if (args.line_index
+        && io61_load_line_index(inf, indexfile) < 0
+        && io61_index_lines(inf, every, indexfile) < 0
+        && errno != ENOSYS) {
+        perror("randline61");
+        exit(1);
+    }
+
+    // Count the lines, then fetch random ones
+    ssize_t nlines = io61_seek_line(inf, SIZE_MAX);
+    if (nlines < 0) {
+        fprintf(stderr, "randline61: input file is not seekable\n");
+        exit(1);
+    }
+    for (size_t i = 0; i != count && nlines != 0; ++i) {
+        size_t line = random() % nlines;
+        if (io61_seek_line(inf, line) != (ssize_t) line) {
+            perror("randline61");
+            exit(1);
+        }
+        ssize_t amount;
+        while ((amount = io61_readline(inf, buf, bufsz)) > 0) {
+            io61_write(outf, buf, amount);
+            if (buf[amount - 1] == '\n')
+                break;
+        }
+    }
+
+    io61_close(inf);
+    io61_close(outf);
+    io61_profile_end();
+    free(buf);
+    free(indexfile);
+}
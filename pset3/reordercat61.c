@@ -1,22 +1,26 @@
 #include "io61.h"
 
-// Usage: ./reordercat61 [-b BLOCKSIZE] [-r RANDOMSEED] [-s SIZE]
+// Usage: ./reordercat61 [-b BLOCKSIZE] [-r RANDOMSEED] [-s SIZE] [-F FLAGS]
 //                       [-o OUTFILE] [FILE]
 //    Copies the input FILE to OUTFILE in blocks. The blocks are
 //    transferred in random order, but the resulting output file
 //    should be the same as the input. Default BLOCKSIZE is 4096.
+//    Blocks are gathered into batches of about 1MB, each read with
+//    io61_read_batch and written with io61_write_batch.
 
 int main(int argc, char* argv[]) {
     // Parse arguments
     srandom(83419);
-    io61_arguments args = io61_parse_arguments(argc, argv, "b:r:s:o:");
+    io61_arguments args = io61_parse_arguments(argc, argv, "b:r:s:o:F:");
     size_t block_size = args.block_size ? args.block_size : 4096;
 
     // Allocate buffer, open files, measure file sizes
-    char* buf = (char*) malloc(block_size);
+    size_t batch_size = block_size < (1 << 20) ? (1 << 20) / block_size : 1;
+    char* buf = (char*) malloc(block_size * batch_size);
+    io61_batch_op* ops = (io61_batch_op*) malloc(sizeof(io61_batch_op) * batch_size);
 
     io61_profile_begin();
-    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY | args.flags);
 
     if ((ssize_t) args.input_size < 0)
         args.input_size = io61_filesize(inf);
@@ -30,7 +34,7 @@ int main(int argc, char* argv[]) {
     }
 
     io61_file* outf = io61_open_check(args.output_file,
-                                      O_WRONLY | O_CREAT | O_TRUNC);
+                                      O_WRONLY | O_CREAT | O_TRUNC | args.flags);
     if (io61_seek(outf, 0) < 0) {
         fprintf(stderr, "reordercat61: output file is not seekable\n");
         exit(1);
@@ -52,23 +56,29 @@ int main(int argc, char* argv[]) {
 
     // Copy file data
     while (nblocks != 0) {
-        // Choose block to read
-        size_t index = random() % nblocks;
-        size_t pos = blockpos[index] * block_size;
-        blockpos[index] = blockpos[nblocks - 1];
-        --nblocks;
+        // Choose blocks to read
+        size_t n = 0;
+        for (; n != batch_size && nblocks != 0; ++n) {
+            size_t index = random() % nblocks;
+            ops[n].off = blockpos[index] * block_size;
+            ops[n].len = block_size;
+            ops[n].buf = buf + n * block_size;
+            blockpos[index] = blockpos[nblocks - 1];
+            --nblocks;
+        }
 
-        // Transfer that block
-        io61_seek(inf, pos);
-        ssize_t amount = io61_read(inf, buf, block_size);
-        if (amount <= 0)
+        // Transfer those blocks
+        if (io61_read_batch(inf, ops, n) <= 0)
             break;
-        io61_seek(outf, pos);
-        io61_write(outf, buf, amount);
+        for (size_t i = 0; i != n; ++i)
+            ops[i].len = ops[i].result > 0 ? ops[i].result : 0;
+        io61_write_batch(outf, ops, n);
     }
 
     io61_close(inf);
     io61_close(outf);
     io61_profile_end();
     free(buf);
+    free(ops);
+    free(blockpos);
 }
@@ -1,12 +1,13 @@
 #include "io61.h"
 
-// Usage: ./reverse61 [-s SIZE] [-o OUTFILE] [FILE]
+// Usage: ./reverse61 [-s SIZE] [-b BLOCKSIZE] [-o OUTFILE] [FILE]
 //    Copies the input FILE to OUTFILE one character at a time,
-//    reversing the order of characters in the input.
+//    reversing the order of characters in the input. With `-b`, reads
+//    BLOCKSIZE reversed characters at a time with io61_read_reverse.
 
 int main(int argc, char* argv[]) {
     // Parse arguments
-    io61_arguments args = io61_parse_arguments(argc, argv, "s:o:");
+    io61_arguments args = io61_parse_arguments(argc, argv, "s:b:o:");
 
     // Open files, measure file sizes
     io61_profile_begin();
@@ -25,12 +26,27 @@ int main(int argc, char* argv[]) {
         exit(1);
     }
 
-    while (args.input_size != 0) {
-        --args.input_size;
+    if (args.block_size) {
+        char* buf = (char*) malloc(args.block_size);
         io61_seek(inf, args.input_size);
-        int ch = io61_readc(inf);
-        io61_writec(outf, ch);
-    }
+        while (args.input_size != 0) {
+            size_t n = args.block_size;
+            if (n > args.input_size)
+                n = args.input_size;
+            ssize_t amount = io61_read_reverse(inf, buf, n);
+            if (amount <= 0)
+                break;
+            io61_write(outf, buf, amount);
+            args.input_size -= amount;
+        }
+        free(buf);
+    } else
+        while (args.input_size != 0) {
+            --args.input_size;
+            io61_seek(inf, args.input_size);
+            int ch = io61_readc(inf);
+            io61_writec(outf, ch);
+        }
 
     io61_close(inf);
     io61_close(outf);
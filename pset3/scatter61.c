@@ -1,6 +1,6 @@
 #include "io61.h"
 
-// Usage: ./scatter61 [-b BLOCKSIZE] [FILE1 FILE2...]
+// Usage: ./scatter61 [-b BLOCKSIZE] [-F FLAGS] [FILE1 FILE2...]
 //    Copies the standard input to the FILEs, alternating between FILEs
 //    with every block. (I.e., write a block to FILE1, then
 //    a block to FILE2, etc.) This is a "scatter" I/O pattern: one
@@ -9,7 +9,7 @@
 
 int main(int argc, char* argv[]) {
     // Parse arguments
-    io61_arguments args = io61_parse_arguments(argc, argv, "b:#");
+    io61_arguments args = io61_parse_arguments(argc, argv, "b:F:#");
     size_t block_size = args.block_size ? args.block_size : 1;
     // Note that we use `args.input_files` for OUTPUT files.
 
@@ -18,11 +18,11 @@ int main(int argc, char* argv[]) {
 
     int nfiles = args.n_input_files;
     io61_profile_begin();
-    io61_file* inf = io61_fdopen(STDIN_FILENO, O_RDONLY);
+    io61_file* inf = io61_fdopen(STDIN_FILENO, O_RDONLY | args.flags);
     io61_file** outfs = (io61_file**) calloc(nfiles, sizeof(io61_file*));
     for (int i = 0; i < nfiles; ++i)
         outfs[i] = io61_open_check(args.input_files[i],
-                                   O_WRONLY | O_CREAT | O_TRUNC);
+                                   O_WRONLY | O_CREAT | O_TRUNC | args.flags);
 
     // Copy file data
     int whichf = 0;
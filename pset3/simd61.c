@@ -0,0 +1,359 @@
+#include "simd61.h"
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD61_X86 1
+#endif
+
+// simd61.c
+//    Each kernel has a portable version plus x86 versions compiled with
+//    the `target` attribute, so the file builds without -mavx2 and runs
+//    on CPUs that lack it.
+
+
+// simd61_memchr(p, c, n)
+//    Return a pointer to the first `c` in the `n` bytes at `p`, or NULL.
+
+static const unsigned char* memchr_portable(const unsigned char* p, int c,
+                                            size_t n) {
+    return (const unsigned char*) memchr(p, c, n);
+}
+
+#if SIMD61_X86
+static const unsigned char* memchr_sse2(const unsigned char* p, int c,
+                                        size_t n) {
+    __m128i needle = _mm_set1_epi8((char) c);
+    for (; n >= 16; p += 16, n -= 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*) p);
+        int m = _mm_movemask_epi8(_mm_cmpeq_epi8(x, needle));
+        if (m)
+            return p + __builtin_ctz(m);
+    }
+    for (; n != 0; ++p, --n)
+        if (*p == (unsigned char) c)
+            return p;
+    return NULL;
+}
+
+__attribute__((target("avx2")))
+static const unsigned char* memchr_avx2(const unsigned char* p, int c,
+                                        size_t n) {
+    __m256i needle = _mm256_set1_epi8((char) c);
+    for (; n >= 32; p += 32, n -= 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*) p);
+        unsigned m = (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, needle));
+        if (m)
+            return p + __builtin_ctz(m);
+    }
+    return memchr_sse2(p, c, n);
+}
+#endif
+
+static const unsigned char* (*memchr_impl)(const unsigned char*, int,
+                                           size_t);
+
+const unsigned char* simd61_memchr(const unsigned char* p, int c, size_t n) {
+    if (!memchr_impl) {
+        memchr_impl = memchr_portable;
+#if SIMD61_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            memchr_impl = memchr_avx2;
+        else if (__builtin_cpu_supports("sse2"))
+            memchr_impl = memchr_sse2;
+#endif
+    }
+    return memchr_impl(p, c, n);
+}
+
+
+// simd61_memchr_nth(p, c, n, k)
+//    Count down `*k` for each `c` in the `n` bytes at `p`, and return a
+//    pointer to the `c` that brings it to zero. If there aren't enough,
+//    return NULL, leaving `*k` reduced by the number found. The x86
+//    versions count a vector's matches at once, so they find the 1000th
+//    newline about as fast as the first.
+
+static const unsigned char* memchr_nth_portable(const unsigned char* p,
+                                                int c, size_t n,
+                                                size_t* k) {
+    const unsigned char* end = p + n;
+    while (*k != 0 && (p = (const unsigned char*) memchr(p, c, end - p))) {
+        if (--*k == 0)
+            return p;
+        ++p;
+    }
+    return NULL;
+}
+
+#if SIMD61_X86
+// Return the position of the `k`th set bit (counting from 1) of `m`
+static inline int nth_bit(unsigned m, size_t k) {
+    while (--k != 0)
+        m &= m - 1;
+    return __builtin_ctz(m);
+}
+
+static const unsigned char* memchr_nth_sse2(const unsigned char* p, int c,
+                                            size_t n, size_t* k) {
+    __m128i needle = _mm_set1_epi8((char) c);
+    for (; n >= 16 && *k != 0; p += 16, n -= 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*) p);
+        unsigned m = _mm_movemask_epi8(_mm_cmpeq_epi8(x, needle));
+        size_t count = __builtin_popcount(m);
+        if (count >= *k) {
+            const unsigned char* r = p + nth_bit(m, *k);
+            *k = 0;
+            return r;
+        }
+        *k -= count;
+    }
+    return memchr_nth_portable(p, c, n, k);
+}
+
+__attribute__((target("avx2,popcnt")))
+static const unsigned char* memchr_nth_avx2(const unsigned char* p, int c,
+                                            size_t n, size_t* k) {
+    __m256i needle = _mm256_set1_epi8((char) c);
+    for (; n >= 32 && *k != 0; p += 32, n -= 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*) p);
+        unsigned m = (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, needle));
+        size_t count = __builtin_popcount(m);
+        if (count >= *k) {
+            const unsigned char* r = p + nth_bit(m, *k);
+            *k = 0;
+            return r;
+        }
+        *k -= count;
+    }
+    return memchr_nth_sse2(p, c, n, k);
+}
+#endif
+
+static const unsigned char* (*memchr_nth_impl)(const unsigned char*, int,
+                                               size_t, size_t*);
+
+const unsigned char* simd61_memchr_nth(const unsigned char* p, int c,
+                                       size_t n, size_t* k) {
+    if (!memchr_nth_impl) {
+        memchr_nth_impl = memchr_nth_portable;
+#if SIMD61_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            memchr_nth_impl = memchr_nth_avx2;
+        else if (__builtin_cpu_supports("sse2"))
+            memchr_nth_impl = memchr_nth_sse2;
+#endif
+    }
+    return memchr_nth_impl(p, c, n, k);
+}
+
+
+// simd61_reverse(dst, src, n)
+//    Copy the `n` bytes at `src` to `dst` in reverse order, so that
+//    dst[i] == src[n - 1 - i]. The ranges must not overlap.
+
+static void reverse_portable(unsigned char* dst, const unsigned char* src,
+                             size_t n) {
+    for (size_t i = 0; i != n; ++i)
+        dst[i] = src[n - 1 - i];
+}
+
+#if SIMD61_X86
+__attribute__((target("ssse3")))
+static void reverse_ssse3(unsigned char* dst, const unsigned char* src,
+                          size_t n) {
+    const __m128i rev = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8,
+                                      7, 6, 5, 4, 3, 2, 1, 0);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*) (src + n - i - 16));
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_shuffle_epi8(x, rev));
+    }
+    reverse_portable(dst + i, src, n - i);
+}
+
+__attribute__((target("avx2")))
+static void reverse_avx2(unsigned char* dst, const unsigned char* src,
+                         size_t n) {
+    // vpshufb reverses within each 128-bit lane; vperm2i128 swaps lanes
+    const __m256i rev = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8,
+                                         7, 6, 5, 4, 3, 2, 1, 0,
+                                         15, 14, 13, 12, 11, 10, 9, 8,
+                                         7, 6, 5, 4, 3, 2, 1, 0);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*) (src + n - i - 32));
+        x = _mm256_shuffle_epi8(x, rev);
+        x = _mm256_permute2x128_si256(x, x, 1);
+        _mm256_storeu_si256((__m256i*) (dst + i), x);
+    }
+    reverse_portable(dst + i, src, n - i);
+}
+#endif
+
+static void (*reverse_impl)(unsigned char*, const unsigned char*, size_t);
+
+void simd61_reverse(unsigned char* dst, const unsigned char* src, size_t n) {
+    if (!reverse_impl) {
+        reverse_impl = reverse_portable;
+#if SIMD61_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            reverse_impl = reverse_avx2;
+        else if (__builtin_cpu_supports("ssse3"))
+            reverse_impl = reverse_ssse3;
+#endif
+    }
+    reverse_impl(dst, src, n);
+}
+
+
+// simd61_crc32c(crc, p, n)
+//    Extend `crc`, the CRC32C (Castagnoli) checksum of earlier data,
+//    with the `n` bytes at `p`. The checksum of no data is 0. SSE4.2 has
+//    an instruction for this polynomial; the portable version looks up
+//    eight bytes at a time ("slicing-by-8").
+
+#define CRC32C_POLY 0x82F63B78  // reflected
+
+static uint32_t crc32c_table[8][256];
+
+static void crc32c_init_table(void) {
+    for (uint32_t i = 0; i != 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k != 8; ++k)
+            c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        crc32c_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i != 256; ++i)
+        for (int t = 1; t != 8; ++t)
+            crc32c_table[t][i] = (crc32c_table[t - 1][i] >> 8)
+                ^ crc32c_table[0][crc32c_table[t - 1][i] & 0xFF];
+}
+
+static uint32_t crc32c_portable(uint32_t crc, const unsigned char* p,
+                                size_t n) {
+    crc = ~crc;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t x;
+        memcpy(&x, p, 8);
+        x ^= crc;
+        crc = crc32c_table[7][x & 0xFF] ^ crc32c_table[6][(x >> 8) & 0xFF]
+            ^ crc32c_table[5][(x >> 16) & 0xFF]
+            ^ crc32c_table[4][(x >> 24) & 0xFF]
+            ^ crc32c_table[3][(x >> 32) & 0xFF]
+            ^ crc32c_table[2][(x >> 40) & 0xFF]
+            ^ crc32c_table[1][(x >> 48) & 0xFF]
+            ^ crc32c_table[0][x >> 56];
+    }
+#endif
+    for (; n != 0; ++p, --n)
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p) & 0xFF];
+    return ~crc;
+}
+
+#if SIMD61_X86
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char* p,
+                             size_t n) {
+    crc = ~crc;
+#if defined(__x86_64__)
+    uint64_t c = crc;
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t x;
+        memcpy(&x, p, 8);
+        c = _mm_crc32_u64(c, x);
+    }
+    crc = c;
+#endif
+    for (; n >= 4; p += 4, n -= 4) {
+        uint32_t x;
+        memcpy(&x, p, 4);
+        crc = _mm_crc32_u32(crc, x);
+    }
+    for (; n != 0; ++p, --n)
+        crc = _mm_crc32_u8(crc, *p);
+    return ~crc;
+}
+#endif
+
+static uint32_t (*crc32c_impl)(uint32_t, const unsigned char*, size_t);
+
+uint32_t simd61_crc32c(uint32_t crc, const unsigned char* p, size_t n) {
+    if (!crc32c_impl) {
+        crc32c_init_table();
+        crc32c_impl = crc32c_portable;
+#if SIMD61_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse4.2"))
+            crc32c_impl = crc32c_sse42;
+#endif
+    }
+    return crc32c_impl(crc, p, n);
+}
+
+
+// simd61_allzero(p, n)
+//    Return 1 if the `n` bytes at `p` are all zero, 0 otherwise. Data
+//    that isn't zero usually fails in the first vector.
+
+static int allzero_portable(const unsigned char* p, size_t n) {
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t x;
+        memcpy(&x, p, sizeof(x));
+        if (x)
+            return 0;
+    }
+    for (; n != 0; ++p, --n)
+        if (*p)
+            return 0;
+    return 1;
+}
+
+#if SIMD61_X86
+static int allzero_sse2(const unsigned char* p, size_t n) {
+    __m128i zero = _mm_setzero_si128();
+    for (; n >= 64; p += 64, n -= 64) {
+        __m128i x = _mm_or_si128(
+            _mm_or_si128(_mm_loadu_si128((const __m128i*) p),
+                         _mm_loadu_si128((const __m128i*) (p + 16))),
+            _mm_or_si128(_mm_loadu_si128((const __m128i*) (p + 32)),
+                         _mm_loadu_si128((const __m128i*) (p + 48))));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)) != 0xFFFF)
+            return 0;
+    }
+    return allzero_portable(p, n);
+}
+
+__attribute__((target("avx2")))
+static int allzero_avx2(const unsigned char* p, size_t n) {
+    for (; n >= 128; p += 128, n -= 128) {
+        __m256i x = _mm256_or_si256(
+            _mm256_or_si256(_mm256_loadu_si256((const __m256i*) p),
+                            _mm256_loadu_si256((const __m256i*) (p + 32))),
+            _mm256_or_si256(_mm256_loadu_si256((const __m256i*) (p + 64)),
+                            _mm256_loadu_si256((const __m256i*) (p + 96))));
+        if (!_mm256_testz_si256(x, x))
+            return 0;
+    }
+    return allzero_sse2(p, n);
+}
+#endif
+
+static int (*allzero_impl)(const unsigned char*, size_t);
+
+int simd61_allzero(const unsigned char* p, size_t n) {
+    if (!allzero_impl) {
+        allzero_impl = allzero_portable;
+#if SIMD61_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            allzero_impl = allzero_avx2;
+        else if (__builtin_cpu_supports("sse2"))
+            allzero_impl = allzero_sse2;
+#endif
+    }
+    return allzero_impl(p, n);
+}
@@ -0,0 +1,19 @@
+#ifndef SIMD61_H
+#define SIMD61_H
+#include <stddef.h>
+#include <stdint.h>
+
+// simd61.h
+//    Byte-scanning, byte-reversing, zero-testing and checksum kernels
+//    for io61. On x86 they use SSE2, SSSE3, SSE4.2 or AVX2, whichever
+//    the CPU supports, chosen on first use; elsewhere they fall back to
+//    portable loops.
+
+const unsigned char* simd61_memchr(const unsigned char* p, int c, size_t n);
+const unsigned char* simd61_memchr_nth(const unsigned char* p, int c,
+                                       size_t n, size_t* k);
+void simd61_reverse(unsigned char* dst, const unsigned char* src, size_t n);
+uint32_t simd61_crc32c(uint32_t crc, const unsigned char* p, size_t n);
+int simd61_allzero(const unsigned char* p, size_t n);
+
+#endif
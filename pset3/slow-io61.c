@@ -1,8 +1,10 @@
+#define _GNU_SOURCE             // fopencookie
 #include "io61.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <limits.h>
 #include <errno.h>
+#include <poll.h>
 
 // slow-io61.c
 //    This is a copy of the handout version of io61.c.
@@ -13,19 +15,31 @@
 
 struct io61_file {
     int fd;
+    int* fanout;        // io61_fanout: the descriptors after `fd`
+    int nfanout;
+    char* rec;          // io61_records_next: the last record read
+    size_t recsize;
 };
 
 
 // io61_fdopen(fd, mode)
 //    Return a new io61_file for file descriptor `fd`. `mode` is
-//    either O_RDONLY for a read-only file or O_WRONLY for a
-//    write-only file. You need not support read/write files.
+//    O_RDONLY for a read-only file, O_WRONLY for a write-only file, or
+//    O_RDWR for a read/write file. With IO61_NONBLOCK, a pipe or socket
+//    is put in nonblocking mode.
 
 io61_file* io61_fdopen(int fd, int mode) {
     assert(fd >= 0);
     io61_file* f = (io61_file*) malloc(sizeof(io61_file));
     f->fd = fd;
-    (void) mode;
+    f->fanout = NULL;
+    f->nfanout = 0;
+    f->rec = NULL;
+    f->recsize = 0;
+    struct stat s;
+    if ((mode & IO61_NONBLOCK) && (mode & O_ACCMODE) != O_RDWR
+        && fstat(fd, &s) == 0 && !S_ISREG(s.st_mode))
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
     return f;
 }
 
@@ -36,6 +50,11 @@ io61_file* io61_fdopen(int fd, int mode) {
 int io61_close(io61_file* f) {
     io61_flush(f);
     int r = close(f->fd);
+    for (int i = 0; i != f->nfanout; ++i)
+        if (close(f->fanout[i]) < 0)
+            r = -1;
+    free(f->fanout);
+    free(f->rec);
     free(f);
     return r;
 }
@@ -63,6 +82,7 @@ int io61_readc(io61_file* f) {
 
 ssize_t io61_read(io61_file* f, char* buf, size_t sz) {
     size_t nread = 0;
+    errno = 0;
     while (nread != sz) {
         int ch = io61_readc(f);
         if (ch == EOF)
@@ -70,6 +90,9 @@ ssize_t io61_read(io61_file* f, char* buf, size_t sz) {
         buf[nread] = ch;
         ++nread;
     }
+    // A nonblocking file with nothing to read isn't at end of file
+    if (nread == 0 && sz != 0 && errno == EAGAIN)
+        return -1;
     if (nread != 0 || sz == 0 || io61_eof(f))
         return nread;
     else
@@ -84,6 +107,8 @@ ssize_t io61_read(io61_file* f, char* buf, size_t sz) {
 int io61_writec(io61_file* f, int ch) {
     unsigned char buf[1];
     buf[0] = ch;
+    for (int i = 0; i != f->nfanout; ++i)
+        write(f->fanout[i], buf, 1);
     if (write(f->fd, buf, 1) == 1)
         return 0;
     else
@@ -110,6 +135,168 @@ ssize_t io61_write(io61_file* f, const char* buf, size_t sz) {
 }
 
 
+// io61_readline(f, buf, sz), io61_scan(f, delim)
+//    Read up to a newline, or skip past `delim`, one character at a time.
+
+ssize_t io61_readline(io61_file* f, char* buf, size_t sz) {
+    size_t n = 0;
+    int ch;
+    while (n != sz && (ch = io61_readc(f)) != EOF) {
+        buf[n++] = ch;
+        if (ch == '\n')
+            break;
+    }
+    return n;
+}
+
+ssize_t io61_scan(io61_file* f, int delim) {
+    size_t n = 0;
+    int ch;
+    while ((ch = io61_readc(f)) != EOF) {
+        ++n;
+        if (ch == (unsigned char) delim)
+            break;
+    }
+    return n;
+}
+
+
+// io61_read_reverse(f, buf, sz)
+//    Read backwards from the file position one character at a time.
+
+ssize_t io61_read_reverse(io61_file* f, char* buf, size_t sz) {
+    off_t pos = lseek(f->fd, 0, SEEK_CUR);
+    if (pos < 0)
+        return -1;
+    size_t n = 0;
+    for (; n != sz && pos > 0; ++n) {
+        --pos;
+        if (io61_seek(f, pos) < 0)
+            return n ? (ssize_t) n : -1;
+        int ch = io61_readc(f);
+        if (ch == EOF || io61_seek(f, pos) < 0)
+            return n ? (ssize_t) n : -1;
+        buf[n] = ch;
+    }
+    return n;
+}
+
+
+// io61_set_recsize(f, sz), io61_records_next(f, ptr, count)
+//    Read one record per call with io61_read.
+
+int io61_set_recsize(io61_file* f, size_t sz) {
+    if (sz == 0)
+        return -1;
+    f->rec = (char*) realloc(f->rec, sz);
+    f->recsize = sz;
+    return 0;
+}
+
+ssize_t io61_records_next(io61_file* f, const char** ptr, size_t* count) {
+    *count = 0;
+    if (f->recsize == 0)
+        return -1;
+    ssize_t n = io61_read(f, f->rec, f->recsize);
+    *ptr = f->rec;
+    *count = n == (ssize_t) f->recsize;
+    return n;
+}
+
+
+// io61_index_lines(f, every, indexfile), io61_load_line_index(f, indexfile)
+//    Line indexes are not supported. io61_seek_line(f, n) scans for line
+//    `n` from the start of the file every time.
+
+int io61_index_lines(io61_file* f, size_t every, const char* indexfile) {
+    (void) f, (void) every, (void) indexfile;
+    errno = ENOSYS;
+    return -1;
+}
+
+int io61_load_line_index(io61_file* f, const char* indexfile) {
+    (void) f, (void) indexfile;
+    errno = ENOSYS;
+    return -1;
+}
+
+ssize_t io61_seek_line(io61_file* f, size_t n) {
+    if (io61_seek(f, 0) < 0)
+        return -1;
+    size_t i = 0;
+    int ch;
+    while (i != n && (ch = io61_readc(f)) != EOF)
+        i += ch == '\n';
+    return i;
+}
+
+// io61_readv(f, iov, iovcnt), io61_writev(f, iov, iovcnt)
+//    Vectored versions of io61_read and io61_write.
+
+ssize_t io61_readv(io61_file* f, const struct iovec* iov, int iovcnt) {
+    size_t nread = 0;
+    for (int i = 0; i != iovcnt; ++i) {
+        ssize_t n = io61_read(f, (char*) iov[i].iov_base, iov[i].iov_len);
+        if (n < 0)
+            return nread ? (ssize_t) nread : -1;
+        nread += n;
+        if ((size_t) n != iov[i].iov_len)
+            break;
+    }
+    return nread;
+}
+
+ssize_t io61_writev(io61_file* f, const struct iovec* iov, int iovcnt) {
+    size_t nwritten = 0;
+    for (int i = 0; i != iovcnt; ++i) {
+        ssize_t n = io61_write(f, (const char*) iov[i].iov_base,
+                               iov[i].iov_len);
+        if (n < 0)
+            return nwritten ? (ssize_t) nwritten : -1;
+        nwritten += n;
+        if ((size_t) n != iov[i].iov_len)
+            break;
+    }
+    return nwritten;
+}
+
+
+// io61_read_batch(f, ops, n), io61_write_batch(f, ops, n)
+//    Perform each request with a seek and a read or write, in caller
+//    order, then restore the file position.
+
+static ssize_t io61_batch(io61_file* f, int write, io61_batch_op* ops,
+                          size_t n) {
+    off_t pos = lseek(f->fd, 0, SEEK_CUR);
+    if (pos < 0)
+        return -1;
+    ssize_t total = 0;
+    int err = 0;
+    for (size_t i = 0; i != n; ++i) {
+        if (io61_seek(f, ops[i].off) < 0)
+            ops[i].result = -1;
+        else if (write)
+            ops[i].result = io61_write(f, ops[i].buf, ops[i].len);
+        else
+            ops[i].result = io61_read(f, ops[i].buf, ops[i].len);
+        if (ops[i].result < 0)
+            err = 1;
+        else
+            total += ops[i].result;
+    }
+    io61_seek(f, pos);
+    return err && total == 0 ? -1 : total;
+}
+
+ssize_t io61_read_batch(io61_file* f, io61_batch_op* ops, size_t n) {
+    return io61_batch(f, 0, ops, n);
+}
+
+ssize_t io61_write_batch(io61_file* f, io61_batch_op* ops, size_t n) {
+    return io61_batch(f, 1, ops, n);
+}
+
+
 // io61_flush(f)
 //    Forces a write of all buffered data written to `f`.
 //    If `f` was opened read-only, io61_flush(f) may either drop all
@@ -134,6 +321,251 @@ int io61_seek(io61_file* f, off_t pos) {
 }
 
 
+
+// io61_set_bufsize(f, sz)
+//    This version has no buffer, so there is nothing to resize.
+
+int io61_set_bufsize(io61_file* f, size_t sz) {
+    (void) f;
+    return sz == 0 ? -1 : 0;
+}
+
+
+// io61_copy(inf, outf, opts)
+//    Copy data from `inf` to `outf` one character at a time, until end
+//    of file or until `opts->size` bytes have been copied.
+
+ssize_t io61_copy(io61_file* inf, io61_file* outf,
+                  const io61_copy_options* opts) {
+    size_t size = opts ? opts->size : (size_t) -1;
+    char buf[1];
+    size_t ncopied = 0;
+    while (ncopied != size) {
+        ssize_t r = io61_read(inf, buf, 1);
+        if (r < 0 && ncopied == 0)
+            return -1;
+        else if (r <= 0)
+            break;
+        if (io61_write(outf, buf, r) != r)
+            return ncopied ? (ssize_t) ncopied : -1;
+        ncopied += r;
+    }
+    return ncopied;
+}
+
+
+// io61_checksum(f)
+//    This version keeps no checksums.
+
+int64_t io61_checksum(io61_file* f) {
+    (void) f;
+    return -1;
+}
+
+
+// io61_poller_new(), io61_poller_add(p, f, events, data),
+// io61_poller_remove(p, f), io61_poll(p, evs, nevs, timeout),
+// io61_poller_free(p)
+//    This version has no cache, so a file is ready when poll(2) says its
+//    descriptor is.
+
+struct io61_poller {
+    io61_file** files;
+    void** datas;
+    struct pollfd* pfds;
+    size_t nents;
+    size_t capents;
+};
+
+io61_poller* io61_poller_new(void) {
+    return (io61_poller*) calloc(1, sizeof(io61_poller));
+}
+
+int io61_poller_add(io61_poller* p, io61_file* f, int events, void* data) {
+    if (p->nents == p->capents) {
+        p->capents = p->capents ? 2 * p->capents : 16;
+        p->files = (io61_file**) realloc(p->files, sizeof(io61_file*) * p->capents);
+        p->datas = (void**) realloc(p->datas, sizeof(void*) * p->capents);
+        p->pfds = (struct pollfd*) realloc(p->pfds, sizeof(struct pollfd) * p->capents);
+    }
+    p->files[p->nents] = f;
+    p->datas[p->nents] = data;
+    p->pfds[p->nents].fd = f->fd;
+    p->pfds[p->nents].events = (events & IO61_POLLIN ? POLLIN : 0)
+        | (events & IO61_POLLOUT ? POLLOUT : 0);
+    ++p->nents;
+    return 0;
+}
+
+int io61_poller_remove(io61_poller* p, io61_file* f) {
+    for (size_t i = 0; i != p->nents; ++i)
+        if (p->files[i] == f) {
+            --p->nents;
+            p->files[i] = p->files[p->nents];
+            p->datas[i] = p->datas[p->nents];
+            p->pfds[i] = p->pfds[p->nents];
+            return 0;
+        }
+    errno = ENOENT;
+    return -1;
+}
+
+int io61_poll(io61_poller* p, io61_event* evs, int nevs, int timeout) {
+    if (poll(p->pfds, p->nents, timeout) < 0)
+        return -1;
+    int n = 0;
+    for (size_t i = 0; i != p->nents && n < nevs; ++i) {
+        short re = p->pfds[i].revents;
+        int ready = (re & (POLLIN | POLLHUP | POLLERR) ? IO61_POLLIN : 0)
+            | (re & (POLLOUT | POLLERR) ? IO61_POLLOUT : 0);
+        ready &= (p->pfds[i].events & POLLIN ? IO61_POLLIN : 0)
+            | (p->pfds[i].events & POLLOUT ? IO61_POLLOUT : 0);
+        if (ready) {
+            evs[n].f = p->files[i];
+            evs[n].events = ready;
+            evs[n].data = p->datas[i];
+            ++n;
+        }
+    }
+    return n;
+}
+
+void io61_poller_free(io61_poller* p) {
+    free(p->files);
+    free(p->datas);
+    free(p->pfds);
+    free(p);
+}
+
+
+// io61_stats_report(buf, sz)
+//    This version keeps no statistics; every call is a system call.
+
+size_t io61_stats_report(char* buf, size_t sz) {
+    (void) buf, (void) sz;
+    return 0;
+}
+
+// io61_shared_fdopen(fd), io61_pread(s, buf, sz, off)
+//    Shared handles have no cache: every io61_pread is a pread.
+
+struct io61_shared {
+    int fd;
+};
+
+io61_shared* io61_shared_fdopen(int fd) {
+    assert(fd >= 0);
+    io61_shared* s = (io61_shared*) malloc(sizeof(io61_shared));
+    s->fd = fd;
+    return s;
+}
+
+off_t io61_shared_filesize(io61_shared* s) {
+    struct stat st;
+    if (fstat(s->fd, &st) == 0 && S_ISREG(st.st_mode))
+        return st.st_size;
+    return -1;
+}
+
+ssize_t io61_pread(io61_shared* s, char* buf, size_t sz, off_t off) {
+    size_t nread = 0;
+    while (nread != sz) {
+        ssize_t r = pread(s->fd, buf + nread, sz - nread, off + nread);
+        if (r == 0)
+            break;
+        else if (r < 0 && errno != EINTR)
+            return nread ? (ssize_t) nread : -1;
+        else if (r > 0)
+            nread += r;
+    }
+    return nread;
+}
+
+int io61_shared_close(io61_shared* s) {
+    int r = close(s->fd);
+    free(s);
+    return r;
+}
+
+
+// io61_fanout(fds, nfds)
+//    Return a write-only io61_file that writes each character to all
+//    `nfds` descriptors in `fds`, one after another.
+
+io61_file* io61_fanout(const int* fds, int nfds) {
+    if (nfds < 1) {
+        errno = EINVAL;
+        return NULL;
+    }
+    io61_file* f = io61_fdopen(fds[0], O_WRONLY);
+    f->fanout = (int*) malloc(sizeof(int) * nfds);
+    f->nfanout = nfds - 1;
+    memcpy(f->fanout, fds + 1, sizeof(int) * (nfds - 1));
+    return f;
+}
+
+
+// io61_fopen(filename, mode)
+//    Open `filename` as a stdio stream on top of this version's io61
+//    functions. `mode` is as for fopen(3), except that "a+" is not
+//    supported. Returns NULL, with errno set, on failure.
+
+static ssize_t io61_cookie_read(void* cookie, char* buf, size_t sz) {
+    return io61_read((io61_file*) cookie, buf, sz);
+}
+
+static ssize_t io61_cookie_write(void* cookie, const char* buf, size_t sz) {
+    ssize_t n = io61_write((io61_file*) cookie, buf, sz);
+    return n > 0 ? n : 0;
+}
+
+static int io61_cookie_seek(void* cookie, off64_t* off, int whence) {
+    off_t r = lseek(((io61_file*) cookie)->fd, *off, whence);
+    if (r < 0)
+        return -1;
+    *off = r;
+    return 0;
+}
+
+static int io61_cookie_close(void* cookie) {
+    return io61_close((io61_file*) cookie);
+}
+
+FILE* io61_fopen(const char* filename, const char* mode) {
+    int plus = strchr(mode, '+') != NULL;
+    int flags;
+    if (mode[0] == 'r')
+        flags = plus ? O_RDWR : O_RDONLY;
+    else if (mode[0] == 'w')
+        flags = (plus ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC;
+    else if (mode[0] == 'a' && !plus)
+        flags = O_WRONLY | O_CREAT | O_APPEND;
+    else {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (strchr(mode, 'x'))
+        flags |= O_EXCL;
+    int fd = open(filename, flags, 0666);
+    if (fd < 0)
+        return NULL;
+    // Writes land at end of file, so the stream's position starts there
+    if ((flags & O_APPEND) && lseek(fd, 0, SEEK_END) < 0 && errno != ESPIPE) {
+        close(fd);
+        return NULL;
+    }
+    io61_file* f = io61_fdopen(fd, flags & O_ACCMODE);
+    cookie_io_functions_t hooks = {
+        io61_cookie_read, io61_cookie_write,
+        io61_cookie_seek, io61_cookie_close
+    };
+    FILE* stream = fopencookie(f, mode, hooks);
+    if (!stream)
+        io61_close(f);
+    return stream;
+}
+
+
 // You shouldn't need to change these functions.
 
 // io61_open_check(filename, mode)
@@ -145,7 +577,7 @@ int io61_seek(io61_file* f, off_t pos) {
 io61_file* io61_open_check(const char* filename, int mode) {
     int fd;
     if (filename)
-        fd = open(filename, mode, 0666);
+        fd = open(filename, mode & ~IO61_FLAGMASK, 0666);
     else if ((mode & O_ACCMODE) == O_RDONLY)
         fd = STDIN_FILENO;
     else
@@ -154,7 +586,7 @@ io61_file* io61_open_check(const char* filename, int mode) {
         fprintf(stderr, "%s: %s\n", filename, strerror(errno));
         exit(1);
     }
-    return io61_fdopen(fd, mode & O_ACCMODE);
+    return io61_fdopen(fd, mode & (O_ACCMODE | IO61_NONBLOCK));
 }
 
 
@@ -3,37 +3,142 @@
 #include <sys/stat.h>
 #include <limits.h>
 #include <errno.h>
+#include <poll.h>
+#include <endian.h>
+#include "simd61.h"
 
 // stdio-io61.c
 //    This version of io61.c is a simple wrapper on stdio. Can you beat it?
+//    It keeps checksums like io61.c does, so check.pl can compare
+//    outputs by checksum.
 
 
 struct io61_file {
     FILE* f;
+    int mode;
+    int crcstate;       // 1 if checksumming, -1 once that fails
+    uint32_t crc;       // CRC32C of the data so far
+    off_t crcpos;       // bytes checksummed
+    off_t* lindex;      // line index: offsets of every lindex_every'th line
+    size_t lindex_n;
+    size_t lindex_every;
+    FILE** fanout;      // io61_fanout: the streams after `f`
+    int nfanout;
+    char* recbuf;       // io61_records_next: records read ahead
+    size_t recsize;
+    size_t reccap;
+    size_t recoff;      // a partial record left at `recbuf + recoff`
+    size_t reclen;
 };
 
+typedef struct io61_sum {
+    int fd;
+    off_t bytes;
+    uint32_t crc;
+    struct io61_sum* next;
+} io61_sum;
+
+static io61_sum* io61_allsums;
+static io61_sum** io61_sumtail = &io61_allsums;
+
 
 io61_file* io61_fdopen(int fd, int mode) {
     assert(fd >= 0);
     io61_file* f = (io61_file*) malloc(sizeof(io61_file));
-    f->f = fdopen(fd, mode == O_RDONLY ? "r" : "w");
+    int accmode = mode & O_ACCMODE;
+    f->f = fdopen(fd, accmode == O_RDONLY ? "r"
+                  : accmode == O_WRONLY ? "w" : "r+");
+    f->mode = accmode;
+    f->crcstate = ((mode & IO61_CRC) || getenv("IO61_CHECKSUM"))
+        && accmode != O_RDWR;
+    // stdio can't resume a write that failed with EAGAIN, so only
+    // inputs become nonblocking
+    struct stat s;
+    if ((mode & IO61_NONBLOCK) && accmode == O_RDONLY
+        && fstat(fd, &s) == 0 && !S_ISREG(s.st_mode))
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    f->crc = 0;
+    f->crcpos = 0;
+    f->lindex = NULL;
+    f->lindex_n = f->lindex_every = 0;
+    f->fanout = NULL;
+    f->nfanout = 0;
+    f->recbuf = NULL;
+    f->recsize = f->reccap = f->recoff = f->reclen = 0;
+    return f;
+}
+
+// io61_fanout is one stream per descriptor, each written separately
+io61_file* io61_fanout(const int* fds, int nfds) {
+    if (nfds < 1) {
+        errno = EINVAL;
+        return NULL;
+    }
+    io61_file* f = io61_fdopen(fds[0], O_WRONLY);
+    f->fanout = (FILE**) malloc(sizeof(FILE*) * nfds);
+    f->nfanout = nfds - 1;
+    for (int i = 1; i != nfds; ++i)
+        f->fanout[i - 1] = fdopen(fds[i], "w");
     return f;
 }
 
 int io61_close(io61_file* f) {
     io61_flush(f);
+    if (f->mode == O_WRONLY && f->crcstate > 0) {
+        io61_sum* sum = (io61_sum*) malloc(sizeof(io61_sum));
+        sum->fd = fileno(f->f);
+        sum->bytes = f->crcpos;
+        sum->crc = f->crc;
+        sum->next = NULL;
+        *io61_sumtail = sum;
+        io61_sumtail = &sum->next;
+    }
     int r = fclose(f->f);
+    for (int i = 0; i != f->nfanout; ++i)
+        if (fclose(f->fanout[i]) != 0)
+            r = EOF;
+    free(f->fanout);
+    free(f->lindex);
+    free(f->recbuf);
     free(f);
     return r;
 }
 
 
+static inline void io61_crc(io61_file* f, const void* p, size_t n) {
+    if (f->crcstate > 0) {
+        f->crc = simd61_crc32c(f->crc, (const unsigned char*) p, n);
+        f->crcpos += n;
+    }
+}
+
+
+// A nonblocking input that has nothing yet sets the stream's error
+// flag; clear it, so the next read tries again.
+static inline void io61_clear_eagain(io61_file* f) {
+    if (ferror(f->f) && errno == EAGAIN)
+        clearerr(f->f);
+}
+
 int io61_readc(io61_file* f) {
-    return fgetc(f->f);
+    int ch = fgetc(f->f);
+    if (ch == EOF)
+        io61_clear_eagain(f);
+    if (ch != EOF && f->crcstate > 0) {
+        unsigned char c = ch;
+        io61_crc(f, &c, 1);
+    }
+    return ch;
 }
 
 ssize_t io61_read(io61_file* f, char* buf, size_t sz) {
     size_t n = fread(buf, 1, sz, f->f);
+    io61_crc(f, buf, n);
+    if (n == 0 && sz != 0 && ferror(f->f) && errno == EAGAIN) {
+        clearerr(f->f);
+        return (ssize_t) -1;
+    }
+    io61_clear_eagain(f);
     if (n != 0 || sz == 0 || !ferror(f->f))
         return (ssize_t) n;
     else
@@ -42,11 +147,20 @@ ssize_t io61_read(io61_file* f, char* buf, size_t sz) {
 
 
 int io61_writec(io61_file* f, int ch) {
+    if (f->crcstate > 0) {
+        unsigned char c = ch;
+        io61_crc(f, &c, 1);
+    }
+    for (int i = 0; i != f->nfanout; ++i)
+        fputc(ch, f->fanout[i]);
     return fputc(ch, f->f);
 }
 
 ssize_t io61_write(io61_file* f, const char* buf, size_t sz) {
     size_t n = fwrite(buf, 1, sz, f->f);
+    io61_crc(f, buf, n);
+    for (int i = 0; i != f->nfanout; ++i)
+        fwrite(buf, 1, sz, f->fanout[i]);
     if (n != 0 || sz == 0 || !ferror(f->f))
         return (ssize_t) n;
     else
@@ -54,19 +168,516 @@ ssize_t io61_write(io61_file* f, const char* buf, size_t sz) {
 }
 
 
+ssize_t io61_readline(io61_file* f, char* buf, size_t sz) {
+    size_t n = 0;
+    int ch;
+    while (n != sz && (ch = getc(f->f)) != EOF) {
+        buf[n++] = ch;
+        if (ch == '\n')
+            break;
+    }
+    io61_crc(f, buf, n);
+    return n == 0 && ferror(f->f) ? -1 : (ssize_t) n;
+}
+
+ssize_t io61_scan(io61_file* f, int delim) {
+    size_t n = 0;
+    int ch;
+    while ((ch = getc(f->f)) != EOF) {
+        ++n;
+        if (f->crcstate > 0) {
+            unsigned char c = ch;
+            io61_crc(f, &c, 1);
+        }
+        if (ch == (unsigned char) delim)
+            break;
+    }
+    return n == 0 && ferror(f->f) ? -1 : (ssize_t) n;
+}
+
+ssize_t io61_read_reverse(io61_file* f, char* buf, size_t sz) {
+    if (f->crcstate > 0)
+        f->crcstate = -1;
+    off_t pos = ftello(f->f);
+    if (pos < 0)
+        return -1;
+    size_t n = sz < (size_t) pos ? sz : (size_t) pos;
+    if (fseeko(f->f, pos - n, SEEK_SET) != 0
+        || fread(buf, 1, n, f->f) != n
+        || fseeko(f->f, pos - n, SEEK_SET) != 0)
+        return -1;
+    for (size_t i = 0; i < n / 2; ++i) {
+        char ch = buf[i];
+        buf[i] = buf[n - 1 - i];
+        buf[n - 1 - i] = ch;
+    }
+    return n;
+}
+
+
+// Records are fread into a buffer of whole records; a partial record
+// at its end moves to the front for the next call.
+int io61_set_recsize(io61_file* f, size_t sz) {
+    if (sz == 0 || f->reclen != 0)
+        return -1;
+    f->reccap = sz < 65536 ? 65536 - 65536 % sz : sz;
+    f->recbuf = (char*) realloc(f->recbuf, f->reccap);
+    f->recsize = sz;
+    return 0;
+}
+
+ssize_t io61_records_next(io61_file* f, const char** ptr, size_t* count) {
+    *count = 0;
+    if (f->mode == O_WRONLY || f->recsize == 0)
+        return -1;
+    memmove(f->recbuf, f->recbuf + f->recoff, f->reclen);
+    f->recoff = 0;
+    size_t n = f->reclen + fread(f->recbuf + f->reclen, 1,
+                                 f->reccap - f->reclen, f->f);
+    io61_crc(f, f->recbuf + f->reclen, n - f->reclen);
+    size_t whole = n - n % f->recsize;
+    if (whole == 0 && ferror(f->f)) {
+        f->reclen = n;
+        return -1;
+    }
+    *ptr = f->recbuf;
+    *count = whole / f->recsize;
+    if (whole == 0)
+        whole = n;
+    f->recoff = whole;
+    f->reclen = n - whole;
+    return whole;
+}
+
+
+// Line indexes are saved in io61.c's format: a header of little-endian
+// 64-bit words (magic, spacing, line count, data file size and
+// modification time in nanoseconds, entry count), then the entries.
+#define LINDEX_MAGIC 0x0031584C31364F49ULL
+#define LINDEX_HEADER 6
+
+static uint64_t io61_mtime_ns(const struct stat* s) {
+    return (uint64_t) s->st_mtim.tv_sec * 1000000000 + s->st_mtim.tv_nsec;
+}
+
+// Skip `k` newlines; return the number skipped
+static size_t io61_skip_lines(io61_file* f, size_t k) {
+    size_t n = 0;
+    int ch;
+    while (n != k && (ch = getc(f->f)) != EOF)
+        n += ch == '\n';
+    return n;
+}
+
+int io61_index_lines(io61_file* f, size_t every, const char* indexfile) {
+    if (f->mode == O_WRONLY || every == 0 || io61_seek(f, 0) != 0)
+        return -1;
+    size_t n = 1, cap = 256, lines = 0, r;
+    off_t* index = (off_t*) malloc(sizeof(off_t) * cap);
+    index[0] = 0;
+    while ((r = io61_skip_lines(f, every)) == every) {
+        lines += every;
+        if (n == cap) {
+            cap *= 2;
+            index = (off_t*) realloc(index, sizeof(off_t) * cap);
+        }
+        index[n++] = ftello(f->f);
+    }
+    if (ferror(f->f)) {
+        free(index);
+        return -1;
+    }
+    free(f->lindex);
+    f->lindex = index;
+    f->lindex_n = n;
+    f->lindex_every = every;
+    if (!indexfile)
+        return 0;
+
+    struct stat s;
+    FILE* idx = fopen(indexfile, "w");
+    if (!idx)
+        return -1;
+    uint64_t hdr[LINDEX_HEADER] = { LINDEX_MAGIC, every, lines + r, 0, 0, n };
+    if (fstat(fileno(f->f), &s) == 0) {
+        hdr[3] = s.st_size;
+        hdr[4] = io61_mtime_ns(&s);
+    }
+    for (int i = 0; i != LINDEX_HEADER; ++i)
+        hdr[i] = htole64(hdr[i]);
+    fwrite(hdr, sizeof(hdr), 1, idx);
+    for (size_t i = 0; i != n; ++i) {
+        uint64_t x = htole64(index[i]);
+        fwrite(&x, sizeof(x), 1, idx);
+    }
+    return fclose(idx) == 0 ? 0 : -1;
+}
+
+int io61_load_line_index(io61_file* f, const char* indexfile) {
+    struct stat s;
+    if (f->mode == O_WRONLY || fstat(fileno(f->f), &s) != 0)
+        return -1;
+    FILE* idx = fopen(indexfile, "r");
+    if (!idx)
+        return -1;
+    uint64_t hdr[LINDEX_HEADER];
+    off_t* index = NULL;
+    size_t n = 0;
+    int ok = fread(hdr, sizeof(hdr), 1, idx) == 1;
+    for (int i = 0; ok && i != LINDEX_HEADER; ++i)
+        hdr[i] = le64toh(hdr[i]);
+    ok = ok && hdr[0] == LINDEX_MAGIC && hdr[1] != 0
+        && hdr[3] == (uint64_t) s.st_size && hdr[4] == io61_mtime_ns(&s)
+        && hdr[5] != 0 && hdr[5] - 1 <= hdr[2] / hdr[1]
+        && hdr[2] <= (uint64_t) s.st_size;
+    if (ok) {
+        n = hdr[5];
+        index = (off_t*) malloc(sizeof(off_t) * n);
+    }
+    for (size_t i = 0; ok && i != n; ++i) {
+        uint64_t x;
+        ok = fread(&x, sizeof(x), 1, idx) == 1;
+        index[i] = le64toh(x);
+        ok = ok && index[i] <= s.st_size
+            && (i == 0 ? index[i] == 0 : index[i] > index[i - 1]);
+    }
+    fclose(idx);
+    if (!ok) {
+        free(index);
+        errno = EINVAL;
+        return -1;
+    }
+    free(f->lindex);
+    f->lindex = index;
+    f->lindex_n = n;
+    f->lindex_every = hdr[1];
+    return 0;
+}
+
+ssize_t io61_seek_line(io61_file* f, size_t n) {
+    size_t i = 0;
+    if (f->lindex) {
+        i = n / f->lindex_every;
+        if (i >= f->lindex_n)
+            i = f->lindex_n - 1;
+    }
+    if (f->mode == O_WRONLY
+        || io61_seek(f, f->lindex ? f->lindex[i] : 0) != 0)
+        return -1;
+    size_t base = i * f->lindex_every;
+    size_t r = io61_skip_lines(f, n - base);
+    return ferror(f->f) ? -1 : (ssize_t) (base + r);
+}
+
+
+ssize_t io61_readv(io61_file* f, const struct iovec* iov, int iovcnt) {
+    size_t nread = 0;
+    for (int i = 0; i != iovcnt; ++i) {
+        ssize_t n = io61_read(f, (char*) iov[i].iov_base, iov[i].iov_len);
+        if (n < 0)
+            return nread ? (ssize_t) nread : -1;
+        nread += n;
+        if ((size_t) n != iov[i].iov_len)
+            break;
+    }
+    return nread;
+}
+
+ssize_t io61_writev(io61_file* f, const struct iovec* iov, int iovcnt) {
+    size_t nwritten = 0;
+    for (int i = 0; i != iovcnt; ++i) {
+        ssize_t n = io61_write(f, (const char*) iov[i].iov_base,
+                               iov[i].iov_len);
+        if (n < 0)
+            return nwritten ? (ssize_t) nwritten : -1;
+        nwritten += n;
+        if ((size_t) n != iov[i].iov_len)
+            break;
+    }
+    return nwritten;
+}
+
+
+static ssize_t io61_batch(io61_file* f, int write, io61_batch_op* ops,
+                          size_t n) {
+    off_t pos = ftello(f->f);
+    // Batches run outside the checksummed stream, and writes break it
+    int crcstate = f->crcstate;
+    f->crcstate = write && crcstate > 0 ? -1 : 0;
+    ssize_t total = 0;
+    int err = 0;
+    for (size_t i = 0; i != n; ++i) {
+        if (fseeko(f->f, ops[i].off, SEEK_SET) != 0)
+            ops[i].result = -1;
+        else if (write)
+            ops[i].result = io61_write(f, ops[i].buf, ops[i].len);
+        else
+            ops[i].result = io61_read(f, ops[i].buf, ops[i].len);
+        if (ops[i].result < 0)
+            err = 1;
+        else
+            total += ops[i].result;
+    }
+    if (pos >= 0)
+        fseeko(f->f, pos, SEEK_SET);
+    if (!write || crcstate <= 0)
+        f->crcstate = crcstate;
+    return err && total == 0 ? -1 : total;
+}
+
+ssize_t io61_read_batch(io61_file* f, io61_batch_op* ops, size_t n) {
+    return io61_batch(f, 0, ops, n);
+}
+
+ssize_t io61_write_batch(io61_file* f, io61_batch_op* ops, size_t n) {
+    return io61_batch(f, 1, ops, n);
+}
+
+
 int io61_flush(io61_file* f) {
-    return fflush(f->f);
+    int r = fflush(f->f);
+    for (int i = 0; i != f->nfanout; ++i)
+        if (fflush(f->fanout[i]) != 0)
+            r = EOF;
+    return r;
 }
 
 int io61_seek(io61_file* f, off_t pos) {
+    if (f->crcstate > 0 && pos != f->crcpos)
+        f->crcstate = -1;
     return fseek(f->f, pos, SEEK_SET);
 }
 
+int io61_set_bufsize(io61_file* f, size_t sz) {
+    if (sz == 0 || fflush(f->f) != 0)
+        return -1;
+    return setvbuf(f->f, NULL, _IOFBF, sz) == 0 ? 0 : -1;
+}
+
+
+ssize_t io61_copy(io61_file* inf, io61_file* outf,
+                  const io61_copy_options* opts) {
+    size_t size = opts ? opts->size : (size_t) -1;
+    char buf[8192];
+    size_t ncopied = 0;
+    while (ncopied != size) {
+        size_t n = size - ncopied < sizeof(buf) ? size - ncopied : sizeof(buf);
+        ssize_t r = io61_read(inf, buf, n);
+        if (r < 0 && ncopied == 0)
+            return -1;
+        else if (r <= 0)
+            break;
+        if (io61_write(outf, buf, r) != r)
+            return ncopied ? (ssize_t) ncopied : -1;
+        ncopied += r;
+    }
+    return ncopied;
+}
+
+
+// Polling: a file is ready to read if its stdio buffer holds data or
+// poll(2) says so; regular files are always ready. Other inputs stay
+// nonblocking while they are watched, so their buffers can be peeked.
+struct io61_poller {
+    struct io61_pollent {
+        io61_file* f;
+        int events;
+        void* data;
+        int regular;            // 1 for regular files
+        int peek;               // 1 if io61_readable applies
+        int oldfl;              // file status flags to restore, or -1
+        int cached;             // 1 if ready without poll(2)
+    }* ents;
+    struct pollfd* pfds;
+    size_t nents;
+    size_t capents;
+    size_t next;                // where the next scan starts
+};
+
+// io61_readable(f)
+//    Return 1 if reading `f`, whose descriptor is nonblocking, won't
+//    wait: its stdio buffer holds data, or it is at end of file or in
+//    error. stdio doesn't report how much it has buffered, so this
+//    peeks a character and pushes it back.
+
+static int io61_readable(io61_file* f) {
+    int saved_errno = errno;
+    errno = 0;
+    int ch = getc(f->f);
+    int err = errno;
+    errno = saved_errno;
+    if (ch != EOF) {
+        ungetc(ch, f->f);
+        return 1;
+    } else if (ferror(f->f) && (err == EAGAIN || err == EWOULDBLOCK)) {
+        clearerr(f->f);
+        return 0;
+    } else
+        return 1;
+}
+
+io61_poller* io61_poller_new(void) {
+    return (io61_poller*) calloc(1, sizeof(io61_poller));
+}
+
+int io61_poller_add(io61_poller* p, io61_file* f, int events, void* data) {
+    if (p->nents == p->capents) {
+        p->capents = p->capents ? 2 * p->capents : 16;
+        p->ents = realloc(p->ents, sizeof(*p->ents) * p->capents);
+        p->pfds = realloc(p->pfds, sizeof(*p->pfds) * p->capents);
+    }
+    struct io61_pollent* e = &p->ents[p->nents];
+    struct stat s;
+    int fd = fileno(f->f);
+    e->f = f;
+    e->events = events;
+    e->data = data;
+    e->regular = fstat(fd, &s) == 0 && S_ISREG(s.st_mode);
+    e->oldfl = -1;
+    int fl = fcntl(fd, F_GETFL);
+    e->peek = !e->regular && (events & IO61_POLLIN) && f->mode != O_WRONLY
+        && fl >= 0
+        && ((fl & O_NONBLOCK) || fcntl(fd, F_SETFL, fl | O_NONBLOCK) == 0);
+    if (e->peek && !(fl & O_NONBLOCK))
+        e->oldfl = fl;
+    ++p->nents;
+    return 0;
+}
+
+static void io61_pollent_release(struct io61_pollent* e) {
+    if (e->oldfl >= 0)
+        fcntl(fileno(e->f->f), F_SETFL, e->oldfl);
+}
+
+int io61_poller_remove(io61_poller* p, io61_file* f) {
+    for (size_t i = 0; i != p->nents; ++i)
+        if (p->ents[i].f == f) {
+            io61_pollent_release(&p->ents[i]);
+            p->ents[i] = p->ents[p->nents - 1];
+            --p->nents;
+            p->next = 0;
+            return 0;
+        }
+    errno = ENOENT;
+    return -1;
+}
+
+int io61_poll(io61_poller* p, io61_event* evs, int nevs, int timeout) {
+    if (nevs <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    int buffered = 0;
+    for (size_t i = 0; i != p->nents; ++i) {
+        struct io61_pollent* e = &p->ents[i];
+        p->pfds[i].fd = fileno(e->f->f);
+        p->pfds[i].events = (e->events & IO61_POLLIN ? POLLIN : 0)
+            | (e->events & IO61_POLLOUT ? POLLOUT : 0);
+        p->pfds[i].revents = 0;
+        e->cached = e->regular || (e->peek && io61_readable(e->f));
+        buffered = buffered || e->cached;
+    }
+    if (poll(p->pfds, p->nents, buffered ? 0 : timeout) < 0 && !buffered)
+        return -1;
+    int n = 0;
+    for (size_t k = 0; k != p->nents && n != nevs; ++k) {
+        size_t i = (p->next + k) % p->nents;
+        short re = p->pfds[i].revents;
+        int ready = (re & (POLLIN | POLLHUP | POLLERR) ? IO61_POLLIN : 0)
+            | (re & (POLLOUT | POLLERR) ? IO61_POLLOUT : 0);
+        if (p->ents[i].cached)
+            ready = IO61_POLLIN | IO61_POLLOUT;
+        ready &= p->ents[i].events;
+        if (ready) {
+            evs[n].f = p->ents[i].f;
+            evs[n].events = ready;
+            evs[n].data = p->ents[i].data;
+            ++n;
+        }
+    }
+    if (p->nents != 0)
+        p->next = (p->next + 1) % p->nents;
+    return n;
+}
+
+void io61_poller_free(io61_poller* p) {
+    for (size_t i = 0; i != p->nents; ++i)
+        io61_pollent_release(&p->ents[i]);
+    free(p->ents);
+    free(p->pfds);
+    free(p);
+}
+
+
+int64_t io61_checksum(io61_file* f) {
+    return f->crcstate > 0 ? (int64_t) f->crc : -1;
+}
+
+// This version keeps no statistics, so it reports only checksums.
+size_t io61_stats_report(char* buf, size_t sz) {
+    if (!io61_allsums)
+        return 0;
+    size_t len = 0;
+    for (const io61_sum* sum = io61_allsums; sum; sum = sum->next) {
+        int n = snprintf(buf + (len < sz ? len : sz), len < sz ? sz - len : 0,
+                         "%s{\"fd\":%d, \"bytes\":%lld, \"crc32c\":\"%08x\"}",
+                         sum == io61_allsums ? "{\"checksums\":[" : ", ",
+                         sum->fd, (long long) sum->bytes, sum->crc);
+        len += n > 0 ? n : 0;
+    }
+    int n = snprintf(buf + (len < sz ? len : sz), len < sz ? sz - len : 0, "]}");
+    return len + (n > 0 ? n : 0);
+}
+
+
+// Shared files: one stream, locked around each seek and read.
+struct io61_shared {
+    FILE* f;
+};
+
+io61_shared* io61_shared_fdopen(int fd) {
+    assert(fd >= 0);
+    io61_shared* s = (io61_shared*) malloc(sizeof(io61_shared));
+    s->f = fdopen(fd, "r");
+    return s;
+}
+
+off_t io61_shared_filesize(io61_shared* s) {
+    struct stat st;
+    if (fstat(fileno(s->f), &st) == 0 && S_ISREG(st.st_mode))
+        return st.st_size;
+    return -1;
+}
+
+ssize_t io61_pread(io61_shared* s, char* buf, size_t sz, off_t off) {
+    ssize_t n = -1;
+    flockfile(s->f);
+    if (fseeko(s->f, off, SEEK_SET) == 0) {
+        n = fread(buf, 1, sz, s->f);
+        if (n == 0 && sz != 0 && ferror(s->f))
+            n = -1;
+    }
+    funlockfile(s->f);
+    return n;
+}
+
+int io61_shared_close(io61_shared* s) {
+    int r = fclose(s->f);
+    free(s);
+    return r;
+}
+
+
+// io61_fopen is plain fopen here: the baseline is stdio itself.
+FILE* io61_fopen(const char* filename, const char* mode) {
+    return fopen(filename, mode);
+}
+
 
 io61_file* io61_open_check(const char* filename, int mode) {
     int fd;
     if (filename)
-        fd = open(filename, mode, 0666);
+        fd = open(filename, mode & ~IO61_FLAGMASK, 0666);
     else if ((mode & O_ACCMODE) == O_RDONLY)
         fd = STDIN_FILENO;
     else
@@ -75,7 +686,7 @@ io61_file* io61_open_check(const char* filename, int mode) {
         fprintf(stderr, "%s: %s\n", filename, strerror(errno));
         exit(1);
     }
-    return io61_fdopen(fd, mode & O_ACCMODE);
+    return io61_fdopen(fd, mode & (O_ACCMODE | IO61_FLAGMASK));
 }
 
 off_t io61_filesize(io61_file* f) {
@@ -0,0 +1,92 @@
+#include "io61.h"
+#include <sys/stat.h>
+
+// Usage: ./streamcat61 [-l] [-a] [-b BLOCKSIZE] [-t STRIDE] [-o OUTFILE]
+//                      [FILE]
+//    Copies the input FILE to OUTFILE through FILE* streams opened with
+//    io61_fopen, the way code written for stdio would: with -l, a line
+//    at a time with fgets and fputs; otherwise in BLOCKSIZE blocks
+//    (default 4096) with fread and fwrite. If STRIDE is larger than
+//    BLOCKSIZE, FILE is read in stridecat61's strided pattern, moving
+//    with fseeko. Without FILE or OUTFILE, uses standard input or output.
+//    With -a, OUTFILE is opened for appending, and the program fails if
+//    ftello on it doesn't report the end of the file before and after
+//    the copy.
+
+// check_append_position(f, expected)
+//    Exit with an error unless the position of the appending stream `f`
+//    is `expected`.
+
+static void check_append_position(FILE* f, off_t expected) {
+    off_t pos = ftello(f);
+    if (pos != expected) {
+        fprintf(stderr, "streamcat61: append position %lld, expected %lld\n",
+                (long long) pos, (long long) expected);
+        exit(1);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args = io61_parse_arguments(argc, argv, "lab:t:o:");
+    size_t block_size = args.block_size ? args.block_size : 4096;
+
+    // Allocate buffer, open files
+    char* buf = (char*) malloc(block_size);
+
+    io61_profile_begin();
+    const char* inname = args.input_file ? args.input_file : "/dev/stdin";
+    const char* outname = args.output_file ? args.output_file : "/dev/stdout";
+    // An appending stream starts at the end of the existing file
+    struct stat s;
+    off_t start = args.append && stat(outname, &s) == 0
+        && S_ISREG(s.st_mode) ? s.st_size : -1;
+    FILE* inf = io61_fopen(inname, "r");
+    FILE* outf = inf ? io61_fopen(outname, args.append ? "a" : "w") : NULL;
+    if (!inf || !outf) {
+        perror(inf ? outname : inname);
+        exit(1);
+    }
+    if (start >= 0)
+        check_append_position(outf, start);
+
+    if (args.by_line)
+        while (fgets(buf, block_size, inf))
+            fputs(buf, outf);
+    else if (args.stride > block_size) {
+        if (fseeko(inf, 0, SEEK_END) != 0) {
+            fprintf(stderr, "streamcat61: input file is not seekable\n");
+            exit(1);
+        }
+        size_t size = ftello(inf), pos = 0, written = 0;
+        fseeko(inf, 0, SEEK_SET);
+        while (written < size) {
+            size_t amount = fread(buf, 1, block_size, inf);
+            if (amount == 0)
+                break;
+            fwrite(buf, 1, amount, outf);
+            written += amount;
+
+            // Move to the next stride
+            pos += args.stride;
+            if (pos >= size) {
+                pos = (pos % args.stride) + block_size;
+                if (pos + block_size > args.stride)
+                    block_size = args.stride - pos;
+            }
+            fseeko(inf, pos, SEEK_SET);
+        }
+    } else {
+        size_t amount;
+        while ((amount = fread(buf, 1, block_size, inf)) != 0)
+            fwrite(buf, 1, amount, outf);
+    }
+
+    if (start >= 0 && args.stride <= block_size && ftello(inf) >= 0)
+        check_append_position(outf, start + ftello(inf));
+
+    fclose(inf);
+    fclose(outf);
+    io61_profile_end();
+    free(buf);
+}
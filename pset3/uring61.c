@@ -0,0 +1,228 @@
+#include "uring61.h"
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+// uring61.c
+//    io_uring setup, submission and completion. Only one thread may use
+//    a uring61 at a time.
+
+struct uring61 {
+    int fd;
+    unsigned entries;
+    unsigned inflight;          // prepared but not yet reaped
+    unsigned unsubmitted;       // prepared but not yet submitted
+    unsigned sq_tail;           // our copy of the submission tail
+    unsigned* sq_head;
+    unsigned* sq_ktail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+
+
+// uring61_open(entries)
+//    Create a ring with room for `entries` requests in flight. Returns
+//    NULL if io_uring is unavailable (old kernel, seccomp, etc.).
+
+uring61* uring61_open(unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = (int) syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0)
+        return NULL;
+    // IORING_OP_READ/WRITE and offset -1 arrived together in Linux 5.6
+    if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+        close(fd);
+        return NULL;
+    }
+
+    uring61* r = (uring61*) calloc(1, sizeof(uring61));
+    r->fd = fd;
+    r->entries = p.sq_entries;
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_ring_size > r->sq_ring_size)
+            r->sq_ring_size = r->cq_ring_size;
+        r->cq_ring_size = r->sq_ring_size;
+    }
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED)
+        goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->cq_ring = r->sq_ring;
+    else {
+        r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED)
+            goto fail;
+    }
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = (struct io_uring_sqe*) mmap(NULL, r->sqes_size,
+                                          PROT_READ | PROT_WRITE,
+                                          MAP_SHARED | MAP_POPULATE,
+                                          fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        goto fail;
+
+    char* sq = (char*) r->sq_ring;
+    r->sq_head = (unsigned*) (sq + p.sq_off.head);
+    r->sq_ktail = (unsigned*) (sq + p.sq_off.tail);
+    r->sq_mask = (unsigned*) (sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned*) (sq + p.sq_off.array);
+    char* cq = (char*) r->cq_ring;
+    r->cq_head = (unsigned*) (cq + p.cq_off.head);
+    r->cq_tail = (unsigned*) (cq + p.cq_off.tail);
+    r->cq_mask = (unsigned*) (cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+    r->sq_tail = *r->sq_ktail;
+    return r;
+
+ fail:
+    r->sqes = NULL;
+    uring61_close(r);
+    return NULL;
+}
+
+
+// uring61_close(r)
+//    Release the ring. Requests still in flight are abandoned.
+
+void uring61_close(uring61* r) {
+    if (r->sqes && r->sqes != MAP_FAILED)
+        munmap(r->sqes, r->sqes_size);
+    if (r->cq_ring && r->cq_ring != MAP_FAILED && r->cq_ring != r->sq_ring)
+        munmap(r->cq_ring, r->cq_ring_size);
+    if (r->sq_ring && r->sq_ring != MAP_FAILED)
+        munmap(r->sq_ring, r->sq_ring_size);
+    close(r->fd);
+    free(r);
+}
+
+
+// uring61_prep(r, opcode, fd, buf, sz, off, data)
+//    Queue a request without submitting it. `off == -1` means the
+//    file's current position; for the vectored opcodes, `buf` is the
+//    iovec array and `sz` its length. Returns -1 if the ring is full;
+//    the caller should then reap completions and try again.
+
+static int uring61_prep(uring61* r, int opcode, int fd, const void* buf,
+                        size_t sz, off_t off, uint64_t data) {
+    if (r->inflight == r->entries)
+        return -1;
+    unsigned idx = r->sq_tail & *r->sq_mask;
+    struct io_uring_sqe* sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t) buf;
+    sqe->len = sz;
+    sqe->off = (uint64_t) off;
+    sqe->user_data = data;
+    r->sq_array[idx] = idx;
+    ++r->sq_tail;
+    ++r->inflight;
+    ++r->unsubmitted;
+    return 0;
+}
+
+int uring61_prep_read(uring61* r, int fd, void* buf, size_t sz, off_t off,
+                      uint64_t data) {
+    return uring61_prep(r, IORING_OP_READ, fd, buf, sz, off, data);
+}
+
+int uring61_prep_write(uring61* r, int fd, const void* buf, size_t sz,
+                       off_t off, uint64_t data) {
+    return uring61_prep(r, IORING_OP_WRITE, fd, buf, sz, off, data);
+}
+
+int uring61_prep_readv(uring61* r, int fd, const struct iovec* iov,
+                       int iovcnt, off_t off, uint64_t data) {
+    return uring61_prep(r, IORING_OP_READV, fd, iov, iovcnt, off, data);
+}
+
+int uring61_prep_writev(uring61* r, int fd, const struct iovec* iov,
+                        int iovcnt, off_t off, uint64_t data) {
+    return uring61_prep(r, IORING_OP_WRITEV, fd, iov, iovcnt, off, data);
+}
+
+
+// uring61_submit(r, min_complete)
+//    Hand all queued requests to the kernel in one system call, then
+//    wait until at least `min_complete` completions are available.
+//    Returns the number of requests submitted or -1 on error.
+
+int uring61_submit(uring61* r, unsigned min_complete) {
+    if (r->unsubmitted == 0 && min_complete == 0)
+        return 0;
+    __atomic_store_n(r->sq_ktail, r->sq_tail, __ATOMIC_RELEASE);
+    int n;
+    do {
+        n = (int) syscall(__NR_io_uring_enter, r->fd, r->unsubmitted,
+                          min_complete,
+                          min_complete ? IORING_ENTER_GETEVENTS : 0,
+                          NULL, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n > 0)
+        r->unsubmitted -= n;
+    return n;
+}
+
+
+// uring61_unsubmitted(r)
+//    Return the number of requests queued since the last submission.
+
+unsigned uring61_unsubmitted(uring61* r) {
+    return r->unsubmitted;
+}
+
+
+// uring61_unprep(r, data)
+//    Withdraw the most recently queued request that hasn't been
+//    submitted, storing its `data`, and return 1; return 0 if every
+//    request has been submitted. Used to fail requests after
+//    uring61_submit fails.
+
+int uring61_unprep(uring61* r, uint64_t* data) {
+    if (r->unsubmitted == 0)
+        return 0;
+    --r->sq_tail;
+    *data = r->sqes[r->sq_tail & *r->sq_mask].user_data;
+    __atomic_store_n(r->sq_ktail, r->sq_tail, __ATOMIC_RELEASE);
+    --r->inflight;
+    --r->unsubmitted;
+    return 1;
+}
+
+
+// uring61_reap(r, data, res)
+//    Pop one completion, if any. Stores the request's `data` and result
+//    (a byte count or a negative errno) and returns 1; returns 0 if no
+//    completion is ready.
+
+int uring61_reap(uring61* r, uint64_t* data, int* res) {
+    unsigned head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+        return 0;
+    struct io_uring_cqe* cqe = &r->cqes[head & *r->cq_mask];
+    *data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+    --r->inflight;
+    return 1;
+}
@@ -0,0 +1,30 @@
+#ifndef URING61_H
+#define URING61_H
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// uring61.h
+//    A minimal io_uring wrapper that talks to the kernel directly, so
+//    io61 needs no liburing. Requests are queued with uring61_prep_*
+//    and handed to the kernel in batches by uring61_submit.
+
+typedef struct uring61 uring61;
+
+uring61* uring61_open(unsigned entries);
+void uring61_close(uring61* r);
+
+int uring61_prep_read(uring61* r, int fd, void* buf, size_t sz, off_t off,
+                      uint64_t data);
+int uring61_prep_write(uring61* r, int fd, const void* buf, size_t sz,
+                       off_t off, uint64_t data);
+int uring61_prep_readv(uring61* r, int fd, const struct iovec* iov,
+                       int iovcnt, off_t off, uint64_t data);
+int uring61_prep_writev(uring61* r, int fd, const struct iovec* iov,
+                        int iovcnt, off_t off, uint64_t data);
+int uring61_submit(uring61* r, unsigned min_complete);
+unsigned uring61_unsubmitted(uring61* r);
+int uring61_unprep(uring61* r, uint64_t* data);
+int uring61_reap(uring61* r, uint64_t* data, int* res);
+
+#endif